@@ -0,0 +1,546 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "./aot.h"
+#include "./decode.h"
+#include "./hash.h"
+
+#define AOT_VERSION 1 // Bump whenever the generated code changes
+#define AOT_ENTRY_POINT 0x200 // Where init_chip8() puts the ROM
+#define AOT_PATH_MAX (PATH_MAX + 64) // Cache directory plus a module's file name
+#define AOT_LAST_PC 0x0FFE // Instructions at higher addresses wrap around, leave those to the interpreter
+
+// Generated modules export
+//   const uint64_t chip8_aot_key;
+//   int64_t chip8_aot_run(uint8_t *chip8, int64_t budget, const uint8_t *live);
+// which runs blocks from chip8->PC on while the budget covers the next one in
+// full and live[block start] is set, and returns the remaining budget with PC
+// at the first instruction it didn't run.
+typedef int64_t (*aot_run_fn)(uint8_t *chip8, int64_t budget, const uint8_t *live);
+
+typedef struct {
+    uint16_t start;
+    uint16_t insts; // Including the jump, call, return or skip that ends it, if any
+} aot_block_t;
+
+// Basic blocks of a program image; found the same way by the generator and
+// by the loader, which needs them to notice code being overwritten.
+typedef struct {
+    aot_block_t blocks[AOT_IMAGE_SIZE];
+    uint32_t block_count;
+    int16_t block_at[AOT_IMAGE_SIZE]; // Index into blocks, -1 = none starts here
+} aot_program_t;
+
+struct aot {
+    void *handle;
+    aot_run_fn run;
+    aot_program_t program;
+    uint8_t image[AOT_IMAGE_SIZE];
+    uint8_t live[AOT_IMAGE_SIZE]; // Per block start: its bytes in RAM are still the ones it was built from
+    bool covered[AOT_IMAGE_SIZE]; // Bytes some block was translated from
+    bool entry[AOT_IMAGE_SIZE]; // Instructions the module can start at, the rest is always interpreted
+    bool built; // False = loaded from the cache
+    double build_ms;
+    uint64_t native; // Instructions run by the module
+    uint64_t interpreted;
+    uint64_t invalidations;
+};
+
+static uint16_t image_opcode(const uint8_t *image, uint16_t pc) {
+    return image[pc & 0x0FFF] << 8 | image[(pc + 1) & 0x0FFF];
+}
+
+// Instructions with a C translation, i.e. the ones that don't touch the display,
+// the keypad wait or RAM contents; the interpreter runs the rest.
+static bool translatable(const decoded_inst_t *inst) {
+    switch (inst->op) {
+        case OP_SYS: case OP_INVALID: // Both do nothing
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_V0:
+        case OP_SE_VX_NN: case OP_SNE_VX_NN: case OP_SE_VX_VY: case OP_SNE_VX_VY:
+        case OP_SKP: case OP_SKNP:
+        case OP_LD_VX_NN: case OP_ADD_VX_NN: case OP_LD_VX_VY:
+        case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_VX_VY: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_I: case OP_ADD_I_VX: case OP_LD_F_VX: case OP_LD_VX_MEM:
+        case OP_RND:
+        case OP_LD_VX_DT: case OP_LD_DT_VX: case OP_LD_ST_VX:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_skip(uint8_t op) {
+    return op == OP_SE_VX_NN || op == OP_SNE_VX_NN || op == OP_SE_VX_VY || op == OP_SNE_VX_VY
+        || op == OP_SKP || op == OP_SKNP;
+}
+
+// Control leaves the block after these.
+static bool ends_block(uint8_t op) {
+    return op == OP_JP || op == OP_CALL || op == OP_RET || op == OP_JP_V0 || is_skip(op);
+}
+
+static void add_leader(uint16_t pc, bool *leader, uint16_t *work, uint32_t *work_count) {
+    if (pc > AOT_LAST_PC || leader[pc]) return;
+    leader[pc] = true;
+    work[(*work_count)++] = pc;
+}
+
+static void find_blocks(const uint8_t *image, aot_program_t *program) {
+    static _Thread_local bool leader[AOT_IMAGE_SIZE];
+    static _Thread_local bool visited[AOT_IMAGE_SIZE]; // Walked through, but not (yet) known to start a block
+    static _Thread_local uint16_t work[AOT_IMAGE_SIZE];
+    memset(leader, 0, sizeof leader);
+    memset(visited, 0, sizeof visited);
+    uint32_t work_count = 0;
+    // Control flow: every target of a jump, call or skip starts a block, and so
+    // does each return address and whatever follows an instruction the interpreter runs
+    add_leader(AOT_ENTRY_POINT, leader, work, &work_count);
+    while (work_count) {
+        uint16_t pc = work[--work_count];
+        for (;;) {
+            const decoded_inst_t inst = decode_instruction(image_opcode(image, pc));
+            if (inst.op == OP_JP) {
+                add_leader(inst.NNN, leader, work, &work_count);
+            } else if (inst.op == OP_CALL) {
+                add_leader(inst.NNN, leader, work, &work_count);
+                add_leader(pc + 2, leader, work, &work_count);
+            } else if (is_skip(inst.op)) {
+                add_leader(pc + 2, leader, work, &work_count);
+                add_leader(pc + 4, leader, work, &work_count);
+            } else if (!translatable(&inst)) {
+                add_leader(pc + 2, leader, work, &work_count);
+            }
+            if (ends_block(inst.op) || !translatable(&inst)) break;
+            pc += 2;
+            if (pc > AOT_LAST_PC || leader[pc] || visited[pc]) break;
+            visited[pc] = true;
+        }
+    }
+    // Cut the code into blocks at the leaders
+    program->block_count = 0;
+    memset(program->block_at, 0xFF, sizeof program->block_at);
+    for (uint32_t start = 0; start <= AOT_LAST_PC; start++) {
+        if (!leader[start]) continue;
+        uint16_t pc = start;
+        uint32_t insts = 0;
+        for (;;) {
+            const decoded_inst_t inst = decode_instruction(image_opcode(image, pc));
+            if (!translatable(&inst)) break;
+            insts++;
+            pc += 2;
+            if (ends_block(inst.op) || pc > AOT_LAST_PC || leader[pc]) break;
+        }
+        if (!insts) continue; // Starts with an instruction for the interpreter
+        program->block_at[start] = program->block_count;
+        program->blocks[program->block_count++] = (aot_block_t){.start = start, .insts = insts};
+    }
+}
+
+// The module only knows chip8_t through these offsets, so they are part of the cache key.
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint32_t V, reg_i, PC, sp, stack, delay_timer, sound_timer, keypad, ram, rng_state;
+} aot_layout_t;
+
+static aot_layout_t layout(void) {
+    return (aot_layout_t){
+        .version = AOT_VERSION, .size = sizeof(chip8_t),
+        .V = offsetof(chip8_t, V), .reg_i = offsetof(chip8_t, reg_i), .PC = offsetof(chip8_t, PC),
+        .sp = offsetof(chip8_t, sp), .stack = offsetof(chip8_t, stack),
+        .delay_timer = offsetof(chip8_t, delay_timer), .sound_timer = offsetof(chip8_t, sound_timer),
+        .keypad = offsetof(chip8_t, keypad), .ram = offsetof(chip8_t, ram), .rng_state = offsetof(chip8_t, rng_state),
+    };
+}
+
+static uint64_t module_key(const uint8_t *image) {
+    const aot_layout_t fields = layout();
+    return fnv1a64(&fields, sizeof fields, fnv1a64(image, AOT_IMAGE_SIZE, FNV1A64_INIT));
+}
+
+// Continues at pc: straight into its block, or back to the caller when there is none.
+static void emit_goto(FILE *out, const aot_program_t *program, uint16_t pc) {
+    if (pc <= AOT_LAST_PC && program->block_at[pc] >= 0) fprintf(out, "goto b_%03X;", pc);
+    else fprintf(out, "{ PC = 0x%04X; return budget; }", pc);
+}
+
+// One instruction that doesn't end its block, with exactly the interpreter's semantics for plain quirks.
+static void emit_body(FILE *out, const decoded_inst_t *inst) {
+    const unsigned X = inst->X, Y = inst->Y, NN = inst->NNN & 0xFF;
+    fprintf(out, "    "); // Every case prints one line
+    switch (inst->op) {
+        case OP_LD_VX_NN: fprintf(out, "V[%u] = %u;\n", X, NN); break;
+        case OP_ADD_VX_NN: fprintf(out, "V[%u] += %u;\n", X, NN); break;
+        case OP_LD_VX_VY: fprintf(out, "V[%u] = V[%u];\n", X, Y); break;
+        case OP_OR: fprintf(out, "V[%u] |= V[%u];\n", X, Y); break;
+        case OP_AND: fprintf(out, "V[%u] &= V[%u];\n", X, Y); break;
+        case OP_XOR: fprintf(out, "V[%u] ^= V[%u];\n", X, Y); break;
+        // VF is written last, so it wins when X is F
+        case OP_ADD_VX_VY:
+            fprintf(out, "{ unsigned s = V[%u] + V[%u]; V[%u] = s; V[15] = s > 255; }\n", X, Y, X);
+            break;
+        case OP_SUB:
+            fprintf(out, "{ uint8_t f = V[%u] >= V[%u]; V[%u] -= V[%u]; V[15] = f; }\n", X, Y, X, Y);
+            break;
+        case OP_SUBN:
+            fprintf(out, "{ uint8_t f = V[%u] >= V[%u]; V[%u] = V[%u] - V[%u]; V[15] = f; }\n", Y, X, X, Y, X);
+            break;
+        case OP_SHR: fprintf(out, "{ uint8_t v = V[%u]; V[%u] = v >> 1; V[15] = v & 1; }\n", X, X); break;
+        case OP_SHL: fprintf(out, "{ uint8_t v = V[%u]; V[%u] = v << 1; V[15] = v >> 7; }\n", X, X); break;
+        case OP_LD_I: fprintf(out, "I = 0x%03X;\n", inst->NNN); break;
+        case OP_ADD_I_VX: fprintf(out, "I += V[%u];\n", X); break;
+        case OP_LD_F_VX: fprintf(out, "I = (V[%u] & 15) * 5;\n", X); break;
+        case OP_LD_VX_MEM:
+            fprintf(out, "for (int i = 0; i <= %u; i++) V[i] = RAM[(I + i) & 0xFFF]; I += %u;\n", X, X + 1);
+            break;
+        case OP_RND:
+            fprintf(out, "{ uint32_t r = RNG; r ^= r << 13; r ^= r >> 17; r ^= r << 5; RNG = r; V[%u] = (r >> 24) & %u; }\n",
+                X, NN);
+            break;
+        case OP_LD_VX_DT: fprintf(out, "V[%u] = DT;\n", X); break;
+        case OP_LD_DT_VX: fprintf(out, "DT = V[%u];\n", X); break;
+        case OP_LD_ST_VX: fprintf(out, "ST = V[%u];\n", X); break;
+        default: fprintf(out, "; // 0x%04X does nothing\n", inst->opcode); break;
+    }
+}
+
+// The condition under which a skip instruction skips.
+static void emit_skip_condition(FILE *out, const decoded_inst_t *inst) {
+    const unsigned X = inst->X, Y = inst->Y, NN = inst->NNN & 0xFF;
+    switch (inst->op) {
+        case OP_SE_VX_NN: fprintf(out, "V[%u] == %u", X, NN); break;
+        case OP_SNE_VX_NN: fprintf(out, "V[%u] != %u", X, NN); break;
+        case OP_SE_VX_VY: fprintf(out, "V[%u] == V[%u]", X, Y); break;
+        case OP_SNE_VX_VY: fprintf(out, "V[%u] != V[%u]", X, Y); break;
+        case OP_SKP: fprintf(out, "KEYPAD[V[%u] & 15]", X); break;
+        default: fprintf(out, "!KEYPAD[V[%u] & 15]", X); break; // SKNP
+    }
+}
+
+// Whatever ends the block: the jump, call, return or skip, or falling through to the next block.
+static void emit_exit(FILE *out, const aot_program_t *program, const aot_block_t *block, const decoded_inst_t *last) {
+    const uint16_t last_pc = block->start + 2 * (block->insts - 1);
+    fprintf(out, "    ");
+    if (!ends_block(last->op)) {
+        emit_goto(out, program, last_pc + 2);
+    } else if (last->op == OP_JP) {
+        emit_goto(out, program, last->NNN);
+    } else if (last->op == OP_CALL) {
+        fprintf(out, "STACK[SP++] = 0x%04X; ", last_pc + 2);
+        emit_goto(out, program, last->NNN);
+    } else if (last->op == OP_RET) {
+        fprintf(out, "PC = STACK[--SP]; goto dispatch;");
+    } else if (last->op == OP_JP_V0) {
+        fprintf(out, "PC = (uint16_t)(0x%03X + V[0]); goto dispatch;", last->NNN);
+    } else {
+        fprintf(out, "if (");
+        emit_skip_condition(out, last);
+        fprintf(out, ") ");
+        emit_goto(out, program, last_pc + 4);
+        fprintf(out, "\n    ");
+        emit_goto(out, program, last_pc + 2);
+    }
+    fprintf(out, "\n");
+}
+
+void aot_emit_c(const uint8_t image[AOT_IMAGE_SIZE], FILE *out) {
+    static _Thread_local aot_program_t program;
+    find_blocks(image, &program);
+    const aot_layout_t fields = layout();
+    fprintf(out, "// Generated by chip8emu's ahead-of-time recompiler (aot.c); do not edit.\n");
+    fprintf(out, "#include <stdint.h>\n\n");
+    fprintf(out, "#define STACK_SIZE %d\n", STACK_SIZE);
+    fprintf(out, "#define V ((uint8_t *)(c + %u))\n", fields.V);
+    fprintf(out, "#define I (*(uint16_t *)(c + %u))\n", fields.reg_i);
+    fprintf(out, "#define PC (*(uint16_t *)(c + %u))\n", fields.PC);
+    fprintf(out, "#define SP (*(uint8_t *)(c + %u))\n", fields.sp);
+    fprintf(out, "#define STACK ((uint16_t *)(c + %u))\n", fields.stack);
+    fprintf(out, "#define DT (*(uint8_t *)(c + %u))\n", fields.delay_timer);
+    fprintf(out, "#define ST (*(uint8_t *)(c + %u))\n", fields.sound_timer);
+    fprintf(out, "#define KEYPAD ((const uint8_t *)(c + %u))\n", fields.keypad);
+    fprintf(out, "#define RAM ((const uint8_t *)(c + %u))\n", fields.ram);
+    fprintf(out, "#define RNG (*(uint32_t *)(c + %u))\n\n", fields.rng_state);
+    fprintf(out, "const uint64_t chip8_aot_key = 0x%016llxull;\n\n", (unsigned long long)module_key(image));
+    fprintf(out, "int64_t chip8_aot_run(uint8_t *c, int64_t budget, const uint8_t *live) {\n");
+    fprintf(out, "    goto dispatch;\n");
+    // The fast way through each block: one budget check up front
+    for (uint32_t b = 0; b < program.block_count; b++) {
+        const aot_block_t *block = &program.blocks[b];
+        const decoded_inst_t last = decode_instruction(image_opcode(image, block->start + 2 * (block->insts - 1)));
+        const uint32_t body = ends_block(last.op) ? block->insts - 1 : block->insts;
+        // Calls and returns that would fault are left to the interpreter, which reports them.
+        // Only calls and returns move SP and they end blocks, so checking on entry is enough.
+        const char *guard = last.op == OP_CALL ? " || SP >= STACK_SIZE" : last.op == OP_RET ? " || SP == 0" : "";
+        fprintf(out, "b_%03X:\n    if (!live[0x%03X]) { PC = 0x%04X; return budget; }\n",
+            block->start, block->start, block->start);
+        fprintf(out, "    if (budget < %u%s) goto s_%03X;\n", block->insts, guard, block->start);
+        fprintf(out, "    budget -= %u;\n", block->insts);
+        for (uint32_t i = 0; i < body; i++) {
+            const decoded_inst_t inst = decode_instruction(image_opcode(image, block->start + 2 * i));
+            emit_body(out, &inst);
+        }
+        emit_exit(out, &program, block, &last);
+    }
+    // The slow way, checking the budget before every instruction: taken when it runs out
+    // inside the block, to stop right before a call or return that faults, and when a
+    // batch starts in the middle of the block
+    for (uint32_t b = 0; b < program.block_count; b++) {
+        const aot_block_t *block = &program.blocks[b];
+        const uint16_t last_pc = block->start + 2 * (block->insts - 1);
+        const decoded_inst_t last = decode_instruction(image_opcode(image, last_pc));
+        const uint32_t body = ends_block(last.op) ? block->insts - 1 : block->insts;
+        for (uint32_t i = 0; i < body; i++) {
+            const uint16_t pc = block->start + 2 * i;
+            fprintf(out, "s_%03X:\n    if (budget == 0) { PC = 0x%04X; return 0; }\n    budget--;\n", pc, pc);
+            const decoded_inst_t inst = decode_instruction(image_opcode(image, pc));
+            emit_body(out, &inst);
+        }
+        if (!ends_block(last.op)) {
+            emit_exit(out, &program, block, &last);
+            continue;
+        }
+        const char *guard = last.op == OP_CALL ? " || SP >= STACK_SIZE" : last.op == OP_RET ? " || SP == 0" : "";
+        fprintf(out, "s_%03X:\n    if (budget == 0%s) { PC = 0x%04X; return budget; }\n    budget--;\n",
+            last_pc, guard, last_pc);
+        emit_exit(out, &program, block, &last);
+    }
+    // Returns, BNNN and batches that start inside a block come in through here
+    fprintf(out, "dispatch:\n    switch (PC) {\n");
+    for (uint32_t b = 0; b < program.block_count; b++) {
+        const aot_block_t *block = &program.blocks[b];
+        fprintf(out, "        case 0x%03X: goto b_%03X;\n", block->start, block->start);
+        for (uint32_t i = 1; i < block->insts; i++) {
+            fprintf(out, "        case 0x%03X: if (live[0x%03X]) goto s_%03X; return budget;\n",
+                block->start + 2 * i, block->start, block->start + 2 * i);
+        }
+    }
+    fprintf(out, "        default: return budget;\n    }\n}\n");
+}
+
+// Creates path and any missing parents, like mkdir -p.
+static bool make_dirs(const char *path) {
+    char buffer[PATH_MAX];
+    if (snprintf(buffer, sizeof buffer, "%s", path) >= (int)sizeof buffer) return false;
+    for (char *p = buffer + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(buffer, 0755) != 0 && errno != EEXIST) return false;
+        *p = '/';
+    }
+    return mkdir(buffer, 0755) == 0 || errno == EEXIST;
+}
+
+static bool default_cache_dir(char *out, size_t size) {
+    const char *dir = getenv("CHIP8_AOT_CACHE");
+    if (dir && *dir) return snprintf(out, size, "%s", dir) < (int)size;
+    dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir) return snprintf(out, size, "%s/chip8emu/aot", dir) < (int)size;
+    dir = getenv("HOME");
+    if (dir && *dir) return snprintf(out, size, "%s/.cache/chip8emu/aot", dir) < (int)size;
+    return false;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Generates and compiles the module into so_path. Everything is written under
+// names private to this process and renamed into place last, so concurrent
+// runs of the same ROM never see a half written module.
+static bool build_module(const uint8_t *image, const char *dir, const char *name) {
+    static _Atomic uint32_t counter;
+    const uint32_t n = counter++;
+    char c_tmp[AOT_PATH_MAX], so_tmp[AOT_PATH_MAX], c_path[AOT_PATH_MAX], so_path[AOT_PATH_MAX];
+    snprintf(c_tmp, sizeof c_tmp, "%s/%s.%d.%u.c", dir, name, (int)getpid(), n);
+    snprintf(so_tmp, sizeof so_tmp, "%s/%s.%d.%u.so", dir, name, (int)getpid(), n);
+    snprintf(c_path, sizeof c_path, "%s/%s.c", dir, name);
+    snprintf(so_path, sizeof so_path, "%s/%s.so", dir, name);
+    FILE *out = fopen(c_tmp, "w");
+    if (!out) {
+        fprintf(stderr, "Could not write %s\n", c_tmp);
+        return false;
+    }
+    aot_emit_c(image, out);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Could not write %s\n", c_tmp);
+        unlink(c_tmp);
+        return false;
+    }
+    const char *cc = getenv("CC");
+    if (!cc || !*cc) cc = "cc";
+    const pid_t pid = fork();
+    if (pid == 0) {
+        execlp(cc, cc, "-O2", "-shared", "-fPIC", "-fno-strict-aliasing", "-w", "-o", so_tmp, c_tmp, (char *)NULL);
+        _exit(127);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Could not compile %s with %s\n", c_tmp, cc);
+        unlink(c_tmp);
+        unlink(so_tmp);
+        return false;
+    }
+    // The source stays next to the module for anyone curious about what was run
+    rename(c_tmp, c_path);
+    if (rename(so_tmp, so_path) != 0) {
+        fprintf(stderr, "Could not move %s into place\n", so_tmp);
+        unlink(so_tmp);
+        return false;
+    }
+    return true;
+}
+
+// Maps so_path and checks it was generated for this image and layout.
+static bool open_module(aot_t *aot, const char *so_path, uint64_t key) {
+    void *handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return false;
+    const uint64_t *module_key = dlsym(handle, "chip8_aot_key");
+    aot_run_fn run = (aot_run_fn)dlsym(handle, "chip8_aot_run");
+    if (!module_key || !run || *module_key != key) {
+        dlclose(handle);
+        return false;
+    }
+    aot->handle = handle;
+    aot->run = run;
+    return true;
+}
+
+aot_t *aot_load(const uint8_t image[AOT_IMAGE_SIZE], const char *cache_dir) {
+    char dir[PATH_MAX];
+    if (cache_dir) snprintf(dir, sizeof dir, "%s", cache_dir);
+    else if (!default_cache_dir(dir, sizeof dir)) {
+        fprintf(stderr, "No cache directory for AOT modules, set CHIP8_AOT_CACHE\n");
+        return NULL;
+    }
+    if (!make_dirs(dir)) {
+        fprintf(stderr, "Could not create AOT cache directory %s\n", dir);
+        return NULL;
+    }
+    aot_t *aot = calloc(1, sizeof *aot);
+    if (!aot) return NULL;
+    memcpy(aot->image, image, AOT_IMAGE_SIZE);
+    find_blocks(image, &aot->program);
+    const uint64_t key = module_key(image);
+    char name[17], so_path[AOT_PATH_MAX];
+    snprintf(name, sizeof name, "%016llx", (unsigned long long)key);
+    snprintf(so_path, sizeof so_path, "%s/%s.so", dir, name);
+    if (!open_module(aot, so_path, key)) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!build_module(image, dir, name) || !open_module(aot, so_path, key)) {
+            fprintf(stderr, "Could not build an AOT module for this ROM, using the interpreter\n");
+            free(aot);
+            return NULL;
+        }
+        aot->built = true;
+        aot->build_ms = elapsed_ms(&start);
+    }
+    for (uint32_t b = 0; b < aot->program.block_count; b++) {
+        const aot_block_t *block = &aot->program.blocks[b];
+        aot->live[block->start] = true;
+        memset(&aot->covered[block->start], true, 2 * block->insts);
+        for (uint32_t i = 0; i < block->insts; i++) aot->entry[block->start + 2 * i] = true;
+    }
+    return aot;
+}
+
+void aot_destroy(aot_t *aot) {
+    if (!aot) return;
+    dlclose(aot->handle);
+    free(aot);
+}
+
+// A block only runs while RAM still holds the bytes it was translated from.
+static void check_blocks(aot_t *aot, const chip8_t *chip8, uint16_t start, uint16_t len) {
+    for (uint32_t b = 0; b < aot->program.block_count; b++) {
+        const aot_block_t *block = &aot->program.blocks[b];
+        const uint32_t size = 2 * block->insts;
+        if (block->start + size <= start || block->start >= start + len) continue;
+        const bool live = memcmp(&chip8->ram[block->start], &aot->image[block->start], size) == 0;
+        if (aot->live[block->start] && !live) aot->invalidations++;
+        aot->live[block->start] = live;
+    }
+}
+
+void aot_sync(aot_t *aot, const chip8_t *chip8) {
+    check_blocks(aot, chip8, 0, AOT_IMAGE_SIZE);
+}
+
+// Address range [start, start + len) an interpreted instruction is about to write, if any.
+static bool ram_write_range(const chip8_t *chip8, uint16_t *start, uint16_t *len) {
+    const uint16_t opcode = image_opcode(chip8->ram, chip8->PC);
+    if ((opcode & 0xF0FF) == 0xF033) *len = 3;
+    else if ((opcode & 0xF0FF) == 0xF055) *len = ((opcode >> 8) & 0x0F) + 1;
+    else return false;
+    *start = chip8->reg_i;
+    return true;
+}
+
+void aot_run(aot_t *aot, chip8_t *chip8, config_t *config, uint64_t cycles) {
+#if CHIP8_TRACE
+    if (chip8->trace) {
+        emulate_cycles(chip8, config, cycles); // Translated code doesn't emit trace records
+        return;
+    }
+#endif
+    if (!chip8_quirks_plain(&chip8->quirks)) {
+        emulate_cycles(chip8, config, cycles); // The module has the default quirks baked in
+        return;
+    }
+    int64_t budget = cycles;
+    while (budget > 0) {
+        if (config->skip_idle) {
+            const uint32_t skipped = chip8_skip_idle(chip8, budget);
+            budget -= skipped;
+            if (skipped) continue;
+        }
+        if (chip8->PC < AOT_IMAGE_SIZE && aot->entry[chip8->PC]) {
+            const int64_t left = aot->run((uint8_t *)chip8, budget, aot->live);
+            if (left != budget) {
+                chip8->cycles += budget - left;
+                aot->native += budget - left;
+                budget = left;
+                continue;
+            }
+        }
+        // Nothing translated at PC, its block was overwritten or it's a call or return
+        // that faults: interpret one instruction and recheck whatever code it overwrote
+        uint16_t start, len;
+        const bool writes = ram_write_range(chip8, &start, &len);
+        emulate_commands(chip8, config);
+        aot->interpreted++;
+        budget--;
+        if (!writes) continue;
+        for (uint16_t i = 0; i < len; i++) {
+            if (aot->covered[(start + i) & 0x0FFF]) {
+                start &= 0x0FFF;
+                if (start + len > AOT_IMAGE_SIZE) aot_sync(aot, chip8); // Wrapped around the end of RAM
+                else check_blocks(aot, chip8, start, len);
+                break;
+            }
+        }
+    }
+}
+
+void aot_report(const aot_t *aot, FILE *out) {
+    const uint64_t total = aot->native + aot->interpreted;
+    fprintf(out, "aot: %u blocks, module %s", aot->program.block_count, aot->built ? "built" : "loaded from cache");
+    if (aot->built) fprintf(out, " in %.0f ms", aot->build_ms);
+    if (total) {
+        fprintf(out, ", %.1f%% of %llu instructions native, %llu invalidations", 100.0 * aot->native / total,
+            (unsigned long long)total, (unsigned long long)aot->invalidations);
+    }
+    fputc('\n', out);
+}
@@ -0,0 +1,42 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "./chip8.h"
+
+// Ahead-of-time recompiler. Follows the program's control flow from 0x200
+// (jumps, calls, returns and skips), translates every reachable basic block
+// to C and builds the lot into a shared object with the system C compiler.
+// Returns and BNNN jump through a switch over the block addresses inside the
+// generated code. The interpreter runs whatever wasn't translated: sprites,
+// key waits, stores to RAM, and any block whose bytes were overwritten since.
+//
+// Modules are cached on disk keyed by a hash of the program image (and of the
+// chip8_t layout they were generated against), so only the first run of a ROM
+// pays for the compiler. Like the JIT, only plain CHIP-8 quirks are translated.
+//
+// The cache is $CHIP8_AOT_CACHE, else $XDG_CACHE_HOME/chip8emu/aot, else
+// ~/.cache/chip8emu/aot. $CC picks the compiler (a single program, default cc).
+
+#define AOT_IMAGE_SIZE 4096
+
+typedef struct aot aot_t;
+
+// Loads the module for image, the RAM as init_chip8() left it, building and
+// caching it first if needed. cache_dir NULL = the default. NULL on failure,
+// after which callers stay on the interpreter.
+aot_t *aot_load(const uint8_t image[AOT_IMAGE_SIZE], const char *cache_dir);
+void aot_destroy(aot_t *aot);
+// Executes exactly cycles instructions, mixing translated blocks and the
+// interpreter, with the same effect as emulate_cycles().
+void aot_run(aot_t *aot, chip8_t *chip8, config_t *config, uint64_t cycles);
+// Rechecks which blocks still match RAM, e.g. after loading a snapshot.
+void aot_sync(aot_t *aot, const chip8_t *chip8);
+// Writes the C that aot_load() would compile for image.
+void aot_emit_c(const uint8_t image[AOT_IMAGE_SIZE], FILE *out);
+// Prints how the module was obtained and how much of the run it covered.
+void aot_report(const aot_t *aot, FILE *out);
+
+#endif
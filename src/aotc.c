@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./aot.h"
+#include "./chip8.h"
+
+// Ahead-of-time compiler front end: builds (or finds) the cached module for
+// every ROM given, so later runs with --engine aot start without waiting on
+// the C compiler. --emit writes the generated C instead, for inspection.
+
+int main(int argc, char **argv) {
+    const char *cache_dir = NULL;
+    const char *emit_name = NULL;
+    int first_rom = 1;
+    for (; first_rom + 1 < argc && strncmp(argv[first_rom], "--", 2) == 0; first_rom += 2) {
+        if (strcmp(argv[first_rom], "--cache") == 0) cache_dir = argv[first_rom + 1];
+        else if (strcmp(argv[first_rom], "--emit") == 0) emit_name = argv[first_rom + 1];
+        else break;
+    }
+    if (first_rom >= argc || strncmp(argv[first_rom], "--", 2) == 0 || (emit_name && argc - first_rom != 1)) {
+        fprintf(stderr, "Usage %s [--cache DIR] <rom> [rom ...]\n"
+            "       %s --emit FILE <rom>   (FILE - for stdout)\n", argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    if (!chip8) exit(EXIT_FAILURE);
+    int failed = 0;
+    for (int i = first_rom; i < argc; i++) {
+        if (!init_chip8(chip8, argv[i])) {
+            failed++;
+            continue;
+        }
+        if (emit_name) {
+            FILE *out = strcmp(emit_name, "-") == 0 ? stdout : fopen(emit_name, "w");
+            if (!out) {
+                fprintf(stderr, "Could not open %s for writing\n", emit_name);
+                exit(EXIT_FAILURE);
+            }
+            aot_emit_c(chip8->ram, out);
+            if (out != stdout) fclose(out);
+            continue;
+        }
+        aot_t *aot = aot_load(chip8->ram, cache_dir);
+        if (!aot) {
+            failed++;
+            continue;
+        }
+        printf("%s: ", argv[i]);
+        aot_report(aot, stdout);
+        aot_destroy(aot);
+    }
+    free(chip8);
+    return failed ? EXIT_FAILURE : 0;
+}
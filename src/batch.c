@@ -0,0 +1,297 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "./constants.h"
+#include "./chip8.h"
+#include "./input.h"
+#include "./romlib.h"
+
+// Batch runner: runs a list of (ROM, input script, cycle budget) jobs headless
+// across all cores and prints one summary line per job.
+//
+// Job file format, one job per line, tab separated (ROM names may contain spaces):
+//   <rom path>\t<input script or ->\t<cycles>
+// Every ROM is mapped once up front and shared by all the jobs that use it.
+
+typedef struct {
+    char *rom_name;
+    char *input_name; // NULL = no input
+    uint64_t cycles;
+    long rom_index; // In the pool's library, -1 = couldn't be read
+} job_t;
+
+typedef struct {
+    bool ok;
+    uint64_t cycles; // Instructions actually executed
+    uint16_t PC;
+    uint16_t reg_i;
+    uint64_t display_hash;
+    uint64_t state_hash;
+    double elapsed_ms;
+} job_result_t;
+
+// Per-worker job deque. The owner takes from the tail, idle workers steal from
+// the head, so neighbours rarely touch the same end.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+} job_queue_t;
+
+typedef struct {
+    const job_t *jobs;
+    job_result_t *results;
+    job_queue_t *queues;
+    uint32_t worker_count;
+    const romlib_t *library;
+    uint32_t insts_per_second; // From --ips, 0 = the ROM's profile or the default
+    bool seeded;
+    uint32_t seed; // Every job starts from the same seed, so results are reproducible
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    uint32_t id;
+    uint64_t steals;
+} worker_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static bool queue_pop(job_queue_t *queue, size_t *job) {
+    pthread_mutex_lock(&queue->lock);
+    const bool found = queue->tail > queue->head;
+    if (found) *job = queue->jobs[--queue->tail];
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool queue_steal(job_queue_t *queue, size_t *job) {
+    pthread_mutex_lock(&queue->lock);
+    const bool found = queue->tail > queue->head;
+    if (found) *job = queue->jobs[queue->head++];
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void run_job(const job_t *job, job_result_t *result, const pool_t *pool) {
+    const double start = now_ms();
+    *result = (job_result_t){0};
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    input_script_t script = {0};
+    const rom_entry_t *rom = job->rom_index >= 0 ? &pool->library->roms[job->rom_index] : NULL;
+    const rom_profile_t profile = rom ? romlib_profile(pool->library, rom->hash) : (rom_profile_t){0};
+    if (chip8) chip8->quirks = profile.quirks; // Zeroed, i.e. plain CHIP-8, without a profile
+    if (!chip8 || !rom || !romlib_load(rom, chip8)
+        || (job->input_name && !input_script_load(&script, job->input_name))) {
+        free(chip8);
+        return;
+    }
+    // --ips wins over the ROM's profile, which wins over the default
+    uint32_t insts_per_second = pool->insts_per_second;
+    if (!insts_per_second) insts_per_second = profile.insts_per_second;
+    if (!insts_per_second) insts_per_second = INSTRUCTIONS_PER_SECOND;
+    if (insts_per_second < FPS) insts_per_second = FPS;
+    config_t config = {.window_width = 64, .window_height = 32, .scale_factor = 1,
+                       .insts_per_second = insts_per_second, .skip_idle = true};
+    if (pool->seeded) chip8_seed(chip8, pool->seed);
+    // A recorded log replays under the conditions it was made in
+    if (script.rng_state) chip8->rng_state = script.rng_state;
+    if (script.insts_per_second) config.insts_per_second = script.insts_per_second;
+    while (chip8->cycles < job->cycles && chip8->state != QUIT) {
+        uint64_t end = input_script_apply(&script, chip8);
+        if (end > job->cycles) end = job->cycles;
+        run_cycles(chip8, &config, end - chip8->cycles);
+    }
+    result->ok = true;
+    result->cycles = chip8->cycles;
+    result->PC = chip8->PC;
+    result->reg_i = chip8->reg_i;
+    result->display_hash = chip8_display_hash(chip8);
+    result->state_hash = chip8_state_hash(chip8);
+    result->elapsed_ms = now_ms() - start;
+    input_script_free(&script);
+    free(chip8);
+}
+
+static void *worker_main(void *arg) {
+    worker_t *worker = arg;
+    pool_t *pool = worker->pool;
+    size_t job;
+    for (;;) {
+        bool found = queue_pop(&pool->queues[worker->id], &job);
+        // Own queue is empty: try everybody else, starting with our neighbour.
+        // Jobs are never added once the pool runs, so all queues empty means done.
+        for (uint32_t i = 1; !found && i < pool->worker_count; i++) {
+            found = queue_steal(&pool->queues[(worker->id + i) % pool->worker_count], &job);
+            if (found) worker->steals++;
+        }
+        if (!found) return NULL;
+        run_job(&pool->jobs[job], &pool->results[job], pool);
+    }
+}
+
+static void free_jobs(job_t *jobs, size_t count) {
+    for (size_t j = 0; j < count; j++) {
+        free(jobs[j].rom_name);
+        free(jobs[j].input_name);
+    }
+    free(jobs);
+}
+
+static job_t *load_jobs(const char *path, size_t *count) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Job file %s is invalid\n", path);
+        return NULL;
+    }
+    job_t *jobs = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    char line[4096];
+    unsigned line_number = 0;
+    while (fgets(line, sizeof line, file)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *rom = strtok(line, "\t");
+        char *input = strtok(NULL, "\t");
+        char *cycles = strtok(NULL, "\t");
+        if (!rom || !input || !cycles) {
+            fprintf(stderr, "%s:%u: expected '<rom>\\t<input or ->\\t<cycles>'\n", path, line_number);
+            fclose(file);
+            free_jobs(jobs, *count);
+            return NULL;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = realloc(jobs, capacity * sizeof *jobs);
+        }
+        jobs[*count].rom_name = strdup(rom);
+        jobs[*count].input_name = strcmp(input, "-") == 0 ? NULL : strdup(input);
+        jobs[*count].cycles = strtoull(cycles, NULL, 0);
+        (*count)++;
+    }
+    fclose(file);
+    return jobs;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage %s <job_file> [--threads N] [--ips N] [--seed N] [--profiles FILE] [--out FILE]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t insts_per_second = 0;
+    const char *out_name = NULL;
+    const char *profiles_name = NULL;
+    bool seeded = false;
+    uint32_t seed = 0;
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) { // Every option takes a value
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(argv[i], "--threads") == 0) threads = strtol(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--ips") == 0) insts_per_second = strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--out") == 0) out_name = argv[i + 1];
+        else if (strcmp(argv[i], "--profiles") == 0) profiles_name = argv[i + 1];
+        else if (strcmp(argv[i], "--seed") == 0) {
+            seeded = true;
+            seed = strtoul(argv[i + 1], NULL, 0);
+        } else {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (threads < 1) threads = 1;
+    if (insts_per_second && insts_per_second < FPS) insts_per_second = FPS;
+
+    size_t job_count;
+    job_t *jobs = load_jobs(argv[1], &job_count);
+    if (!jobs) exit(EXIT_FAILURE);
+    if ((size_t)threads > job_count) threads = job_count ? job_count : 1;
+    romlib_t library;
+    romlib_init(&library);
+    if (profiles_name && !romlib_load_profiles(&library, profiles_name)) exit(EXIT_FAILURE);
+    for (size_t j = 0; j < job_count; j++) jobs[j].rom_index = romlib_add(&library, jobs[j].rom_name);
+
+    pool_t pool = {
+        .jobs = jobs,
+        .results = calloc(job_count, sizeof(job_result_t)),
+        .queues = calloc(threads, sizeof(job_queue_t)),
+        .worker_count = threads,
+        .library = &library,
+        .insts_per_second = insts_per_second,
+        .seeded = seeded,
+        .seed = seed,
+    };
+    // Deal the jobs out round-robin; stealing evens out whatever imbalance remains
+    for (long w = 0; w < threads; w++) {
+        pthread_mutex_init(&pool.queues[w].lock, NULL);
+        pool.queues[w].jobs = malloc((job_count / threads + 1) * sizeof(size_t));
+    }
+    for (size_t j = 0; j < job_count; j++) {
+        job_queue_t *queue = &pool.queues[j % threads];
+        queue->jobs[queue->tail++] = j;
+    }
+
+    const double start = now_ms();
+    pthread_t *handles = calloc(threads, sizeof *handles);
+    worker_t *workers = calloc(threads, sizeof *workers);
+    for (long w = 0; w < threads; w++) {
+        workers[w] = (worker_t){.pool = &pool, .id = w};
+        pthread_create(&handles[w], NULL, worker_main, &workers[w]);
+    }
+    uint64_t steals = 0;
+    for (long w = 0; w < threads; w++) {
+        pthread_join(handles[w], NULL);
+        steals += workers[w].steals;
+    }
+    const double elapsed = now_ms() - start;
+
+    FILE *out = out_name ? fopen(out_name, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Could not open %s for writing\n", out_name);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "rom\tinput\tstatus\tcycles\tPC\tI\tdisplay_hash\tstate_hash\tms\n");
+    uint64_t total_cycles = 0;
+    size_t failed = 0;
+    for (size_t j = 0; j < job_count; j++) {
+        const job_result_t *r = &pool.results[j];
+        fprintf(out, "%s\t%s\t%s\t%llu\t0x%04X\t0x%04X\t%016llx\t%016llx\t%.2f\n",
+            jobs[j].rom_name, jobs[j].input_name ? jobs[j].input_name : "-", r->ok ? "ok" : "error",
+            (unsigned long long)r->cycles, r->PC, r->reg_i,
+            (unsigned long long)r->display_hash, (unsigned long long)r->state_hash, r->elapsed_ms);
+        total_cycles += r->cycles;
+        failed += !r->ok;
+    }
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "batch: %zu jobs (%zu failed) on %ld threads in %.1f ms, %.1f MIPS, %llu steals\n",
+        job_count, failed, threads, elapsed, total_cycles / elapsed / 1000.0, (unsigned long long)steals);
+    for (long w = 0; w < threads; w++) {
+        pthread_mutex_destroy(&pool.queues[w].lock);
+        free(pool.queues[w].jobs);
+    }
+    free(pool.queues);
+    free(pool.results);
+    free(handles);
+    free(workers);
+    free_jobs(jobs, job_count);
+    romlib_free(&library);
+    return failed ? EXIT_FAILURE : 0;
+}
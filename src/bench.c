@@ -0,0 +1,285 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "./aot.h"
+#include "./constants.h"
+#include "./chip8.h"
+#include "./jit.h"
+#include "./render.h"
+#include "./simd.h"
+
+// Benchmark suite: runs every ROM given on the command line plus synthetic
+// opcode mixes for a fixed instruction count, on the interpreter, the JIT and
+// an AOT module, and prints one JSON object per line so results can be diffed and tracked.
+//
+//   kind "rom"    a ROM from the command line
+//   kind "mix"    ALU-, DXYN- and call/return-heavy programs
+//   kind "class"  a loop of one opcode class, so ns_per_inst is that class's cost
+//   kind "render" the CPU side of update_screen (render_display) per drawn frame, with the SIMD backend used
+//
+// Every run uses the same PRNG seed, so the instruction streams are identical
+// from run to run and machine to machine.
+
+#define BENCH_SEED 0xC8BE
+#define SYNTHETIC_UNITS 64 // Loop body size; the closing jump is 1 in 64+ instructions
+#define SUBROUTINE 0xE00 // Where the synthetic programs keep their subroutine
+#define DATA 0xF00 // Scratch RAM for memory opcodes, clear of the code
+
+typedef enum {
+    ENGINE_INTERPRETER,
+    ENGINE_JIT,
+    ENGINE_AOT,
+    ENGINE_COUNT,
+} engine_t;
+
+static const char *engine_names[] = {"interp", "jit", "aot"};
+
+typedef struct {
+    uint8_t code[4096 - 0x200];
+    size_t size;
+} program_t;
+
+typedef struct {
+    const char *name;
+    const char *kind;
+    void (*emit_unit)(program_t *program, int i); // Emits the i-th unit of the loop body
+} synthetic_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void emit(program_t *program, uint16_t opcode) {
+    program->code[program->size++] = opcode >> 8;
+    program->code[program->size++] = opcode & 0xFF;
+}
+
+// Registers V0-VE; VF is the flag register and would make some units no-ops
+static uint16_t reg(int i) {
+    return (i % 15) & 0x0F;
+}
+
+static void unit_alu(program_t *p, int i) {
+    static const uint8_t kinds[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+    emit(p, 0x8000 | reg(i) << 8 | reg(i + 3) << 4 | kinds[i % sizeof kinds]);
+}
+
+static void unit_imm(program_t *p, int i) {
+    emit(p, (i & 1 ? 0x7000 : 0x6000) | reg(i) << 8 | (i * 37 & 0xFF));
+}
+
+static void unit_skip(program_t *p, int i) {
+    // Registers stay 0, so none of these skip and every one of them is executed
+    emit(p, (i & 1 ? 0x4000 : 0x3000) | reg(i) << 8 | (i & 1 ? 0x00 : 0x01));
+}
+
+static void unit_jump(program_t *p, int i) {
+    (void)i;
+    emit(p, 0x1000 | (0x200 + p->size + 2)); // To the next instruction
+}
+
+static void unit_call(program_t *p, int i) {
+    (void)i;
+    emit(p, 0x2000 | SUBROUTINE); // The subroutine is a bare 00EE
+}
+
+static void unit_draw(program_t *p, int i) {
+    emit(p, 0xD000 | reg(i) << 8 | reg(i + 1) << 4 | (i % 15 + 1));
+}
+
+static void unit_mem(program_t *p, int i) {
+    static const uint16_t ops[] = {0xF033, 0xF755, 0xF765};
+    emit(p, 0xA000 | DATA); // FX55/FX65 advance I, so point it back at the scratch area
+    emit(p, ops[i % 3] | reg(i) << 8);
+}
+
+static void unit_timer(program_t *p, int i) {
+    emit(p, (i & 1 ? 0xF007 : 0xF015) | reg(i) << 8);
+}
+
+static void unit_rand(program_t *p, int i) {
+    emit(p, 0xC0FF | reg(i) << 8);
+}
+
+static void unit_mix_alu(program_t *p, int i) {
+    if (i % 4 == 3) unit_imm(p, i);
+    else unit_alu(p, i);
+}
+
+static void unit_mix_draw(program_t *p, int i) {
+    emit(p, 0xA000 | (i % 16) * 5); // Font digit
+    emit(p, 0xD015);
+    emit(p, 0x7007); // Move on so the sprites land all over the screen
+    emit(p, 0x7103);
+}
+
+static void unit_mix_call(program_t *p, int i) {
+    unit_call(p, i);
+    unit_imm(p, i);
+}
+
+static const synthetic_t synthetics[] = {
+    {"alu", "mix", unit_mix_alu},
+    {"dxyn", "mix", unit_mix_draw},
+    {"call", "mix", unit_mix_call},
+    {"alu", "class", unit_alu},
+    {"imm", "class", unit_imm},
+    {"skip", "class", unit_skip},
+    {"jump", "class", unit_jump},
+    {"call", "class", unit_call},
+    {"draw", "class", unit_draw},
+    {"mem", "class", unit_mem},
+    {"timer", "class", unit_timer},
+    {"rand", "class", unit_rand},
+};
+
+static void build_synthetic(program_t *program, const synthetic_t *synthetic) {
+    memset(program, 0, sizeof *program);
+    for (int i = 0; i < SYNTHETIC_UNITS; i++) synthetic->emit_unit(program, i);
+    emit(program, 0x1200); // Loop forever
+    program->size = SUBROUTINE - 0x200;
+    emit(program, 0x00EE);
+}
+
+// Runs cycles instructions with the timers ticking on emulated time, like the headless runner.
+static void run(chip8_t *chip8, config_t *config, jit_t *jit, aot_t *aot, uint64_t cycles) {
+    if (!jit && !aot) {
+        run_cycles(chip8, config, cycles);
+        return;
+    }
+    const uint64_t end = chip8->cycles + cycles;
+    while (chip8->cycles < end) {
+        const uint64_t tick = chip8_next_tick(chip8->cycles, config->insts_per_second);
+        const uint64_t batch = (tick < end ? tick : end) - chip8->cycles;
+        if (jit) jit_run(jit, chip8, config, batch);
+        else aot_run(aot, chip8, config, batch);
+        if (chip8->cycles == tick) update_timers(chip8);
+    }
+}
+
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void bench_program(FILE *out, const char *name, const char *kind, const uint8_t *rom, size_t rom_size,
+                          config_t *config, engine_t engine, jit_t *jit, uint64_t cycles) {
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    if (!chip8 || !init_chip8_rom(chip8, name, rom, rom_size)) exit(EXIT_FAILURE);
+    chip8_seed(chip8, BENCH_SEED);
+    if (engine != ENGINE_JIT) jit = NULL;
+    if (jit) jit_flush(jit);
+    // Building the module (or finding it in the cache) isn't part of the timing
+    aot_t *aot = engine == ENGINE_AOT ? aot_load(chip8->ram, NULL) : NULL;
+    if (engine == ENGINE_AOT && !aot) {
+        free(chip8);
+        return;
+    }
+    const double start = now_s();
+    run(chip8, config, jit, aot, cycles);
+    const double seconds = now_s() - start;
+    fprintf(out, "{\"name\":");
+    print_json_string(out, name);
+    fprintf(out, ",\"kind\":\"%s\",\"engine\":\"%s\",\"cycles\":%llu,\"seconds\":%.6f,\"mips\":%.2f,"
+        "\"ns_per_inst\":%.3f,\"state_hash\":\"%016llx\"}\n",
+        kind, engine_names[engine], (unsigned long long)chip8->cycles, seconds,
+        chip8->cycles / seconds / 1e6, seconds * 1e9 / chip8->cycles,
+        (unsigned long long)chip8_state_hash(chip8));
+    fflush(out);
+    aot_destroy(aot);
+    free(chip8);
+}
+
+// Times render_display on every frame the ROM actually draws, the way update_screen would see them.
+static void bench_render(FILE *out, const char *name, const uint8_t *rom, size_t rom_size,
+                         config_t *config, uint32_t frames) {
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    if (!chip8 || !init_chip8_rom(chip8, name, rom, rom_size)) exit(EXIT_FAILURE);
+    chip8_seed(chip8, BENCH_SEED);
+    static uint32_t pixels[DISPLAY_HIRES_WIDTH * DISPLAY_HIRES_HEIGHT];
+    static const uint32_t palette[4] = {0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555};
+    double seconds = 0;
+    uint32_t drawn = 0;
+    for (uint32_t f = 0; f < frames; f++) {
+        run_cycles(chip8, config, chip8_next_tick(chip8->cycles, config->insts_per_second) - chip8->cycles);
+        if (!chip8->draw) continue;
+        const double start = now_s();
+        render_display(chip8, pixels, palette);
+        seconds += now_s() - start;
+        chip8->draw = false;
+        drawn++;
+    }
+    fprintf(out, "{\"name\":");
+    print_json_string(out, name);
+    fprintf(out, ",\"kind\":\"render\",\"simd\":\"%s\",\"frames\":%u,\"frames_drawn\":%u,\"ns_per_frame\":%.1f}\n",
+        simd_get()->name, frames, drawn, drawn ? seconds * 1e9 / drawn : 0.0);
+    free(chip8);
+}
+
+static bool read_rom(const char *path, uint8_t *rom, size_t capacity, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Rom file %s is invalid\n", path);
+        return false;
+    }
+    *size = fread(rom, 1, capacity, file);
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint64_t cycles = 20000000;
+    uint32_t render_frames = 20000;
+    const char *out_name = NULL;
+    int first_rom = 1;
+    for (; first_rom + 1 < argc && strncmp(argv[first_rom], "--", 2) == 0; first_rom += 2) {
+        if (strcmp(argv[first_rom], "--cycles") == 0) cycles = strtoull(argv[first_rom + 1], NULL, 0);
+        else if (strcmp(argv[first_rom], "--frames") == 0) render_frames = strtoul(argv[first_rom + 1], NULL, 0);
+        else if (strcmp(argv[first_rom], "--out") == 0) out_name = argv[first_rom + 1];
+        else break;
+    }
+    if (first_rom < argc && strncmp(argv[first_rom], "--", 2) == 0) {
+        fprintf(stderr, "Usage %s [--cycles N] [--frames N] [--out FILE] [rom ...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    FILE *out = out_name ? fopen(out_name, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Could not open %s for writing\n", out_name);
+        exit(EXIT_FAILURE);
+    }
+    config_t config = {.window_width = 64, .window_height = 32, .scale_factor = 1,
+                       .insts_per_second = INSTRUCTIONS_PER_SECOND};
+    jit_t *jit = jit_create();
+
+    for (int i = first_rom; i < argc; i++) {
+        static uint8_t rom[4096];
+        size_t rom_size;
+        if (!read_rom(argv[i], rom, sizeof rom, &rom_size)) exit(EXIT_FAILURE);
+        for (engine_t e = 0; e < ENGINE_COUNT; e++) {
+            if (e == ENGINE_JIT && !jit) continue;
+            bench_program(out, argv[i], "rom", rom, rom_size, &config, e, jit, cycles);
+        }
+        bench_render(out, argv[i], rom, rom_size, &config, render_frames);
+    }
+    for (size_t s = 0; s < sizeof synthetics / sizeof synthetics[0]; s++) {
+        program_t program;
+        build_synthetic(&program, &synthetics[s]);
+        for (engine_t e = 0; e < ENGINE_COUNT; e++) {
+            if (e == ENGINE_JIT && !jit) continue;
+            bench_program(out, synthetics[s].name, synthetics[s].kind, program.code, program.size,
+                &config, e, jit, cycles);
+        }
+    }
+    if (jit) jit_destroy(jit);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,919 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "./constants.h"
+#include "./chip8.h"
+#include "./decode.h"
+#include "./hash.h"
+#include "./profile.h"
+#include "./simd.h"
+#include "./trace.h"
+
+#define ENTRY_POINT 0x200 // CHIP8 roms will be loaded to 0x200
+#define BIG_FONT 0x50 // SUPER-CHIP 8x10 digits, right after the small font
+
+bool chip8_quirks_by_name(const char *name, quirks_t *quirks) {
+    static const struct {
+        const char *name;
+        quirks_t quirks;
+    } profiles[] = {
+        {"chip8", {.model = MODEL_CHIP8}},
+        {"vip", {.model = MODEL_CHIP8, .shift_vy = true, .vf_reset = true}},
+        {"schip", {.model = MODEL_SCHIP, .keep_i = true, .jump_vx = true}},
+        {"xochip", {.model = MODEL_XOCHIP, .shift_vy = true, .wrap_sprites = true}},
+    };
+    for (size_t i = 0; i < sizeof profiles / sizeof profiles[0]; i++) {
+        if (strcmp(name, profiles[i].name) == 0) {
+            *quirks = profiles[i].quirks;
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown quirk profile %s (expected chip8, vip, schip or xochip)\n", name);
+    return false;
+}
+
+bool init_chip8_rom(chip8_t *chip8, const char rom_name[], const uint8_t *rom, size_t rom_size) {
+    const uint16_t ram_mask = chip8->quirks.model == MODEL_XOCHIP ? RAM_SIZE - 1 : 0x0FFF;
+    if (rom_size > (size_t)ram_mask + 1 - ENTRY_POINT) {
+        fprintf(stderr, "Rom size %zu is too big.\n", rom_size);
+        return false;
+    }
+    // Start from a clean machine, so a ROM can also be swapped into one that has been running.
+    // The keypad belongs to the frontend, and the quirks and the trace and profile sinks to the caller.
+    chip8->ram_mask = ram_mask;
+    memset(chip8->ram, 0, sizeof chip8->ram);
+    memset(chip8->display, 0, sizeof chip8->display);
+    chip8->hires = false;
+    chip8->planes = 1;
+    memset(chip8->stack, 0, sizeof chip8->stack);
+    memset(chip8->V, 0, sizeof chip8->V);
+    memset(chip8->flags, 0, sizeof chip8->flags);
+    memset(chip8->audio_pattern, 0, sizeof chip8->audio_pattern);
+    chip8->pitch = 64; // XO-CHIP's default, 4000 Hz
+    chip8->reg_i = 0;
+    chip8->delay_timer = chip8->sound_timer = 0;
+    chip8->key_wait_active = false;
+    chip8->key_wait_key = 0;
+    chip8->cycles = chip8->idle_cycles = 0;
+    chip8->fault = FAULT_NONE;
+    chip8->fault_pc = 0;
+    chip8->state = RUNNING;
+    chip8->PC = ENTRY_POINT; // Start PC at ROM entry point
+    chip8->rom_name = rom_name;
+    chip8->sp = 0;
+    chip8->draw = true; // Make sure the first frame gets shown
+    // Different per instance and per run unless the caller reseeds with chip8_seed()
+    chip8_seed(chip8, (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)chip8);
+    // Load font
+    const uint8_t font[] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+
+    const uint8_t big_font[] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    memcpy(&chip8->ram[0], font, sizeof(font));
+    // Only where FX30 exists, so CHIP-8 RAM (and its state hash) stays as it was
+    if (chip8->quirks.model != MODEL_CHIP8) memcpy(&chip8->ram[BIG_FONT], big_font, sizeof big_font);
+    if (rom_size) memcpy(&chip8->ram[ENTRY_POINT], rom, rom_size); // An empty ROM may have no buffer at all
+    invalidate_icache(chip8); // RAM contents changed under any previous decode
+    return true; // Success
+}
+
+bool init_chip8(chip8_t *chip8, const char rom_name[]) {
+    FILE *rom = fopen(rom_name, "rb");
+    if (!rom) {
+        fprintf(stderr, "Rom file %s is invalid\n", rom_name);
+        return false;
+    };
+    fseek(rom, 0, SEEK_END);
+    const size_t rom_size = ftell(rom);
+    rewind(rom);
+    uint8_t data[RAM_SIZE - ENTRY_POINT];
+    if (rom_size > sizeof data) {
+        fprintf(stderr, "Rom size %zu is too big.\n", rom_size);
+        fclose(rom);
+        return false;
+    }
+    if (rom_size > 0 && fread(data, rom_size, 1, rom) != 1) {
+        fprintf(stderr, "Could not read rom file into chip memory\n");
+        fclose(rom);
+        return false;
+    };
+    fclose(rom);
+    return init_chip8_rom(chip8, rom_name, data, rom_size);
+}
+
+// Any write into RAM may land on code we already decoded, so drop the cached
+// entries for the two instructions that can contain this byte.
+// Only the first 4 KiB can hold code, so writes above that leave the cache alone,
+// bar 0x1000: on XO-CHIP it is the second byte of the instruction at 0xFFF.
+static inline void write_ram(chip8_t *chip8, uint16_t address, uint8_t value) {
+    address &= chip8->ram_mask;
+    chip8->ram[address] = value;
+    if (address > 0x1000) return;
+    if (address < 0x1000) chip8->icache[address].op = OP_UNDECODED;
+    chip8->icache[(address - 1) & 0x0FFF].op = OP_UNDECODED;
+}
+
+// Only the first fault is kept; PC has already moved past the instruction.
+static void fault(chip8_t *chip8, chip8_fault_t kind) {
+    if (chip8->fault != FAULT_NONE) return;
+    chip8->fault = kind;
+    chip8->fault_pc = (chip8->PC - 2) & chip8->ram_mask;
+}
+
+// Stores of count bytes from I on that would run past the end of RAM.
+static inline void check_store(chip8_t *chip8, uint32_t count) {
+    if (chip8->reg_i + count - 1 > chip8->ram_mask) fault(chip8, FAULT_RAM_BOUNDS);
+}
+
+static inline uint8_t read_ram(const chip8_t *chip8, uint16_t address) {
+    return chip8->ram[address & chip8->ram_mask];
+}
+
+// Skips the next instruction, which on XO-CHIP may be the 4 byte F000 NNNN.
+static inline void skip_next(chip8_t *chip8) {
+    const bool long_load = chip8->quirks.model == MODEL_XOCHIP && read_ram(chip8, chip8->PC) == 0xF0
+        && read_ram(chip8, chip8->PC + 1) == 0x00;
+    chip8->PC += long_load ? 4 : 2;
+}
+
+// Bits of a display row that are on screen in the current resolution.
+static inline display_row_t screen_mask(const chip8_t *chip8) {
+    return ~(display_row_t)0 << (DISPLAY_HIRES_WIDTH - chip8_width(chip8));
+}
+
+// xorshift32: a few cycles per call and all of its state lives in the instance,
+// so any number of machines can run side by side.
+static inline uint8_t chip8_rand(chip8_t *chip8) {
+    uint32_t x = chip8->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->rng_state = x;
+    return x >> 24;
+}
+
+const char *chip8_fault_name(uint8_t fault) {
+    switch (fault) {
+        case FAULT_NONE: return "none";
+        case FAULT_STACK_OVERFLOW: return "stack overflow";
+        case FAULT_STACK_UNDERFLOW: return "stack underflow";
+        case FAULT_RAM_BOUNDS: return "store past the end of RAM";
+        case FAULT_PC_BOUNDS: return "code past 0xFFF";
+    }
+    return "unknown";
+}
+
+void chip8_seed(chip8_t *chip8, uint32_t seed) {
+    // murmur3's finalizer spreads the seed over all bits, so small seeds like 1, 2, 3
+    // don't start with a run of near-zero values. xorshift must never start from 0.
+    seed ^= seed >> 16;
+    seed *= 0x85EBCA6Bu;
+    seed ^= seed >> 13;
+    seed *= 0xC2B2AE35u;
+    seed ^= seed >> 16;
+    chip8->rng_state = seed ? seed : 1;
+}
+
+void invalidate_icache(chip8_t *chip8) {
+    memset(chip8->icache, 0, sizeof chip8->icache);
+}
+
+typedef void (*op_handler_t)(chip8_t *chip8, const decoded_inst_t *inst);
+
+static void op_cls(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00E0: Clear screen (the selected planes on XO-CHIP)
+    (void)inst;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (chip8->planes & 1 << plane) memset(chip8->display[plane], 0, sizeof chip8->display[plane]);
+    }
+    chip8->draw = true;
+}
+
+static void op_ret(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00EE: Return from subroutine
+    // Set program counter to last address on subroutine stack ("pop" it off the stack)
+    //   so that next opcode will be gotten from that address.
+    (void)inst;
+    if (chip8->sp == 0) {
+        fault(chip8, FAULT_STACK_UNDERFLOW);
+        return;
+    }
+    chip8->PC = chip8->stack[--chip8->sp];
+}
+
+static void op_nop(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x0NNN: Calls machine code routine (RCA 1802 for COSMAC VIP) at address NNN.
+    // There is no 1802 to run it on, so like most interpreters we ignore it.
+    // Unknown opcodes end up here too.
+    (void)chip8;
+    (void)inst;
+}
+
+static void op_jp(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x1NNN: Jump to NNN
+    chip8->PC = inst->NNN;
+}
+
+static void op_call(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x2NNN: Calls subroutine at NNN.
+    if (chip8->sp < STACK_SIZE) chip8->stack[chip8->sp++] = chip8->PC;
+    else fault(chip8, FAULT_STACK_OVERFLOW);
+    chip8->PC = inst->NNN;
+}
+
+static void op_se_vx_nn(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x3XNN: Skips the next instruction if VX equals NN
+    if (chip8->V[inst->X] == (uint8_t)inst->NNN) skip_next(chip8);
+}
+
+static void op_sne_vx_nn(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x4XNN: Skips the next instruction if VX does not equal NN
+    if (chip8->V[inst->X] != (uint8_t)inst->NNN) skip_next(chip8);
+}
+
+static void op_se_vx_vy(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x5XY0: Skips the next instruction if VX equals VY
+    if (chip8->V[inst->X] == chip8->V[inst->Y]) skip_next(chip8);
+}
+
+static void op_ld_vx_nn(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x6XNN: Set register VX to NN
+    chip8->V[inst->X] = (uint8_t)inst->NNN;
+}
+
+static void op_add_vx_nn(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x7XNN: Adds NN to VX (carry flag is not changed)
+    chip8->V[inst->X] += (uint8_t)inst->NNN;
+}
+
+static void op_ld_vx_vy(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY0: Sets VX to the value of VY
+    chip8->V[inst->X] = chip8->V[inst->Y];
+}
+
+static void op_or(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY1: Sets VX to VX OR VY
+    chip8->V[inst->X] |= chip8->V[inst->Y];
+    if (chip8->quirks.vf_reset) chip8->V[0xF] = 0;
+}
+
+static void op_and(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY2: Sets VX to VX and VY
+    chip8->V[inst->X] &= chip8->V[inst->Y];
+    if (chip8->quirks.vf_reset) chip8->V[0xF] = 0;
+}
+
+static void op_xor(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY3: Sets VX to VX xor VY
+    chip8->V[inst->X] ^= chip8->V[inst->Y];
+    if (chip8->quirks.vf_reset) chip8->V[0xF] = 0;
+}
+
+// For the flag-setting ALU ops VF is written last, so it wins when X is F.
+
+static void op_add_vx_vy(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY4: Adds VY to VX. VF is set to 1 when there's an overflow, and 0 when there is not.
+    const uint16_t sum = chip8->V[inst->X] + chip8->V[inst->Y];
+    chip8->V[inst->X] = (uint8_t)sum;
+    chip8->V[0xF] = sum > 0xFF;
+}
+
+static void op_sub(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY5: Substracts VY from VX. VF is set to 0 when there's an underflow, and 1 when there is not.
+    const bool no_borrow = chip8->V[inst->X] >= chip8->V[inst->Y];
+    chip8->V[inst->X] -= chip8->V[inst->Y];
+    chip8->V[0xF] = no_borrow;
+}
+
+static void op_shr(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY6: Stores the least significant bit of VX in VF and then shifts VX to the right by 1.
+    const uint8_t value = chip8->V[chip8->quirks.shift_vy ? inst->Y : inst->X];
+    const uint8_t lsb = value & 0x01;
+    chip8->V[inst->X] = value >> 1;
+    chip8->V[0xF] = lsb;
+}
+
+static void op_subn(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XY7: Sets VX to VY minus VX. VF is set to 0 when there's an underflow, and 1 when there is not.
+    const bool no_borrow = chip8->V[inst->Y] >= chip8->V[inst->X];
+    chip8->V[inst->X] = chip8->V[inst->Y] - chip8->V[inst->X];
+    chip8->V[0xF] = no_borrow;
+}
+
+static void op_shl(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x8XYE: Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
+    const uint8_t value = chip8->V[chip8->quirks.shift_vy ? inst->Y : inst->X];
+    const uint8_t msb = value >> 7;
+    chip8->V[inst->X] = value << 1;
+    chip8->V[0xF] = msb;
+}
+
+static void op_sne_vx_vy(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x9XY0: Skips the next instruction if VX does not equal VY
+    if (chip8->V[inst->X] != chip8->V[inst->Y]) skip_next(chip8);
+}
+
+static void op_ld_i(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xANNN: Sets I to the address NNN
+    chip8->reg_i = inst->NNN;
+}
+
+static void op_jp_v0(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xBNNN: Jumps to the address NNN plus V0 (plus VX on SUPER-CHIP).
+    chip8->PC = inst->NNN + chip8->V[chip8->quirks.jump_vx ? inst->X : 0];
+}
+
+static void op_rnd(chip8_t *chip8, const decoded_inst_t *inst) {
+    //Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
+    chip8->V[inst->X] = chip8_rand(chip8) & (uint8_t)inst->NNN;
+}
+
+// Sprite rows are read from I on and lined up with the display row in a single shift.
+// Bits pushed past the right edge either fall off (clipping) or come back in on the left.
+
+// The plain CHIP-8 case: an 8 pixel wide sprite on the first plane in low resolution, clipped.
+// Everything happens in the top half of each row, so it stays in 64 bits.
+static uint64_t draw_lores(chip8_t *chip8, uint32_t x_coord, uint32_t y_coord, uint32_t rows) {
+    display_row_t *display = chip8->display[0];
+    uint64_t collision = 0;
+    for (uint32_t i = 0; i < rows && y_coord + i < DISPLAY_HEIGHT; i++) {
+        const uint8_t sprite_data = read_ram(chip8, chip8->reg_i + i);
+        const uint64_t sprite_row = (uint64_t)sprite_data << (DISPLAY_WIDTH - 8) >> x_coord;
+        collision |= (uint64_t)(display[y_coord + i] >> 64) & sprite_row;
+        display[y_coord + i] ^= (display_row_t)sprite_row << 64;
+#if CHIP8_PROFILING
+        if (chip8->profile) {
+            chip8->profile->draw_rows++;
+            chip8->profile->draw_pixels += __builtin_popcount(sprite_data);
+        }
+#endif
+    }
+    return collision;
+}
+
+// Everything else: either resolution, 8 or 16 pixels wide, clipped or wrapped, and with
+// more than one plane selected each plane takes its own sprite, one after the other.
+static display_row_t draw_planes(chip8_t *chip8, uint32_t x_coord, uint32_t y_coord, uint32_t rows,
+                                 uint32_t sprite_width) {
+    const uint32_t width = chip8_width(chip8);
+    const uint32_t height = chip8_height(chip8);
+    const uint32_t bytes = sprite_width / 8;
+    const bool wrap = chip8->quirks.wrap_sprites;
+    const display_row_t screen = screen_mask(chip8);
+    const simd_t *simd = simd_get();
+    // Rows past the bottom edge come back in at the top or are clipped
+    const uint32_t above_edge = rows < height - y_coord ? rows : height - y_coord;
+    const uint32_t drawn = wrap ? rows : above_edge;
+    uint16_t addr = chip8->reg_i;
+    display_row_t collision = 0;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(chip8->planes & 1 << plane)) continue;
+        display_row_t sprite[16];
+        for (uint32_t i = 0; i < drawn; i++) {
+            const uint16_t row_addr = addr + i * bytes;
+            const uint32_t sprite_data = bytes == 2 ? read_ram(chip8, row_addr) << 8 | read_ram(chip8, row_addr + 1)
+                                                    : read_ram(chip8, row_addr);
+            const display_row_t aligned = (display_row_t)sprite_data << (DISPLAY_HIRES_WIDTH - sprite_width);
+            sprite[i] = aligned >> x_coord & screen;
+            if (wrap && x_coord + sprite_width > width) sprite[i] |= aligned << (width - x_coord);
+#if CHIP8_PROFILING
+            if (chip8->profile) {
+                chip8->profile->draw_rows++;
+                chip8->profile->draw_pixels += __builtin_popcount(sprite_data);
+            }
+#endif
+        }
+        display_row_t *display = chip8->display[plane];
+        collision |= simd->xor_rows(&display[y_coord], sprite, above_edge);
+        if (drawn > above_edge) collision |= simd->xor_rows(display, &sprite[above_edge], drawn - above_edge);
+        addr += rows * bytes;
+    }
+    return collision;
+}
+
+static void op_drw(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xDXYN - Draw N-height sprite at coords X, Y; Read from memory location I
+    // Screen pixels are XOR'd with sprite bits,
+    // VF (Carry flag) is set if any screen pixels are set off; This is usefult for
+    // collision detection or other reasons
+    // DXY0 is a 16x16 sprite of two bytes per row on SUPER-CHIP and XO-CHIP.
+    const uint32_t x_coord = chip8->V[inst->X] & (chip8_width(chip8) - 1); // Both sizes are powers of two
+    const uint32_t y_coord = chip8->V[inst->Y] & (chip8_height(chip8) - 1);
+    const bool big = inst->N == 0 && chip8->quirks.model != MODEL_CHIP8;
+    bool collision;
+    chip8->draw = true;
+    if (!chip8->hires && chip8->planes == 1 && !big && !chip8->quirks.wrap_sprites) {
+        collision = draw_lores(chip8, x_coord, y_coord, inst->N) != 0;
+    } else {
+        collision = draw_planes(chip8, x_coord, y_coord, big ? 16 : inst->N, big ? 16 : 8) != 0;
+    }
+    chip8->V[0xF] = collision;
+#if CHIP8_PROFILING
+    if (chip8->profile) chip8->profile->draw_collisions += collision;
+#endif
+}
+
+static void op_skp(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xEX9E: Skip next instruction if key in VX is pressed
+    if (chip8->keypad[chip8->V[inst->X] & 0x0F]) skip_next(chip8);
+}
+
+static void op_sknp(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xEXA1: Skip next instruction if key in VX is not pressed
+    if (!chip8->keypad[chip8->V[inst->X] & 0x0F]) skip_next(chip8);
+}
+
+static void op_ld_vx_dt(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX07: Sets VX to the value of the delay timer.
+    chip8->V[inst->X] = chip8->delay_timer;
+}
+
+static void op_ld_vx_k(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX0A: A key press is awaited, and then stored in VX.
+    // Like the original interpreter, the key only counts once it is released again.
+    for (uint8_t i = 0; !chip8->key_wait_active && i < sizeof chip8->keypad; i++) {
+        if (chip8->keypad[i]) {
+            chip8->key_wait_key = i;
+            chip8->key_wait_active = true;
+        }
+    }
+    if (!chip8->key_wait_active || chip8->keypad[chip8->key_wait_key]) {
+        chip8->PC -= 2; // Keep executing this instruction until the key goes up
+        return;
+    }
+    chip8->V[inst->X] = chip8->key_wait_key;
+    chip8->key_wait_active = false;
+}
+
+static void op_ld_dt_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX15: Sets the delay timer to VX
+    chip8->delay_timer = chip8->V[inst->X];
+}
+
+static void op_ld_st_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX18: Sets the sound timer to VX.
+    chip8->sound_timer = chip8->V[inst->X];
+}
+
+static void op_add_i_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX1E: Adds VX to I. VF is not affected.
+    chip8->reg_i += chip8->V[inst->X];
+}
+
+static void op_ld_f_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX29: Sets I to the location of the sprite for the character in VX.
+    chip8->reg_i = (chip8->V[inst->X] & 0x0F) * 5;
+}
+
+static void op_ld_b_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX33: Stores the binary-coded decimal representation of VX,
+    // with the hundreds digit in memory at location in I,
+    // the tens digit at location I+1, and the ones digit at location I+2
+    uint8_t bcd = chip8->V[inst->X];
+    check_store(chip8, 3);
+    write_ram(chip8, chip8->reg_i + 2, bcd % 10);
+    bcd /= 10;
+    write_ram(chip8, chip8->reg_i + 1, bcd % 10);
+    bcd /= 10;
+    write_ram(chip8, chip8->reg_i, bcd);
+}
+
+static void op_ld_mem_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX55: Stores from V0 to VX (including VX) in memory, starting at address I
+    check_store(chip8, inst->X + 1);
+    for (uint8_t i = 0; i <= inst->X; i++) {
+        write_ram(chip8, chip8->reg_i + i, chip8->V[i]);
+    }
+    if (!chip8->quirks.keep_i) chip8->reg_i += inst->X + 1;
+}
+
+static void op_ld_vx_mem(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX65: Register load V0-VX inclusive from memory offset from I;
+    //   SCHIP does not increment I, CHIP8 does increment I
+    for (uint8_t i = 0; i <= inst->X; i++) {
+        chip8->V[i] = read_ram(chip8, chip8->reg_i + i);
+    }
+    if (!chip8->quirks.keep_i) chip8->reg_i += inst->X + 1;
+}
+
+// SUPER-CHIP and XO-CHIP instructions. On a model that doesn't have them they
+// stay the no-ops they always were, so CHIP-8 programs run exactly as before.
+
+static bool has_schip(const chip8_t *chip8) {
+    return chip8->quirks.model != MODEL_CHIP8;
+}
+
+static bool has_xochip(const chip8_t *chip8) {
+    return chip8->quirks.model == MODEL_XOCHIP;
+}
+
+// Vertical scrolls move whole rows; lines scrolled in from the edge are blank.
+static void scroll_rows(chip8_t *chip8, int32_t rows) {
+    const uint32_t height = chip8_height(chip8);
+    uint32_t n = rows < 0 ? (uint32_t)-rows : (uint32_t)rows;
+    if (n > height) n = height;
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!(chip8->planes & 1 << plane)) continue;
+        display_row_t *display = chip8->display[plane];
+        if (rows > 0) {
+            memmove(&display[n], &display[0], (height - n) * sizeof *display);
+            memset(&display[0], 0, n * sizeof *display);
+        } else {
+            memmove(&display[0], &display[n], (height - n) * sizeof *display);
+            memset(&display[height - n], 0, n * sizeof *display);
+        }
+    }
+    chip8->draw = true;
+}
+
+// Horizontal scrolls shift each row as a whole; bits pushed off screen are dropped.
+static void scroll_columns(chip8_t *chip8, bool right) {
+    const display_row_t screen = screen_mask(chip8);
+    const simd_t *simd = simd_get();
+    for (uint8_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (chip8->planes & 1 << plane) simd->shift_rows(chip8->display[plane], DISPLAY_HIRES_HEIGHT, right, screen);
+    }
+    chip8->draw = true;
+}
+
+static void op_scd(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00CN: Scroll the display down by N lines
+    if (has_schip(chip8)) scroll_rows(chip8, inst->N);
+}
+
+static void op_scu(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00DN: Scroll the display up by N lines (XO-CHIP)
+    if (has_xochip(chip8)) scroll_rows(chip8, -(int32_t)inst->N);
+}
+
+static void op_scr(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00FB: Scroll the display right by 4 pixels
+    (void)inst;
+    if (has_schip(chip8)) scroll_columns(chip8, true);
+}
+
+static void op_scl(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00FC: Scroll the display left by 4 pixels
+    (void)inst;
+    if (has_schip(chip8)) scroll_columns(chip8, false);
+}
+
+static void op_exit(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00FD: Exit the interpreter. The last frame stays up and the machine halts here,
+    // which the idle skipping fast-forwards through like any other halt.
+    (void)inst;
+    if (has_schip(chip8)) chip8->PC -= 2;
+}
+
+static void set_resolution(chip8_t *chip8, bool hires) {
+    if (!has_schip(chip8)) return;
+    chip8->hires = hires;
+    memset(chip8->display, 0, sizeof chip8->display); // Both planes, whatever is selected
+    chip8->draw = true;
+}
+
+static void op_low(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00FE: Switch to 64x32 and clear the display
+    (void)inst;
+    set_resolution(chip8, false);
+}
+
+static void op_high(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x00FF: Switch to 128x64 and clear the display
+    (void)inst;
+    set_resolution(chip8, true);
+}
+
+static void op_ld_hf_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX30: Sets I to the 8x10 sprite for the digit in VX
+    if (has_schip(chip8)) chip8->reg_i = BIG_FONT + (chip8->V[inst->X] & 0x0F) * 10;
+}
+
+static void op_ld_r_vx(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX75: Stores V0 to VX in the flag registers
+    if (has_schip(chip8)) memcpy(chip8->flags, chip8->V, inst->X + 1);
+}
+
+static void op_ld_vx_r(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX85: Loads V0 to VX from the flag registers
+    if (has_schip(chip8)) memcpy(chip8->V, chip8->flags, inst->X + 1);
+}
+
+static void op_save_vx_vy(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x5XY2: Stores VX to VY (in either order) in memory from I on; I is not changed
+    if (!has_xochip(chip8)) return;
+    const int step = inst->X <= inst->Y ? 1 : -1;
+    check_store(chip8, (inst->X <= inst->Y ? inst->Y - inst->X : inst->X - inst->Y) + 1);
+    for (int i = 0, reg = inst->X;; i++, reg += step) {
+        write_ram(chip8, chip8->reg_i + i, chip8->V[reg]);
+        if (reg == inst->Y) break;
+    }
+}
+
+static void op_load_vx_vy(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0x5XY3: Loads VX to VY (in either order) from memory from I on; I is not changed
+    if (!has_xochip(chip8)) return;
+    const int step = inst->X <= inst->Y ? 1 : -1;
+    for (int i = 0, reg = inst->X;; i++, reg += step) {
+        chip8->V[reg] = read_ram(chip8, chip8->reg_i + i);
+        if (reg == inst->Y) break;
+    }
+}
+
+static void op_ld_i_long(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xF000 NNNN: Sets I to the 16 bit address in the next word
+    (void)inst;
+    if (!has_xochip(chip8)) return;
+    chip8->reg_i = read_ram(chip8, chip8->PC) << 8 | read_ram(chip8, chip8->PC + 1);
+    chip8->PC += 2;
+}
+
+static void op_plane(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFN01: Selects the bitplanes (0-3) later drawing, clearing and scrolling act on
+    if (has_xochip(chip8)) chip8->planes = inst->X & 0x03;
+}
+
+static void op_audio(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xF002: Loads the 16 byte audio pattern from I
+    (void)inst;
+    if (!has_xochip(chip8)) return;
+    for (uint8_t i = 0; i < sizeof chip8->audio_pattern; i++) chip8->audio_pattern[i] = read_ram(chip8, chip8->reg_i + i);
+}
+
+static void op_pitch(chip8_t *chip8, const decoded_inst_t *inst) {
+    // 0xFX3A: Sets the audio pattern playback pitch to VX
+    if (has_xochip(chip8)) chip8->pitch = chip8->V[inst->X];
+}
+
+static const op_handler_t handlers[OP_COUNT] = {
+    [OP_CLS] = op_cls,
+    [OP_RET] = op_ret,
+    [OP_SYS] = op_nop,
+    [OP_JP] = op_jp,
+    [OP_CALL] = op_call,
+    [OP_SE_VX_NN] = op_se_vx_nn,
+    [OP_SNE_VX_NN] = op_sne_vx_nn,
+    [OP_SE_VX_VY] = op_se_vx_vy,
+    [OP_LD_VX_NN] = op_ld_vx_nn,
+    [OP_ADD_VX_NN] = op_add_vx_nn,
+    [OP_LD_VX_VY] = op_ld_vx_vy,
+    [OP_OR] = op_or,
+    [OP_AND] = op_and,
+    [OP_XOR] = op_xor,
+    [OP_ADD_VX_VY] = op_add_vx_vy,
+    [OP_SUB] = op_sub,
+    [OP_SHR] = op_shr,
+    [OP_SUBN] = op_subn,
+    [OP_SHL] = op_shl,
+    [OP_SNE_VX_VY] = op_sne_vx_vy,
+    [OP_LD_I] = op_ld_i,
+    [OP_JP_V0] = op_jp_v0,
+    [OP_RND] = op_rnd,
+    [OP_DRW] = op_drw,
+    [OP_SKP] = op_skp,
+    [OP_SKNP] = op_sknp,
+    [OP_LD_VX_DT] = op_ld_vx_dt,
+    [OP_LD_VX_K] = op_ld_vx_k,
+    [OP_LD_DT_VX] = op_ld_dt_vx,
+    [OP_LD_ST_VX] = op_ld_st_vx,
+    [OP_ADD_I_VX] = op_add_i_vx,
+    [OP_LD_F_VX] = op_ld_f_vx,
+    [OP_LD_B_VX] = op_ld_b_vx,
+    [OP_LD_MEM_VX] = op_ld_mem_vx,
+    [OP_LD_VX_MEM] = op_ld_vx_mem,
+    [OP_SCD] = op_scd,
+    [OP_SCR] = op_scr,
+    [OP_SCL] = op_scl,
+    [OP_EXIT] = op_exit,
+    [OP_LOW] = op_low,
+    [OP_HIGH] = op_high,
+    [OP_LD_HF_VX] = op_ld_hf_vx,
+    [OP_LD_R_VX] = op_ld_r_vx,
+    [OP_LD_VX_R] = op_ld_vx_r,
+    [OP_SCU] = op_scu,
+    [OP_SAVE_VX_VY] = op_save_vx_vy,
+    [OP_LOAD_VX_VY] = op_load_vx_vy,
+    [OP_LD_I_LONG] = op_ld_i_long,
+    [OP_PLANE] = op_plane,
+    [OP_AUDIO] = op_audio,
+    [OP_PITCH] = op_pitch,
+    [OP_INVALID] = op_nop,
+};
+
+// Returns the cached decode of the instruction at pc, decoding it on first use.
+// The cache covers the first 4 KiB, which is all any jump can reach; fetch()
+// faults on XO-CHIP code that runs on past it.
+static inline const decoded_inst_t *decode_at(chip8_t *chip8, uint16_t pc) {
+    pc &= 0x0FFF;
+    decoded_inst_t *inst = &chip8->icache[pc];
+    if (inst->op == OP_UNDECODED) {
+        // Reading 2 bytes and combining them; at 0xFFF the second is 0x1000 on XO-CHIP
+        *inst = decode_instruction(chip8->ram[pc] << 8 | chip8->ram[(pc + 1) & chip8->ram_mask]);
+    }
+    return inst;
+}
+
+static inline const decoded_inst_t *fetch(chip8_t *chip8) {
+    if ((chip8->PC & chip8->ram_mask) > 0x0FFF && chip8->fault == FAULT_NONE) {
+        chip8->fault = FAULT_PC_BOUNDS;
+        chip8->fault_pc = chip8->PC; // Nothing has run yet, PC is the instruction itself
+    }
+    return decode_at(chip8, chip8->PC);
+}
+
+// op_ld_vx_k rewinds PC and changes nothing else while the awaited key is held,
+// or while there is nothing to await yet.
+static bool key_wait_blocked(const chip8_t *chip8) {
+    if (chip8->key_wait_active) return chip8->keypad[chip8->key_wait_key];
+    for (uint8_t i = 0; i < sizeof chip8->keypad; i++) {
+        if (chip8->keypad[i]) return false;
+    }
+    return true;
+}
+
+// Fast-forwards through whole passes of a wait loop starting at PC, where inst is
+// the instruction there. A pass leaves the machine as it found it, so only the
+// count (which the caller adds to cycles) has to come out right. Returns 0 when
+// PC isn't in a wait loop or max doesn't cover a single pass.
+static uint32_t skip_idle(chip8_t *chip8, const decoded_inst_t *inst, uint32_t max) {
+    if (inst->op == OP_JP) {
+        // A jump to itself is how most programs halt
+        return inst->NNN == chip8->PC ? max : 0;
+    }
+    if (inst->op == OP_EXIT) return has_schip(chip8) ? max : 0;
+    if (inst->op == OP_LD_VX_K) return key_wait_blocked(chip8) ? max : 0;
+    if (inst->op != OP_LD_VX_DT || max < 3) return 0;
+    // FX07 / 3XNN or 4XNN / 1NNN back to the FX07, for as long as the skip doesn't fire
+    const decoded_inst_t *test = decode_at(chip8, chip8->PC + 2);
+    const decoded_inst_t *jump = decode_at(chip8, chip8->PC + 4);
+    if (jump->op != OP_JP || jump->NNN != chip8->PC || test->X != inst->X) return 0;
+    const uint8_t NN = test->NNN & 0xFF;
+    const bool loops = (test->op == OP_SE_VX_NN && chip8->delay_timer != NN)
+        || (test->op == OP_SNE_VX_NN && chip8->delay_timer == NN);
+    if (!loops) return 0;
+    chip8->V[inst->X] = chip8->delay_timer;
+    return max - max % 3;
+}
+
+uint32_t chip8_skip_idle(chip8_t *chip8, uint32_t max) {
+    const uint32_t skipped = skip_idle(chip8, fetch(chip8), max);
+    chip8->cycles += skipped;
+    chip8->idle_cycles += skipped;
+    return skipped;
+}
+
+bool chip8_waiting_for_key(chip8_t *chip8) {
+    return fetch(chip8)->op == OP_LD_VX_K && key_wait_blocked(chip8);
+}
+
+void emulate_commands(chip8_t *chip8, config_t *config) {
+    (void)config;
+    const decoded_inst_t *inst = fetch(chip8);
+#if CHIP8_TRACE
+    const uint16_t trace_pc = chip8->PC;
+    uint8_t V_before[16];
+    if (chip8->trace) memcpy(V_before, chip8->V, sizeof V_before);
+#endif
+#if CHIP8_PROFILING
+    if (chip8->profile) profile_instruction(chip8->profile, chip8->PC, inst->op);
+#endif
+    chip8->PC += 2; // Pre-increment program counter for next opcode
+    chip8->cycles++;
+    handlers[inst->op](chip8, inst);
+#if CHIP8_TRACE
+    if (chip8->trace) {
+        trace_write(chip8->trace, trace_pc, inst->opcode, chip8->reg_i, V_before, chip8->V);
+    }
+#endif
+}
+
+void emulate_cycles(chip8_t *chip8, config_t *config, uint32_t cycles) {
+#if CHIP8_TRACE
+    if (chip8->trace) {
+        for (uint32_t i = 0; i < cycles; i++) emulate_commands(chip8, config);
+        return;
+    }
+#endif
+#if CHIP8_PROFILING
+    if (chip8->profile) {
+        for (uint32_t i = 0; i < cycles; i++) emulate_commands(chip8, config);
+        return;
+    }
+#endif
+    if (config->skip_idle) {
+        // Same loop, except that the instructions a wait loop can start with
+        // first check whether the rest of the batch can be skipped
+        uint32_t idle = 0;
+        uint32_t i = 0;
+        while (i < cycles) {
+            const decoded_inst_t *inst = fetch(chip8);
+            if (inst->op == OP_LD_VX_DT || inst->op == OP_LD_VX_K || inst->op == OP_JP || inst->op == OP_EXIT) {
+                const uint32_t skipped = skip_idle(chip8, inst, cycles - i);
+                if (skipped) {
+                    idle += skipped;
+                    i += skipped;
+                    continue;
+                }
+            }
+            chip8->PC += 2;
+            handlers[inst->op](chip8, inst);
+            i++;
+        }
+        chip8->cycles += cycles;
+        chip8->idle_cycles += idle;
+        return;
+    }
+    // Hot loop: one cached lookup and one indirect call per instruction
+    for (uint32_t i = 0; i < cycles; i++) {
+        const decoded_inst_t *inst = fetch(chip8);
+        chip8->PC += 2;
+        handlers[inst->op](chip8, inst);
+    }
+    chip8->cycles += cycles;
+}
+
+uint64_t chip8_next_tick(uint64_t cycles, uint32_t insts_per_second) {
+    const uint64_t tick = cycles * FPS / insts_per_second + 1;
+    return (tick * insts_per_second + FPS - 1) / FPS;
+}
+
+void run_cycles(chip8_t *chip8, config_t *config, uint64_t cycles) {
+    const uint64_t end = chip8->cycles + cycles;
+    while (chip8->cycles < end && chip8->state != QUIT) {
+        // Run up to the next 60Hz timer tick (or the end of the budget) in one go
+        const uint64_t tick = chip8_next_tick(chip8->cycles, config->insts_per_second);
+        emulate_cycles(chip8, config, (tick < end ? tick : end) - chip8->cycles);
+        if (chip8->cycles == tick) update_timers(chip8);
+    }
+}
+
+void update_timers(chip8_t *chip8) {
+    // Both timers count down at 60Hz until they reach 0
+    if (chip8->delay_timer > 0) chip8->delay_timer--;
+    if (chip8->sound_timer > 0) chip8->sound_timer--;
+}
+
+// Row by row at the current resolution, as the 64 bit words a low resolution display used to be stored in.
+// The second plane only counts on XO-CHIP, where it can be drawn to.
+uint64_t chip8_display_hash(const chip8_t *chip8) {
+    const uint8_t planes = has_xochip(chip8) ? DISPLAY_PLANES : 1;
+    uint64_t hash = FNV1A64_INIT;
+    for (uint8_t plane = 0; plane < planes; plane++) {
+        for (uint32_t y = 0; y < chip8_height(chip8); y++) {
+            const uint64_t words[2] = {(uint64_t)(chip8->display[plane][y] >> 64), (uint64_t)chip8->display[plane][y]};
+            hash = fnv1a64(words, chip8->hires ? sizeof words : sizeof words[0], hash);
+        }
+    }
+    return hash;
+}
+
+uint64_t chip8_state_hash(const chip8_t *chip8) {
+    const uint8_t sp = chip8->sp;
+    const uint8_t depth = sp < STACK_SIZE ? sp : STACK_SIZE; // A runaway stack pointer must not make us read past stack
+    uint64_t hash = chip8_display_hash(chip8);
+    hash = fnv1a64(chip8->ram, (size_t)chip8->ram_mask + 1, hash);
+    hash = fnv1a64(chip8->V, sizeof chip8->V, hash);
+    hash = fnv1a64(&chip8->PC, sizeof chip8->PC, hash);
+    hash = fnv1a64(&chip8->reg_i, sizeof chip8->reg_i, hash);
+    hash = fnv1a64(&sp, sizeof sp, hash);
+    hash = fnv1a64(chip8->stack, depth * sizeof chip8->stack[0], hash);
+    hash = fnv1a64(&chip8->delay_timer, sizeof chip8->delay_timer, hash);
+    return fnv1a64(&chip8->sound_timer, sizeof chip8->sound_timer, hash);
+}
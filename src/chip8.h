@@ -0,0 +1,160 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "./decode.h"
+
+#define DISPLAY_WIDTH 64 // Low resolution, the only one CHIP-8 has
+#define DISPLAY_HEIGHT 32
+#define DISPLAY_HIRES_WIDTH 128 // SUPER-CHIP and XO-CHIP high resolution (00FF)
+#define DISPLAY_HIRES_HEIGHT 64
+#define DISPLAY_PLANES 2 // XO-CHIP bitplanes; CHIP-8 and SUPER-CHIP only draw to the first
+#define RAM_SIZE 0x10000 // XO-CHIP's 64 KiB; CHIP-8 and SUPER-CHIP see the first 4 KiB
+#define STACK_SIZE 16
+
+// One display row, bit 127 is x = 0. Low resolution only uses the top 64 bits, so
+// DXYN, scrolling and clearing are a few whole-word operations per row either way.
+typedef unsigned __int128 display_row_t;
+
+typedef enum {
+    QUIT,
+    RUNNING,
+    PAUSED,
+} emulator_state_t;
+
+typedef enum {
+    MODEL_CHIP8,
+    MODEL_SCHIP, // SUPER-CHIP 1.1: 128x64, 16x16 sprites, scrolling, big font, flag registers
+    MODEL_XOCHIP, // XO-CHIP: SUPER-CHIP plus two bitplanes, 64 KiB of RAM and a few more opcodes
+} chip8_model_t;
+
+// Program errors the core catches instead of letting them corrupt the machine.
+// The offending instruction does as little harm as it can: a 2NNN with a full
+// stack jumps without saving its return address, a 00EE with an empty one does
+// nothing, stores past the end of RAM wrap around to the start, and code run
+// from past 0xFFF is fetched from the start of RAM instead.
+typedef enum {
+    FAULT_NONE,
+    FAULT_STACK_OVERFLOW,
+    FAULT_STACK_UNDERFLOW,
+    FAULT_RAM_BOUNDS, // FX33, FX55 or 5XY2 storing past the end of RAM
+    FAULT_PC_BOUNDS, // XO-CHIP running on past 0xFFF, beyond the 4 KiB the instruction cache covers
+} chip8_fault_t;
+
+// Which instruction set runs, and the behaviours interpreters disagree on. A
+// zeroed struct is this emulator's own CHIP-8 behaviour, which most ROMs expect.
+typedef struct {
+    uint8_t model; // chip8_model_t
+    bool shift_vy; // 8XY6/8XYE shift VY into VX (COSMAC VIP, XO-CHIP) instead of shifting VX in place
+    bool vf_reset; // 8XY1/8XY2/8XY3 clear VF (COSMAC VIP)
+    bool keep_i; // FX55/FX65 leave I alone (SUPER-CHIP) instead of moving it past the registers
+    bool jump_vx; // BXNN jumps to XNN + VX (SUPER-CHIP) instead of NNN + V0
+    bool wrap_sprites; // Sprites wrap around the screen edges (XO-CHIP) instead of being clipped
+} quirks_t;
+
+// True for the zeroed profile, the only one the JIT and the lockstep lanes implement.
+static inline bool chip8_quirks_plain(const quirks_t *quirks) {
+    return quirks->model == MODEL_CHIP8 && !quirks->shift_vy && !quirks->vf_reset && !quirks->keep_i
+        && !quirks->jump_vx && !quirks->wrap_sprites;
+}
+
+typedef struct {
+    uint32_t scale_factor;
+    uint32_t window_width;
+    uint32_t window_height;
+    uint32_t insts_per_second; // Emulated CPU clock rate
+    bool skip_idle; // Fast-forward through wait loops instead of running them (see chip8_skip_idle)
+} config_t;
+
+typedef struct {
+    emulator_state_t state;
+    quirks_t quirks; // Kept by init_chip8_rom(), so set it before loading a ROM
+    uint16_t ram_mask; // 0x0FFF, or 0xFFFF on XO-CHIP
+    uint8_t ram[RAM_SIZE];
+    display_row_t display[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT]; // Rows 0-31 only in low resolution
+    bool hires; // 128x64 instead of 64x32 (00FF / 00FE)
+    uint8_t planes; // Bitplanes that drawing, clearing and scrolling act on (XO-CHIP FN01)
+    bool draw; // Set by anything that changes the display, cleared once the frontend has shown the new frame
+    uint16_t stack[STACK_SIZE]; // subroutine stack;
+    uint8_t sp; // Stack depth; an index rather than a pointer so the struct can be copied
+    uint16_t PC; // program counter
+    uint16_t reg_i; // 12 bit address register I
+    uint8_t V[16]; // Data registers V0-VF;
+    uint8_t delay_timer; // Decrements at 60Hz when > 0;
+    uint8_t sound_timer;
+    bool keypad[16]; // Hexadecimal keypad
+    bool key_wait_active; // FX0A saw key_wait_key go down and is waiting for it to go up
+    uint8_t key_wait_key;
+    uint8_t flags[16]; // SUPER-CHIP FX75/FX85 registers (HP-48 RPL flags)
+    uint8_t audio_pattern[16]; // XO-CHIP F002 sample buffer; there is no audio output yet
+    uint8_t pitch; // XO-CHIP FX3A
+    uint32_t rng_state; // Per-instance PRNG for CXNN
+    uint8_t fault; // chip8_fault_t: the first one since init, FAULT_NONE if there was none
+    uint16_t fault_pc; // Address of the instruction that caused it
+    uint64_t cycles; // Instructions executed since init
+    uint64_t idle_cycles; // How many of those were fast-forwarded through wait loops
+    const char *rom_name; // Currently running rom
+    decoded_inst_t icache[4096]; // Predecoded instruction per address, invalidated on RAM writes
+    struct trace *trace; // Instruction trace sink, NULL when tracing is off
+    struct profile *profile; // Execution counters, NULL when profiling is off (see profile.h)
+} chip8_t;
+
+static inline uint32_t chip8_width(const chip8_t *chip8) {
+    return chip8->hires ? DISPLAY_HIRES_WIDTH : DISPLAY_WIDTH;
+}
+
+static inline uint32_t chip8_height(const chip8_t *chip8) {
+    return chip8->hires ? DISPLAY_HIRES_HEIGHT : DISPLAY_HEIGHT;
+}
+
+// Plane bits of the pixel at x, y in the current resolution: 0 is off, 1 the first plane, 2 the second, 3 both.
+static inline uint32_t chip8_pixel(const chip8_t *chip8, uint32_t x, uint32_t y) {
+    const uint32_t shift = DISPLAY_HIRES_WIDTH - 1 - x;
+    return (uint32_t)(chip8->display[0][y] >> shift & 1) | (uint32_t)(chip8->display[1][y] >> shift & 1) << 1;
+}
+
+// The core below does not depend on SDL, so it can be driven by the SDL
+// frontend (main.c) as well as the headless runner (headless.c).
+// It keeps no global state: every function only touches the chip8_t it is
+// given, so separate instances can run on separate threads.
+bool init_chip8(chip8_t *chip8, const char rom_name[]);
+// Same as init_chip8() for a ROM that is already in memory; rom_name is only kept for display.
+// Either one resets the whole machine apart from the keypad, so it can also switch a running instance to another ROM.
+bool init_chip8_rom(chip8_t *chip8, const char rom_name[], const uint8_t *rom, size_t rom_size);
+void emulate_commands(chip8_t *chip8, config_t *config);
+// Runs the given number of instructions back to back; same result as calling
+// emulate_commands() that many times, minus the per-call overhead.
+void emulate_cycles(chip8_t *chip8, config_t *config, uint32_t cycles);
+// Skips up to max instructions of a wait loop at PC, if there is one, and returns
+// how many it skipped. Recognises FX07 / 3XNN or 4XNN / 1NNN polling the delay
+// timer, FX0A waiting for a key and a 1NNN jumping to itself. The delay timer and keypad only change between
+// emulate_cycles() calls, so the result is exactly that of running them.
+uint32_t chip8_skip_idle(chip8_t *chip8, uint32_t max);
+// True while PC is at an FX0A that can't get any further until the keypad changes.
+bool chip8_waiting_for_key(chip8_t *chip8);
+// Looks up a quirk profile by name: chip8 (the default), vip, schip or xochip.
+bool chip8_quirks_by_name(const char *name, quirks_t *quirks);
+// "stack overflow" etc., for reports.
+const char *chip8_fault_name(uint8_t fault);
+// Reseeds the CXNN random number generator; the same seed gives the same run.
+void chip8_seed(chip8_t *chip8, uint32_t seed);
+// Drops every predecoded instruction, e.g. after RAM was replaced wholesale.
+void invalidate_icache(chip8_t *chip8);
+void update_timers(chip8_t *chip8);
+// Instruction count at which the first timer tick after cycles is due. Tick n falls
+// on instruction ceil(n * insts_per_second / FPS), so the timers run at exactly FPS
+// per emulated second even when the rate isn't a multiple of it.
+uint64_t chip8_next_tick(uint64_t cycles, uint32_t insts_per_second);
+// Runs cycles instructions and ticks the timers FPS times per insts_per_second
+// instructions of emulated time, for callers with no real-time clock of their own.
+void run_cycles(chip8_t *chip8, config_t *config, uint64_t cycles);
+// Hashes for comparing runs: the framebuffer alone, or everything that makes up
+// the machine state (RAM, display, registers, stack and timers). For a CHIP-8
+// program in low resolution they hash the same bytes they did before SUPER-CHIP
+// support, so existing golden hashes stay valid.
+uint64_t chip8_display_hash(const chip8_t *chip8);
+uint64_t chip8_state_hash(const chip8_t *chip8);
+
+#endif
@@ -0,0 +1,328 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "./aot.h"
+#include "./constants.h"
+#include "./chip8.h"
+#include "./input.h"
+#include "./jit.h"
+
+// Conformance harness: runs every case headless, hashes the machine at fixed
+// checkpoints and compares them with the stored golden hashes. Meant to gate
+// changes to the core: any behavioural change shows up as the first checkpoint
+// whose hash no longer matches.
+//
+// Cases file, tab separated, '#' starts a comment:
+//   <rom>\t<input script or ->\t<seed>\t<cycles>\t<checkpoint interval>[\t<quirk profile>]
+// Golden file, one checkpoint per line, written by --update:
+//   <rom>\t<input or ->\t<seed>\t<cycle>\t<display hash>\t<state hash>[\t<quirk profile>]
+// The quirk profile defaults to chip8 and is only written out when it isn't that.
+
+typedef struct {
+    uint64_t cycle;
+    uint64_t display_hash;
+    uint64_t state_hash; // Registers, stack, timers and RAM on top of the display
+} checkpoint_t;
+
+typedef struct {
+    char *rom_name;
+    char *input_name; // "-" = no input
+    char *quirks_name;
+    quirks_t quirks;
+    uint32_t seed;
+    uint64_t cycles;
+    uint64_t interval;
+    checkpoint_t *golden; // NULL when the golden file has nothing for this case
+    size_t golden_count;
+    checkpoint_t *result;
+    size_t result_count;
+    bool ok; // ROM and input loaded
+} case_t;
+
+typedef enum {
+    ENGINE_INTERPRETER,
+    ENGINE_JIT,
+    ENGINE_AOT,
+} engine_t;
+
+static const char *engine_names[] = {"interp", "jit", "aot"};
+
+typedef struct {
+    case_t *cases;
+    size_t case_count;
+    size_t next_case; // Claimed atomically by the workers
+    engine_t engine;
+    bool skip_idle;
+    uint32_t insts_per_second;
+} harness_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Runs up to cycle end, stopping at every input event and timer tick on the way.
+static void run_to(chip8_t *chip8, config_t *config, jit_t *jit, aot_t *aot, input_script_t *script, uint64_t end) {
+    while (chip8->cycles < end) {
+        const uint64_t next_event = input_script_apply(script, chip8);
+        const uint64_t tick = chip8_next_tick(chip8->cycles, config->insts_per_second);
+        uint64_t batch = tick - chip8->cycles;
+        if (batch > end - chip8->cycles) batch = end - chip8->cycles;
+        if (batch > next_event - chip8->cycles) batch = next_event - chip8->cycles;
+        if (jit) jit_run(jit, chip8, config, batch);
+        else if (aot) aot_run(aot, chip8, config, batch);
+        else emulate_cycles(chip8, config, batch);
+        if (chip8->cycles == tick) update_timers(chip8);
+    }
+}
+
+static void run_case(case_t *c, jit_t *jit, const harness_t *harness) {
+    chip8_t *chip8 = calloc(1, sizeof *chip8);
+    input_script_t script = {0};
+    config_t config = {.window_width = 64, .window_height = 32, .scale_factor = 1,
+                       .insts_per_second = harness->insts_per_second, .skip_idle = harness->skip_idle};
+    if (chip8) chip8->quirks = c->quirks;
+    c->ok = chip8 && init_chip8(chip8, c->rom_name)
+        && (strcmp(c->input_name, "-") == 0 || input_script_load(&script, c->input_name));
+    if (!c->ok) {
+        free(chip8);
+        return;
+    }
+    chip8_seed(chip8, c->seed);
+    if (jit) jit_flush(jit);
+    // Modules are per ROM, and with other quirks aot_run() would only interpret anyway
+    aot_t *aot = NULL;
+    if (harness->engine == ENGINE_AOT && chip8_quirks_plain(&c->quirks)) aot = aot_load(chip8->ram, NULL);
+    c->result_count = (c->cycles + c->interval - 1) / c->interval;
+    c->result = calloc(c->result_count, sizeof *c->result);
+    for (size_t i = 0; i < c->result_count; i++) {
+        uint64_t end = (i + 1) * c->interval;
+        if (end > c->cycles) end = c->cycles; // The last checkpoint is always at the end of the run
+        run_to(chip8, &config, jit, aot, &script, end);
+        c->result[i] = (checkpoint_t){chip8->cycles, chip8_display_hash(chip8), chip8_state_hash(chip8)};
+    }
+    aot_destroy(aot);
+    input_script_free(&script);
+    free(chip8);
+}
+
+static void *worker_main(void *arg) {
+    harness_t *harness = arg;
+    jit_t *jit = harness->engine == ENGINE_JIT ? jit_create() : NULL; // One per thread, it isn't shareable
+    for (;;) {
+        const size_t i = __atomic_fetch_add(&harness->next_case, 1, __ATOMIC_RELAXED);
+        if (i >= harness->case_count) break;
+        run_case(&harness->cases[i], jit, harness);
+    }
+    if (jit) jit_destroy(jit);
+    return NULL;
+}
+
+// Splits a line into up to max tab separated fields in place; returns the number found.
+static int split_tabs(char *line, char **fields, int max) {
+    int n = 0;
+    for (char *field = strtok(line, "\t"); field && n < max; field = strtok(NULL, "\t")) fields[n++] = field;
+    return n;
+}
+
+static case_t *load_cases(const char *path, size_t *count) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cases file %s is invalid\n", path);
+        return NULL;
+    }
+    case_t *cases = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    char line[4096];
+    unsigned line_number = 0;
+    while (fgets(line, sizeof line, file)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *fields[6];
+        const int n = split_tabs(line, fields, 6);
+        quirks_t quirks = {0};
+        if (n < 5 || strtoull(fields[4], NULL, 0) == 0 || (n == 6 && !chip8_quirks_by_name(fields[5], &quirks))) {
+            fprintf(stderr, "%s:%u: expected '<rom>\\t<input or ->\\t<seed>\\t<cycles>\\t<interval>[\\t<quirks>]'\n",
+                path, line_number);
+            fclose(file);
+            free(cases);
+            return NULL;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            cases = realloc(cases, capacity * sizeof *cases);
+        }
+        cases[(*count)++] = (case_t){
+            .rom_name = strdup(fields[0]),
+            .input_name = strdup(fields[1]),
+            .quirks_name = strdup(n == 6 ? fields[5] : "chip8"),
+            .quirks = quirks,
+            .seed = strtoul(fields[2], NULL, 0),
+            .cycles = strtoull(fields[3], NULL, 0),
+            .interval = strtoull(fields[4], NULL, 0),
+        };
+    }
+    fclose(file);
+    return cases;
+}
+
+static bool same_case(const case_t *c, const char *rom, const char *input, uint32_t seed, const char *quirks) {
+    return c->seed == seed && strcmp(c->rom_name, rom) == 0 && strcmp(c->input_name, input) == 0
+        && strcmp(c->quirks_name, quirks) == 0;
+}
+
+// Attaches each golden checkpoint to its case. A missing file just means no goldens yet.
+static void load_golden(const char *path, case_t *cases, size_t case_count) {
+    FILE *file = fopen(path, "r");
+    if (!file) return;
+    char line[4096];
+    size_t last = 0; // Goldens are written in case order, so usually the previous case matches
+    while (fgets(line, sizeof line, file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *fields[7];
+        const int field_count = split_tabs(line, fields, 7);
+        if (field_count < 6) continue;
+        const uint32_t seed = strtoul(fields[2], NULL, 0);
+        const char *quirks = field_count == 7 ? fields[6] : "chip8";
+        size_t i = last;
+        for (size_t n = 0; n < case_count && !same_case(&cases[i], fields[0], fields[1], seed, quirks); n++) {
+            i = (i + 1) % case_count;
+        }
+        if (!case_count || !same_case(&cases[i], fields[0], fields[1], seed, quirks)) continue; // Case was removed
+        last = i;
+        case_t *c = &cases[i];
+        c->golden = realloc(c->golden, (c->golden_count + 1) * sizeof *c->golden);
+        c->golden[c->golden_count++] = (checkpoint_t){
+            strtoull(fields[3], NULL, 0), strtoull(fields[4], NULL, 16), strtoull(fields[5], NULL, 16)};
+    }
+    fclose(file);
+}
+
+static bool write_golden(const char *path, const case_t *cases, size_t case_count) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return false;
+    }
+    fprintf(file, "# Generated by chip8conform --update; do not edit by hand.\n");
+    for (size_t i = 0; i < case_count; i++) {
+        const case_t *c = &cases[i];
+        for (size_t k = 0; k < c->result_count; k++) {
+            fprintf(file, "%s\t%s\t%u\t%llu\t%016llx\t%016llx", c->rom_name, c->input_name, c->seed,
+                (unsigned long long)c->result[k].cycle, (unsigned long long)c->result[k].display_hash,
+                (unsigned long long)c->result[k].state_hash);
+            if (strcmp(c->quirks_name, "chip8") != 0) fprintf(file, "\t%s", c->quirks_name);
+            fputc('\n', file);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+// Prints why a case failed; returns true when it matches its goldens.
+static bool check_case(const case_t *c) {
+    if (!c->ok) {
+        printf("ERROR %s %s seed %u: could not load the ROM or input\n", c->rom_name, c->input_name, c->seed);
+        return false;
+    }
+    if (!c->golden) {
+        printf("NEW   %s %s seed %u: no golden hashes, run with --update\n", c->rom_name, c->input_name, c->seed);
+        return false;
+    }
+    uint64_t last_match = 0;
+    for (size_t k = 0; k < c->result_count; k++) {
+        const checkpoint_t *got = &c->result[k];
+        const checkpoint_t *want = k < c->golden_count ? &c->golden[k] : NULL;
+        if (want && want->cycle == got->cycle && want->state_hash == got->state_hash
+            && want->display_hash == got->display_hash) {
+            last_match = got->cycle;
+            continue;
+        }
+        const char *what = !want || want->cycle != got->cycle ? "checkpoints no longer line up"
+            : want->display_hash != got->display_hash ? "display differs" : "registers or RAM differ";
+        printf("FAIL  %s %s seed %u: first divergence between cycles %llu and %llu (%s)\n",
+            c->rom_name, c->input_name, c->seed, (unsigned long long)last_match,
+            (unsigned long long)got->cycle, what);
+        return false;
+    }
+    if (c->golden_count != c->result_count) {
+        printf("FAIL  %s %s seed %u: %zu golden checkpoints, run produced %zu\n",
+            c->rom_name, c->input_name, c->seed, c->golden_count, c->result_count);
+        return false;
+    }
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage %s <cases> <golden> [--update] [--engine interp|jit|aot] [--threads N] [--ips N] "
+        "[--skip-idle on|off]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    bool update = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    harness_t harness = {.insts_per_second = INSTRUCTIONS_PER_SECOND, .skip_idle = true};
+    bool valid = true;
+    for (int i = 3; i < argc && valid; i++) {
+        if (strcmp(argv[i], "--update") == 0) update = true;
+        else if (i + 1 >= argc) valid = false; // Every other option takes a value
+        else if (strcmp(argv[i], "--engine") == 0) {
+            const char *engine = argv[++i];
+            if (strcmp(engine, "interp") == 0) harness.engine = ENGINE_INTERPRETER;
+            else if (strcmp(engine, "jit") == 0) harness.engine = ENGINE_JIT;
+            else if (strcmp(engine, "aot") == 0) harness.engine = ENGINE_AOT;
+            else valid = false;
+        }
+        else if (strcmp(argv[i], "--threads") == 0) threads = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--ips") == 0) harness.insts_per_second = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--skip-idle") == 0) {
+            const char *value = argv[++i];
+            if (strcmp(value, "on") == 0) harness.skip_idle = true;
+            else if (strcmp(value, "off") == 0) harness.skip_idle = false;
+            else valid = false;
+        }
+        else valid = false;
+    }
+    if (!valid) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (threads < 1) threads = 1;
+    if (harness.insts_per_second < FPS) harness.insts_per_second = FPS;
+
+    harness.cases = load_cases(argv[1], &harness.case_count);
+    if (!harness.cases) exit(EXIT_FAILURE);
+    if (!update) load_golden(argv[2], harness.cases, harness.case_count);
+
+    const double start = now_ms();
+    pthread_t *handles = calloc(threads, sizeof *handles);
+    for (long t = 0; t < threads; t++) pthread_create(&handles[t], NULL, worker_main, &harness);
+    for (long t = 0; t < threads; t++) pthread_join(handles[t], NULL);
+    const double elapsed = now_ms() - start;
+
+    size_t failed = 0;
+    uint64_t total_cycles = 0;
+    for (size_t i = 0; i < harness.case_count; i++) {
+        const case_t *c = &harness.cases[i];
+        if (c->result_count) total_cycles += c->result[c->result_count - 1].cycle;
+        if (update) failed += !c->ok;
+        else failed += !check_case(c);
+    }
+    if (update && !failed && !write_golden(argv[2], harness.cases, harness.case_count)) exit(EXIT_FAILURE);
+    fprintf(stderr, "conform: %zu cases, %zu %s, %s engine%s, %ld threads, %.1f ms (%.1f MIPS)\n",
+        harness.case_count, failed, update ? "failed to run" : "failed", engine_names[harness.engine],
+        harness.skip_idle ? "" : " without idle skipping", threads, elapsed, total_cycles / elapsed / 1000.0);
+    return failed ? EXIT_FAILURE : 0;
+}
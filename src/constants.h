@@ -1,2 +1,3 @@
 #define FPS 60
 #define FRAME_TARGET_TIME (1000 / FPS)
+#define INSTRUCTIONS_PER_SECOND 700 // Roughly the speed of the original COSMAC VIP interpreter
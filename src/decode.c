@@ -0,0 +1,85 @@
+#include "./decode.h"
+
+static uint8_t decode_op(uint16_t opcode) {
+    const uint8_t NN = opcode & 0x0FF;
+    const uint8_t N = opcode & 0x0F;
+
+    switch ((opcode >> 12) & 0x0F) {
+        case 0x00:
+            if (opcode == 0x00E0) return OP_CLS;
+            if (opcode == 0x00EE) return OP_RET;
+            if ((opcode & 0xFFF0) == 0x00C0) return OP_SCD;
+            if ((opcode & 0xFFF0) == 0x00D0) return OP_SCU;
+            if (opcode == 0x00FB) return OP_SCR;
+            if (opcode == 0x00FC) return OP_SCL;
+            if (opcode == 0x00FD) return OP_EXIT;
+            if (opcode == 0x00FE) return OP_LOW;
+            if (opcode == 0x00FF) return OP_HIGH;
+            return OP_SYS;
+        case 0x01: return OP_JP;
+        case 0x02: return OP_CALL;
+        case 0x03: return OP_SE_VX_NN;
+        case 0x04: return OP_SNE_VX_NN;
+        case 0x05:
+            if (N == 0) return OP_SE_VX_VY;
+            if (N == 2) return OP_SAVE_VX_VY;
+            if (N == 3) return OP_LOAD_VX_VY;
+            return OP_INVALID;
+        case 0x06: return OP_LD_VX_NN;
+        case 0x07: return OP_ADD_VX_NN;
+        case 0x08:
+            switch (N) {
+                case 0x0: return OP_LD_VX_VY;
+                case 0x1: return OP_OR;
+                case 0x2: return OP_AND;
+                case 0x3: return OP_XOR;
+                case 0x4: return OP_ADD_VX_VY;
+                case 0x5: return OP_SUB;
+                case 0x6: return OP_SHR;
+                case 0x7: return OP_SUBN;
+                case 0xE: return OP_SHL;
+            }
+            return OP_INVALID;
+        case 0x09: return N == 0 ? OP_SNE_VX_VY : OP_INVALID;
+        case 0x0A: return OP_LD_I;
+        case 0x0B: return OP_JP_V0;
+        case 0x0C: return OP_RND;
+        case 0x0D: return OP_DRW;
+        case 0x0E:
+            if (NN == 0x9E) return OP_SKP;
+            if (NN == 0xA1) return OP_SKNP;
+            return OP_INVALID;
+        case 0x0F:
+            if (opcode == 0xF000) return OP_LD_I_LONG;
+            if (opcode == 0xF002) return OP_AUDIO;
+            switch (NN) {
+                case 0x01: return OP_PLANE;
+                case 0x07: return OP_LD_VX_DT;
+                case 0x0A: return OP_LD_VX_K;
+                case 0x15: return OP_LD_DT_VX;
+                case 0x18: return OP_LD_ST_VX;
+                case 0x1E: return OP_ADD_I_VX;
+                case 0x29: return OP_LD_F_VX;
+                case 0x33: return OP_LD_B_VX;
+                case 0x55: return OP_LD_MEM_VX;
+                case 0x65: return OP_LD_VX_MEM;
+                case 0x30: return OP_LD_HF_VX;
+                case 0x3A: return OP_PITCH;
+                case 0x75: return OP_LD_R_VX;
+                case 0x85: return OP_LD_VX_R;
+            }
+            return OP_INVALID;
+    }
+    return OP_INVALID;
+}
+
+decoded_inst_t decode_instruction(uint16_t opcode) {
+    return (decoded_inst_t){
+        .op = decode_op(opcode),
+        .X = (opcode >> 8) & 0x0F,
+        .Y = (opcode >> 4) & 0x0F,
+        .N = opcode & 0x0F,
+        .NNN = opcode & 0x0FFF,
+        .opcode = opcode,
+    };
+}
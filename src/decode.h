@@ -0,0 +1,80 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+
+// Every instruction the interpreter knows, used as an index into its handler table.
+// OP_UNDECODED must stay 0 so a zeroed instruction cache means "decode me first".
+typedef enum {
+    OP_UNDECODED = 0,
+    OP_CLS,        // 00E0
+    OP_RET,        // 00EE
+    OP_SYS,        // 0NNN
+    OP_JP,         // 1NNN
+    OP_CALL,       // 2NNN
+    OP_SE_VX_NN,   // 3XNN
+    OP_SNE_VX_NN,  // 4XNN
+    OP_SE_VX_VY,   // 5XY0
+    OP_LD_VX_NN,   // 6XNN
+    OP_ADD_VX_NN,  // 7XNN
+    OP_LD_VX_VY,   // 8XY0
+    OP_OR,         // 8XY1
+    OP_AND,        // 8XY2
+    OP_XOR,        // 8XY3
+    OP_ADD_VX_VY,  // 8XY4
+    OP_SUB,        // 8XY5
+    OP_SHR,        // 8XY6
+    OP_SUBN,       // 8XY7
+    OP_SHL,        // 8XYE
+    OP_SNE_VX_VY,  // 9XY0
+    OP_LD_I,       // ANNN
+    OP_JP_V0,      // BNNN
+    OP_RND,        // CXNN
+    OP_DRW,        // DXYN
+    OP_SKP,        // EX9E
+    OP_SKNP,       // EXA1
+    OP_LD_VX_DT,   // FX07
+    OP_LD_VX_K,    // FX0A
+    OP_LD_DT_VX,   // FX15
+    OP_LD_ST_VX,   // FX18
+    OP_ADD_I_VX,   // FX1E
+    OP_LD_F_VX,    // FX29
+    OP_LD_B_VX,    // FX33
+    OP_LD_MEM_VX,  // FX55
+    OP_LD_VX_MEM,  // FX65
+    // SUPER-CHIP, no-ops unless chip8->quirks.model allows them
+    OP_SCD,        // 00CN
+    OP_SCR,        // 00FB
+    OP_SCL,        // 00FC
+    OP_EXIT,       // 00FD
+    OP_LOW,        // 00FE
+    OP_HIGH,       // 00FF
+    OP_LD_HF_VX,   // FX30
+    OP_LD_R_VX,    // FX75
+    OP_LD_VX_R,    // FX85
+    // XO-CHIP
+    OP_SCU,        // 00DN
+    OP_SAVE_VX_VY, // 5XY2
+    OP_LOAD_VX_VY, // 5XY3
+    OP_LD_I_LONG,  // F000 NNNN
+    OP_PLANE,      // FN01
+    OP_AUDIO,      // F002
+    OP_PITCH,      // FX3A
+    OP_INVALID,    // Anything else, executed as a no-op
+    OP_COUNT,
+} op_t;
+
+// One predecoded instruction. Kept at 8 bytes so the whole 4 KiB address
+// space fits in a 32 KiB cache.
+typedef struct {
+    uint8_t op; // op_t
+    uint8_t X;
+    uint8_t Y;
+    uint8_t N;
+    uint16_t NNN; // NN is the low byte
+    uint16_t opcode; // Raw opcode, kept for tracing and profiling
+} decoded_inst_t;
+
+decoded_inst_t decode_instruction(uint16_t opcode);
+
+#endif
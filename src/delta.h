@@ -0,0 +1,55 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "./varint.h"
+
+// XOR deltas between two equally sized blobs, for keeping many similar machine
+// states around cheaply. Format: repeated <zero run varint> <literal count varint>
+// <literal XOR bytes>. Trailing zeros are left out. Literal runs swallow gaps of
+// fewer than 3 zeros, which cost less inline than a new pair of counts.
+
+// Worst case encoded size for size bytes, for sizing buffers.
+#define DELTA_MAX(size) (2 * (size))
+
+// Encodes data XOR base into out (at least DELTA_MAX(size) bytes) and returns the encoded size.
+static inline size_t delta_encode(const void *base, const void *data, size_t size, uint8_t *out) {
+    const uint8_t *a = base;
+    const uint8_t *b = data;
+    size_t pos = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t start = i;
+        while (start < size && a[start] == b[start]) start++;
+        if (start == size) break;
+        size_t end = start;
+        size_t zeros = 0;
+        while (end < size && zeros < 3) {
+            zeros = a[end] == b[end] ? zeros + 1 : 0;
+            end++;
+        }
+        end -= zeros;
+        pos += varint_put(&out[pos], start - i);
+        pos += varint_put(&out[pos], end - start);
+        for (size_t j = start; j < end; j++) out[pos++] = a[j] ^ b[j];
+        i = end;
+    }
+    return pos;
+}
+
+// Turns base into the data a delta was encoded from.
+static inline void delta_apply(void *base, const uint8_t *delta, size_t size) {
+    uint8_t *a = base;
+    size_t pos = 0;
+    size_t i = 0;
+    while (pos < size) {
+        uint64_t skip, count;
+        pos += varint_get(&delta[pos], size - pos, &skip);
+        pos += varint_get(&delta[pos], size - pos, &count);
+        i += skip;
+        for (size_t j = 0; j < count; j++) a[i++] ^= delta[pos++];
+    }
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include "./disasm.h"
+
+void disassemble(uint16_t opcode, char *buf, size_t size) {
+    const uint16_t NNN = opcode & 0x0FFF;
+    const uint8_t NN = opcode & 0x0FF;
+    const uint8_t N = opcode & 0x0F;
+    const uint8_t X = (opcode >> 8) & 0x0F;
+    const uint8_t Y = (opcode >> 4) & 0x0F;
+
+    switch ((opcode >> 12) & 0x0F) {
+        case 0x00:
+            if (opcode == 0x00E0) snprintf(buf, size, "CLS");
+            else if (opcode == 0x00EE) snprintf(buf, size, "RET");
+            else if ((opcode & 0xFFF0) == 0x00C0) snprintf(buf, size, "SCD %u", N);
+            else if ((opcode & 0xFFF0) == 0x00D0) snprintf(buf, size, "SCU %u", N);
+            else if (opcode == 0x00FB) snprintf(buf, size, "SCR");
+            else if (opcode == 0x00FC) snprintf(buf, size, "SCL");
+            else if (opcode == 0x00FD) snprintf(buf, size, "EXIT");
+            else if (opcode == 0x00FE) snprintf(buf, size, "LOW");
+            else if (opcode == 0x00FF) snprintf(buf, size, "HIGH");
+            else snprintf(buf, size, "SYS 0x%03X", NNN);
+            return;
+        case 0x01: snprintf(buf, size, "JP 0x%03X", NNN); return;
+        case 0x02: snprintf(buf, size, "CALL 0x%03X", NNN); return;
+        case 0x03: snprintf(buf, size, "SE V%X, 0x%02X", X, NN); return;
+        case 0x04: snprintf(buf, size, "SNE V%X, 0x%02X", X, NN); return;
+        case 0x05:
+            if (N == 0x0) { snprintf(buf, size, "SE V%X, V%X", X, Y); return; }
+            if (N == 0x2) { snprintf(buf, size, "LD [I], V%X-V%X", X, Y); return; }
+            if (N == 0x3) { snprintf(buf, size, "LD V%X-V%X, [I]", X, Y); return; }
+            break;
+        case 0x06: snprintf(buf, size, "LD V%X, 0x%02X", X, NN); return;
+        case 0x07: snprintf(buf, size, "ADD V%X, 0x%02X", X, NN); return;
+        case 0x08:
+            switch (N) {
+                case 0x0: snprintf(buf, size, "LD V%X, V%X", X, Y); return;
+                case 0x1: snprintf(buf, size, "OR V%X, V%X", X, Y); return;
+                case 0x2: snprintf(buf, size, "AND V%X, V%X", X, Y); return;
+                case 0x3: snprintf(buf, size, "XOR V%X, V%X", X, Y); return;
+                case 0x4: snprintf(buf, size, "ADD V%X, V%X", X, Y); return;
+                case 0x5: snprintf(buf, size, "SUB V%X, V%X", X, Y); return;
+                case 0x6: snprintf(buf, size, "SHR V%X, V%X", X, Y); return;
+                case 0x7: snprintf(buf, size, "SUBN V%X, V%X", X, Y); return;
+                case 0xE: snprintf(buf, size, "SHL V%X, V%X", X, Y); return;
+            }
+            break;
+        case 0x09: snprintf(buf, size, "SNE V%X, V%X", X, Y); return;
+        case 0x0A: snprintf(buf, size, "LD I, 0x%03X", NNN); return;
+        case 0x0B: snprintf(buf, size, "JP V0, 0x%03X", NNN); return;
+        case 0x0C: snprintf(buf, size, "RND V%X, 0x%02X", X, NN); return;
+        case 0x0D: snprintf(buf, size, "DRW V%X, V%X, %u", X, Y, N); return;
+        case 0x0E:
+            if (NN == 0x9E) { snprintf(buf, size, "SKP V%X", X); return; }
+            if (NN == 0xA1) { snprintf(buf, size, "SKNP V%X", X); return; }
+            break;
+        case 0x0F:
+            if (opcode == 0xF000) { snprintf(buf, size, "LD I, long"); return; } // The address is the next word
+            if (opcode == 0xF002) { snprintf(buf, size, "AUDIO"); return; }
+            switch (NN) {
+                case 0x01: snprintf(buf, size, "PLANE %u", X); return;
+                case 0x07: snprintf(buf, size, "LD V%X, DT", X); return;
+                case 0x0A: snprintf(buf, size, "LD V%X, K", X); return;
+                case 0x15: snprintf(buf, size, "LD DT, V%X", X); return;
+                case 0x18: snprintf(buf, size, "LD ST, V%X", X); return;
+                case 0x1E: snprintf(buf, size, "ADD I, V%X", X); return;
+                case 0x29: snprintf(buf, size, "LD F, V%X", X); return;
+                case 0x33: snprintf(buf, size, "LD B, V%X", X); return;
+                case 0x55: snprintf(buf, size, "LD [I], V%X", X); return;
+                case 0x65: snprintf(buf, size, "LD V%X, [I]", X); return;
+                case 0x30: snprintf(buf, size, "LD HF, V%X", X); return;
+                case 0x3A: snprintf(buf, size, "PITCH V%X", X); return;
+                case 0x75: snprintf(buf, size, "LD R, V%X", X); return;
+                case 0x85: snprintf(buf, size, "LD V%X, R", X); return;
+            }
+            break;
+    }
+    snprintf(buf, size, "DW 0x%04X", opcode); // Not an instruction we know, probably data
+}
@@ -0,0 +1,10 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes a short mnemonic for opcode into buf, e.g. "LD V3, 0x12" or "DRW V0, V1, 5".
+void disassemble(uint16_t opcode, char *buf, size_t size);
+
+#endif
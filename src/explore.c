@@ -0,0 +1,573 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "./constants.h"
+#include "./chip8.h"
+#include "./delta.h"
+#include "./hash.h"
+#include "./input.h"
+
+// State-space explorer: starting from a ROM's first instruction, tries every
+// keypad input for a few frames at a time and carries on from each state it
+// hasn't been in before, on all cores. Reports how many distinct states it
+// reached and every fault (see chip8_fault_t) it ran into, with the inputs
+// that lead there, and exits with 2 if there were any.
+//
+// A state is everything that decides what the machine does next: RAM, display,
+// registers, stack, timers, the RNG and FX0A's key wait, but not the instruction
+// count, so a game idling on its title screen is one state however long it
+// idles. Visited states are only kept as 64 bit hashes in a lock-free set.
+// States still to be expanded are XOR deltas (delta.h) against the start state
+// over just the RAM the model can address, usually a few hundred bytes; forking
+// one is a delta apply and a 4 KiB copy into a worker's machine.
+
+#define NO_KEY 0xFF // The "hold nothing" input
+#define NO_PARENT UINT32_MAX
+#define DEFAULT_HOLD_FRAMES 6
+#define DEFAULT_MAX_STATES 1000000
+#define MAX_FAULTS 64 // Distinct (fault, address) pairs reported
+
+typedef enum {
+    SEARCH_BREADTH_FIRST,
+    SEARCH_BEST_FIRST, // Largest delta first: the states that moved furthest from the start
+} search_t;
+
+// What a state adds to the RAM: everything else chip8_t carries for the program.
+// The RAM itself follows it. Ordered so there is no padding inside.
+typedef struct {
+    display_row_t display[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT];
+    uint64_t cycles;
+    uint32_t rng_state;
+    uint16_t stack[STACK_SIZE];
+    uint16_t PC;
+    uint16_t reg_i;
+    uint8_t V[16];
+    uint8_t flags[16];
+    uint8_t audio_pattern[16];
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t key_wait_active;
+    uint8_t key_wait_key;
+    uint8_t hires;
+    uint8_t planes;
+    uint8_t pitch;
+} fork_regs_t;
+_Static_assert(sizeof(fork_regs_t) % 8 == 0, "state_hash() reads whole words");
+
+typedef struct {
+    uint32_t parent; // NO_PARENT for the start state
+    uint32_t depth; // Inputs since the start state
+    uint8_t key; // Held on the way here from parent, or NO_KEY
+    uint32_t delta_size;
+    uint8_t *delta; // Against the start state; NULL once expanded (or never, past --max-depth)
+} node_t;
+
+typedef struct {
+    uint32_t score; // Best-first order; breadth-first ignores it
+    uint32_t node;
+} frontier_entry_t;
+
+// Open addressing over 64 bit hashes, 0 = empty slot. Inserts are a single
+// compare-and-swap; a thread that loses the race looks at what the winner wrote.
+typedef struct {
+    _Atomic uint64_t *slots;
+    uint64_t mask;
+} state_set_t;
+
+typedef struct {
+    uint8_t fault;
+    uint16_t pc;
+    uint32_t parent; // Node the faulting input was tried from
+    uint8_t key;
+    uint32_t depth;
+    uint64_t cycle; // Instruction count at the end of the faulting input
+} fault_report_t;
+
+typedef struct {
+    // Fixed once the search starts
+    const chip8_t *start;
+    config_t config;
+    search_t search;
+    uint32_t hold_cycles; // Instructions per input
+    uint8_t keys[17]; // Inputs to try from every state, NO_KEY first
+    uint32_t key_count;
+    uint32_t max_states;
+    uint32_t max_depth; // 0 = no limit
+    uint64_t deadline_ms; // 0 = no limit
+    size_t state_size; // fork_regs_t plus the addressable RAM
+    uint8_t *start_state;
+    // Shared
+    state_set_t visited;
+    node_t *nodes;
+    _Atomic uint32_t node_count;
+    _Atomic uint64_t expanded;
+    _Atomic uint64_t edges; // Inputs tried, i.e. forks run
+    _Atomic uint64_t delta_bytes; // Total size of every delta made
+    _Atomic bool stop;
+    _Atomic bool truncated; // Ran out of --max-states or time, rather than states to visit
+    pthread_mutex_t lock; // Guards everything below
+    pthread_cond_t wake;
+    frontier_entry_t *frontier;
+    size_t frontier_head; // Breadth-first pops from here; best-first keeps a heap at 0
+    size_t frontier_count;
+    size_t frontier_capacity;
+    size_t frontier_peak;
+    uint32_t busy; // Workers expanding a state; none and an empty frontier means done
+    fault_report_t faults[MAX_FAULTS];
+    uint32_t fault_count;
+    uint64_t fault_total;
+} explorer_t;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage %s <rom_name> [options]\n"
+        "  --quirks P       chip8 (default), vip, schip or xochip\n"
+        "  --ips N          emulated instructions per second (default %d)\n"
+        "  --seed N         seed the CXNN random number generator (default 1)\n"
+        "  --threads N      worker threads (default: all cores)\n"
+        "  --search S       bfs (default) or best (states furthest from the start first)\n"
+        "  --hold FRAMES    frames each input is held for (default %d)\n"
+        "  --keys LIST      keys to try besides none, e.g. 456 (default 0123456789ABCDEF)\n"
+        "  --max-states N   stop after N distinct states (default %d)\n"
+        "  --max-depth N    don't go further than N inputs from the start\n"
+        "  --time MS        stop after MS milliseconds\n"
+        "  --script FILE    save the inputs leading to the shallowest fault as a replayable log\n",
+        prog, INSTRUCTIONS_PER_SECOND, DEFAULT_HOLD_FRAMES, DEFAULT_MAX_STATES);
+}
+
+static bool set_init(state_set_t *set, uint32_t max_states) {
+    uint64_t capacity = 1024;
+    while (capacity < 2 * (uint64_t)max_states) capacity *= 2; // At most half full
+    set->slots = calloc(capacity, sizeof *set->slots);
+    set->mask = capacity - 1;
+    return set->slots != NULL;
+}
+
+// True if hash wasn't in the set yet.
+static bool set_insert(state_set_t *set, uint64_t hash) {
+    for (uint64_t i = hash & set->mask;; i = (i + 1) & set->mask) {
+        uint64_t seen = atomic_load_explicit(&set->slots[i], memory_order_relaxed);
+        if (seen == 0
+            && atomic_compare_exchange_strong_explicit(&set->slots[i], &seen, hash, memory_order_relaxed,
+                memory_order_relaxed)) {
+            return true;
+        }
+        if (seen == hash) return false;
+    }
+}
+
+// Hashes a packed state (see pack_state) minus its instruction count. Byte at a
+// time FNV-1a would take longer than running the input, so this mixes 8 bytes
+// per multiply; the states only ever get compared within one run.
+static uint64_t state_hash(const uint8_t *state, size_t size) {
+    uint64_t hash = FNV1A64_INIT;
+    for (size_t i = 0; i < size; i += 8) {
+        if (i == offsetof(fork_regs_t, cycles)) continue;
+        uint64_t word;
+        memcpy(&word, &state[i], sizeof word);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    return hash ? hash : 1; // 0 marks an empty slot
+}
+
+static void pack_state(const chip8_t *chip8, uint8_t *state) {
+    fork_regs_t regs;
+    memset(&regs, 0, sizeof regs); // Deltas compare the padding at the end too
+    memcpy(regs.display, chip8->display, sizeof regs.display);
+    regs.cycles = chip8->cycles;
+    regs.rng_state = chip8->rng_state;
+    memcpy(regs.stack, chip8->stack, sizeof regs.stack);
+    regs.PC = chip8->PC;
+    regs.reg_i = chip8->reg_i;
+    memcpy(regs.V, chip8->V, sizeof regs.V);
+    memcpy(regs.flags, chip8->flags, sizeof regs.flags);
+    memcpy(regs.audio_pattern, chip8->audio_pattern, sizeof regs.audio_pattern);
+    regs.sp = chip8->sp;
+    regs.delay_timer = chip8->delay_timer;
+    regs.sound_timer = chip8->sound_timer;
+    regs.key_wait_active = chip8->key_wait_active;
+    regs.key_wait_key = chip8->key_wait_key;
+    regs.hires = chip8->hires;
+    regs.planes = chip8->planes;
+    regs.pitch = chip8->pitch;
+    memcpy(state, &regs, sizeof regs);
+    memcpy(state + sizeof regs, chip8->ram, (size_t)chip8->ram_mask + 1);
+}
+
+// Puts chip8, which is running the same ROM with the same quirks, into state.
+static void unpack_state(chip8_t *chip8, const uint8_t *state) {
+    fork_regs_t regs;
+    memcpy(&regs, state, sizeof regs);
+    const uint8_t *ram = state + sizeof regs;
+    // Same as snapshot_load(): an instruction is stale if either of its two bytes changed.
+    // Sibling states rarely differ in code, so compare a word at a time first.
+    const uint32_t code_end = chip8->ram_mask < 0x1000 ? chip8->ram_mask : 0x1000;
+    for (uint32_t word = 0; word <= code_end; word += 8) {
+        uint64_t a, b;
+        memcpy(&a, &chip8->ram[word], sizeof a);
+        memcpy(&b, &ram[word], sizeof b);
+        if (a == b) continue;
+        for (uint32_t addr = word; addr < word + 8 && addr <= code_end; addr++) {
+            if (chip8->ram[addr] == ram[addr]) continue;
+            if (addr < 0x1000) chip8->icache[addr].op = OP_UNDECODED;
+            chip8->icache[(addr - 1) & 0x0FFF].op = OP_UNDECODED;
+        }
+    }
+    memcpy(chip8->ram, ram, (size_t)chip8->ram_mask + 1);
+    memcpy(chip8->display, regs.display, sizeof chip8->display);
+    chip8->cycles = regs.cycles;
+    chip8->rng_state = regs.rng_state;
+    memcpy(chip8->stack, regs.stack, sizeof chip8->stack);
+    chip8->PC = regs.PC;
+    chip8->reg_i = regs.reg_i;
+    memcpy(chip8->V, regs.V, sizeof chip8->V);
+    memcpy(chip8->flags, regs.flags, sizeof chip8->flags);
+    memcpy(chip8->audio_pattern, regs.audio_pattern, sizeof chip8->audio_pattern);
+    chip8->sp = regs.sp;
+    chip8->delay_timer = regs.delay_timer;
+    chip8->sound_timer = regs.sound_timer;
+    chip8->key_wait_active = regs.key_wait_active;
+    chip8->key_wait_key = regs.key_wait_key;
+    chip8->hires = regs.hires;
+    chip8->planes = regs.planes;
+    chip8->pitch = regs.pitch;
+    memset(chip8->keypad, 0, sizeof chip8->keypad); // Inputs are released between states
+    chip8->fault = FAULT_NONE;
+    chip8->state = RUNNING;
+}
+
+// Adds entry to the frontier; called with the lock held.
+static void frontier_push(explorer_t *ex, frontier_entry_t entry) {
+    if (ex->frontier_head + ex->frontier_count == ex->frontier_capacity) {
+        if (ex->frontier_head > ex->frontier_capacity / 2) {
+            // Breadth-first has used up the front half: reuse it rather than growing
+            memmove(ex->frontier, &ex->frontier[ex->frontier_head], ex->frontier_count * sizeof *ex->frontier);
+            ex->frontier_head = 0;
+        } else {
+            ex->frontier_capacity = ex->frontier_capacity ? 2 * ex->frontier_capacity : 1024;
+            ex->frontier = realloc(ex->frontier, ex->frontier_capacity * sizeof *ex->frontier);
+        }
+    }
+    size_t i = ex->frontier_head + ex->frontier_count++;
+    if (ex->frontier_count > ex->frontier_peak) ex->frontier_peak = ex->frontier_count;
+    if (ex->search == SEARCH_BEST_FIRST) {
+        // Sift up a max-heap on score
+        while (i > 0 && ex->frontier[(i - 1) / 2].score < entry.score) {
+            ex->frontier[i] = ex->frontier[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    }
+    ex->frontier[i] = entry;
+}
+
+// Takes the next entry off a non-empty frontier; called with the lock held.
+static uint32_t frontier_pop(explorer_t *ex) {
+    if (ex->search == SEARCH_BREADTH_FIRST) {
+        ex->frontier_count--;
+        return ex->frontier[ex->frontier_head++].node;
+    }
+    const uint32_t node = ex->frontier[0].node;
+    const frontier_entry_t last = ex->frontier[--ex->frontier_count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= ex->frontier_count) break;
+        if (child + 1 < ex->frontier_count && ex->frontier[child + 1].score > ex->frontier[child].score) child++;
+        if (ex->frontier[child].score <= last.score) break;
+        ex->frontier[i] = ex->frontier[child];
+        i = child;
+    }
+    ex->frontier[i] = last;
+    return node;
+}
+
+// Blocks until there is a state to expand, and returns false once the search is over.
+static bool next_node(explorer_t *ex, uint32_t *node) {
+    pthread_mutex_lock(&ex->lock);
+    for (;;) {
+        if (atomic_load_explicit(&ex->stop, memory_order_relaxed)) break;
+        if (ex->deadline_ms && now_ms() >= ex->deadline_ms) {
+            atomic_store(&ex->truncated, ex->frontier_count > 0 || ex->busy > 0);
+            atomic_store(&ex->stop, true);
+            break;
+        }
+        if (ex->frontier_count) {
+            *node = frontier_pop(ex);
+            ex->busy++;
+            pthread_mutex_unlock(&ex->lock);
+            return true;
+        }
+        if (ex->busy == 0) {
+            atomic_store(&ex->stop, true); // Nothing left anywhere
+            break;
+        }
+        pthread_cond_wait(&ex->wake, &ex->lock);
+    }
+    pthread_cond_broadcast(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+    return false;
+}
+
+static void report_fault(explorer_t *ex, const chip8_t *chip8, uint32_t parent, uint8_t key) {
+    const uint32_t depth = ex->nodes[parent].depth + 1;
+    pthread_mutex_lock(&ex->lock);
+    ex->fault_total++;
+    uint32_t i = 0;
+    while (i < ex->fault_count && (ex->faults[i].fault != chip8->fault || ex->faults[i].pc != chip8->fault_pc)) i++;
+    // Keep the shortest way into each fault
+    if (i < ex->fault_count ? depth < ex->faults[i].depth : i < MAX_FAULTS) {
+        ex->faults[i] = (fault_report_t){.fault = chip8->fault, .pc = chip8->fault_pc, .parent = parent,
+                                         .key = key, .depth = depth, .cycle = chip8->cycles};
+        if (i == ex->fault_count) ex->fault_count++;
+    }
+    pthread_mutex_unlock(&ex->lock);
+}
+
+// Tries every input from node, queueing the states not seen before.
+static void expand(explorer_t *ex, chip8_t *chip8, uint32_t node, uint8_t *parent_state, uint8_t *child_state,
+    uint8_t *delta) {
+    node_t *parent = &ex->nodes[node];
+    memcpy(parent_state, ex->start_state, ex->state_size);
+    delta_apply(parent_state, parent->delta, parent->delta_size);
+    free(parent->delta);
+    parent->delta = NULL;
+    const bool leaf = ex->max_depth && parent->depth + 1 >= ex->max_depth;
+    frontier_entry_t children[17];
+    uint32_t child_count = 0;
+    for (uint32_t k = 0; k < ex->key_count && !atomic_load_explicit(&ex->stop, memory_order_relaxed); k++) {
+        const uint8_t key = ex->keys[k];
+        unpack_state(chip8, parent_state);
+        if (key != NO_KEY) chip8->keypad[key] = true;
+        run_cycles(chip8, &ex->config, ex->hold_cycles);
+        if (key != NO_KEY) chip8->keypad[key] = false;
+        atomic_fetch_add_explicit(&ex->edges, 1, memory_order_relaxed);
+        if (chip8->fault != FAULT_NONE) {
+            report_fault(ex, chip8, node, key); // Don't carry on from a broken machine
+            continue;
+        }
+        pack_state(chip8, child_state);
+        if (!set_insert(&ex->visited, state_hash(child_state, ex->state_size))) continue;
+        const uint32_t id = atomic_fetch_add_explicit(&ex->node_count, 1, memory_order_relaxed);
+        if (id >= ex->max_states) {
+            atomic_store(&ex->truncated, true);
+            atomic_store(&ex->stop, true);
+            break;
+        }
+        node_t *child = &ex->nodes[id];
+        *child = (node_t){.parent = node, .depth = parent->depth + 1, .key = key};
+        if (leaf) continue;
+        child->delta_size = delta_encode(ex->start_state, child_state, ex->state_size, delta);
+        child->delta = malloc(child->delta_size ? child->delta_size : 1);
+        memcpy(child->delta, delta, child->delta_size);
+        atomic_fetch_add_explicit(&ex->delta_bytes, child->delta_size, memory_order_relaxed);
+        children[child_count++] = (frontier_entry_t){.score = child->delta_size, .node = id};
+    }
+    atomic_fetch_add_explicit(&ex->expanded, 1, memory_order_relaxed);
+    pthread_mutex_lock(&ex->lock);
+    for (uint32_t i = 0; i < child_count; i++) frontier_push(ex, children[i]);
+    ex->busy--;
+    if (child_count || ex->busy == 0 || atomic_load(&ex->stop)) pthread_cond_broadcast(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+static void *worker_main(void *arg) {
+    explorer_t *ex = arg;
+    chip8_t *chip8 = malloc(sizeof *chip8);
+    uint8_t *parent_state = malloc(ex->state_size);
+    uint8_t *child_state = malloc(ex->state_size);
+    uint8_t *delta = malloc(DELTA_MAX(ex->state_size));
+    if (!chip8 || !parent_state || !child_state || !delta) {
+        fprintf(stderr, "Could not allocate a worker\n");
+        exit(EXIT_FAILURE);
+    }
+    *chip8 = *ex->start; // Same ROM, quirks and warm instruction cache; unpack_state does the rest
+    uint32_t node;
+    while (next_node(ex, &node)) expand(ex, chip8, node, parent_state, child_state, delta);
+    free(delta);
+    free(child_state);
+    free(parent_state);
+    free(chip8);
+    return NULL;
+}
+
+// Keys held on the way from the start state to node, in order.
+static uint32_t node_path(const explorer_t *ex, uint32_t node, uint8_t *keys) {
+    const uint32_t depth = ex->nodes[node].depth;
+    for (uint32_t i = depth; i > 0; i--) {
+        keys[i - 1] = ex->nodes[node].key;
+        node = ex->nodes[node].parent;
+    }
+    return depth;
+}
+
+static void print_fault(const explorer_t *ex, const fault_report_t *fault, uint8_t *keys) {
+    printf("fault: %s at 0x%04X after %u inputs (%llu instructions):", chip8_fault_name(fault->fault), fault->pc,
+        fault->depth, (unsigned long long)fault->cycle);
+    const uint32_t count = node_path(ex, fault->parent, keys);
+    keys[count] = fault->key;
+    for (uint32_t i = 0; i <= count; i++) {
+        if (keys[i] == NO_KEY) printf(" -");
+        else printf(" %X", keys[i]);
+    }
+    putchar('\n');
+}
+
+// Writes the inputs leading to fault as a recording, so chip8emu-headless --replay runs into it.
+static bool save_script(const explorer_t *ex, const fault_report_t *fault, uint8_t *keys, const char *path) {
+    input_script_t script = {.rng_state = ex->start->rng_state, .insts_per_second = ex->config.insts_per_second,
+                             .end_cycle = fault->cycle};
+    const uint32_t count = node_path(ex, fault->parent, keys);
+    keys[count] = fault->key;
+    bool ok = true;
+    for (uint32_t i = 0; i <= count && ok; i++) {
+        if (keys[i] == NO_KEY) continue;
+        const uint64_t start = ex->start->cycles + (uint64_t)i * ex->hold_cycles;
+        ok = input_script_record(&script, start, keys[i], true)
+            && input_script_record(&script, start + ex->hold_cycles, keys[i], false);
+    }
+    ok = ok && input_script_save(&script, path);
+    input_script_free(&script);
+    return ok;
+}
+
+static bool parse_keys(const char *list, explorer_t *ex) {
+    bool seen[16] = {false};
+    ex->keys[0] = NO_KEY;
+    ex->key_count = 1;
+    for (const char *c = list; *c; c++) {
+        char digit[2] = {*c, '\0'};
+        char *end;
+        const unsigned long key = strtoul(digit, &end, 16);
+        if (*end || seen[key]) return false;
+        seen[key] = true;
+        ex->keys[ex->key_count++] = key;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    static explorer_t ex;
+    quirks_t quirks = {0};
+    uint32_t seed = 1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t hold_frames = DEFAULT_HOLD_FRAMES;
+    uint64_t time_ms = 0;
+    const char *script_name = NULL;
+    ex.config = (config_t){.window_width = 64, .window_height = 32, .scale_factor = 1,
+                           .insts_per_second = INSTRUCTIONS_PER_SECOND, .skip_idle = true};
+    ex.max_states = DEFAULT_MAX_STATES;
+    parse_keys("0123456789ABCDEF", &ex);
+    bool valid = true;
+    for (int i = 2; i < argc && valid; i += 2) {
+        if (i + 1 >= argc) valid = false; // Every option takes a value
+        else if (strcmp(argv[i], "--quirks") == 0) valid = chip8_quirks_by_name(argv[i + 1], &quirks);
+        else if (strcmp(argv[i], "--ips") == 0) ex.config.insts_per_second = strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--threads") == 0) threads = strtol(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--hold") == 0) hold_frames = strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--keys") == 0) valid = parse_keys(argv[i + 1], &ex);
+        else if (strcmp(argv[i], "--max-states") == 0) ex.max_states = strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--max-depth") == 0) ex.max_depth = strtoul(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--time") == 0) time_ms = strtoull(argv[i + 1], NULL, 0);
+        else if (strcmp(argv[i], "--script") == 0) script_name = argv[i + 1];
+        else if (strcmp(argv[i], "--search") == 0) {
+            if (strcmp(argv[i + 1], "bfs") == 0) ex.search = SEARCH_BREADTH_FIRST;
+            else if (strcmp(argv[i + 1], "best") == 0) ex.search = SEARCH_BEST_FIRST;
+            else valid = false;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || hold_frames == 0 || ex.max_states == 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (threads < 1) threads = 1;
+    if (ex.config.insts_per_second < FPS) ex.config.insts_per_second = FPS;
+    ex.hold_cycles = (uint64_t)hold_frames * ex.config.insts_per_second / FPS;
+
+    chip8_t *start = calloc(1, sizeof *start);
+    if (!start) exit(EXIT_FAILURE);
+    start->quirks = quirks;
+    if (!init_chip8(start, argv[1])) exit(EXIT_FAILURE);
+    chip8_seed(start, seed);
+    ex.start = start;
+    ex.state_size = sizeof(fork_regs_t) + (size_t)start->ram_mask + 1;
+    ex.start_state = malloc(ex.state_size);
+    // Room for every state allowed, plus what the workers find before they notice the limit
+    ex.nodes = malloc(((size_t)ex.max_states + 1) * sizeof *ex.nodes);
+    if (!ex.start_state || !ex.nodes || !set_init(&ex.visited, ex.max_states + 1)) {
+        fprintf(stderr, "Could not allocate room for %u states\n", ex.max_states);
+        exit(EXIT_FAILURE);
+    }
+    pack_state(start, ex.start_state);
+    set_insert(&ex.visited, state_hash(ex.start_state, ex.state_size));
+    ex.nodes[0] = (node_t){.parent = NO_PARENT, .key = NO_KEY, .delta = malloc(1)}; // An empty delta
+    atomic_store(&ex.node_count, 1);
+    pthread_mutex_init(&ex.lock, NULL);
+    pthread_cond_init(&ex.wake, NULL);
+    frontier_push(&ex, (frontier_entry_t){.node = 0});
+
+    const uint64_t start_ms = now_ms();
+    if (time_ms) ex.deadline_ms = start_ms + time_ms;
+    pthread_t *handles = calloc(threads, sizeof *handles);
+    for (long t = 0; t < threads; t++) pthread_create(&handles[t], NULL, worker_main, &ex);
+    for (long t = 0; t < threads; t++) pthread_join(handles[t], NULL);
+    const uint64_t elapsed_ms = now_ms() - start_ms;
+
+    uint32_t states = atomic_load(&ex.node_count);
+    if (states > ex.max_states) states = ex.max_states;
+    uint32_t depth = 0;
+    for (uint32_t i = 0; i < states; i++) {
+        if (ex.nodes[i].depth > depth) depth = ex.nodes[i].depth;
+    }
+    uint8_t *keys = malloc((size_t)depth + 2);
+    for (uint32_t i = 0; i < ex.fault_count; i++) print_fault(&ex, &ex.faults[i], keys);
+    if (script_name && ex.fault_count) {
+        const fault_report_t *shallowest = &ex.faults[0];
+        for (uint32_t i = 1; i < ex.fault_count; i++) {
+            if (ex.faults[i].depth < shallowest->depth) shallowest = &ex.faults[i];
+        }
+        if (!save_script(&ex, shallowest, keys, script_name)) exit(EXIT_FAILURE);
+        printf("Saved the inputs for the %s at 0x%04X to %s\n", chip8_fault_name(shallowest->fault),
+            shallowest->pc, script_name);
+    }
+    const uint64_t made = states > 1 ? states - 1 : 1;
+    fprintf(stderr, "explore: %u states (%s), %llu expanded, depth %u, %llu inputs tried, %llu faults, "
+        "%u distinct\n", states, atomic_load(&ex.truncated) ? "stopped early" : "exhausted",
+        (unsigned long long)atomic_load(&ex.expanded), depth, (unsigned long long)atomic_load(&ex.edges),
+        (unsigned long long)ex.fault_total, ex.fault_count);
+    fprintf(stderr, "explore: %ld threads, %.1f s, %.0f states/s, %.0f inputs/s, %.0f byte deltas, "
+        "frontier peaked at %zu\n", threads, elapsed_ms / 1000.0, states * 1000.0 / (elapsed_ms ? elapsed_ms : 1),
+        atomic_load(&ex.edges) * 1000.0 / (elapsed_ms ? elapsed_ms : 1),
+        (double)atomic_load(&ex.delta_bytes) / made, ex.frontier_peak);
+
+    for (uint32_t i = 0; i < states; i++) free(ex.nodes[i].delta);
+    free(keys);
+    free(handles);
+    free(ex.frontier);
+    free(ex.nodes);
+    free((void *)ex.visited.slots);
+    free(ex.start_state);
+    free(start);
+    return ex.fault_count ? 2 : 0;
+}
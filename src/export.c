@@ -0,0 +1,259 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "./export.h"
+#include "./varint.h"
+
+#define EXPORT_RING_SIZE (1u << 22) // 4 MiB, must be a power of two
+#define EXPORT_RING_MASK (EXPORT_RING_SIZE - 1)
+
+// Like the trace writer: a single producer (emulation thread), single consumer
+// (writer thread) byte ring whose head and tail only ever grow.
+struct export {
+    export_config_t config;
+    uint64_t frames;
+    // Shared memory
+    export_header_t *header; // NULL when not exporting to shared memory
+    export_slot_t *slots;
+    size_t map_size;
+    // Stream
+    FILE *file; // NULL when not streaming
+    uint8_t *ring;
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic bool stop;
+    pthread_t writer;
+    display_row_t base[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT]; // Display as of the last record in the ring
+    bool base_hires;
+    bool base_valid; // False until the first record, after a drop and after a restart: the next one is a keyframe
+    uint64_t base_cycles;
+    uint64_t records;
+    uint64_t dropped;
+};
+
+static bool open_shm(export_t *ex) {
+    const uint32_t slots = ex->config.shm_slots ? ex->config.shm_slots : EXPORT_DEFAULT_SLOTS;
+    const int fd = shm_open(ex->config.shm_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create shared memory object %s\n", ex->config.shm_name);
+        return false;
+    }
+    ex->map_size = sizeof(export_header_t) + slots * sizeof(export_slot_t);
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, ex->map_size) == 0) map = mmap(NULL, ex->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the object alive
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map shared memory object %s\n", ex->config.shm_name);
+        shm_unlink(ex->config.shm_name);
+        return false;
+    }
+    ex->header = map;
+    ex->slots = (export_slot_t *)(ex->header + 1);
+    *ex->header = (export_header_t){
+        .magic = EXPORT_SHM_MAGIC, .version = EXPORT_SHM_VERSION,
+        .slot_count = slots, .slot_size = sizeof(export_slot_t),
+    };
+    return true;
+}
+
+// Writes out everything between tail and head; returns false when the ring was empty.
+static bool drain(export_t *ex) {
+    const uint64_t tail = atomic_load_explicit(&ex->tail, memory_order_relaxed);
+    const uint64_t head = atomic_load_explicit(&ex->head, memory_order_acquire);
+    if (head == tail) return false;
+    const size_t start = tail & EXPORT_RING_MASK;
+    const size_t len = head - tail;
+    const size_t first = len < EXPORT_RING_SIZE - start ? len : EXPORT_RING_SIZE - start;
+    fwrite(&ex->ring[start], 1, first, ex->file);
+    fwrite(&ex->ring[0], 1, len - first, ex->file);
+    fflush(ex->file); // Consumers on the other end of a pipe want frames as they come
+    atomic_store_explicit(&ex->tail, head, memory_order_release);
+    return true;
+}
+
+static void *writer_main(void *arg) {
+    export_t *ex = arg;
+    const struct timespec idle = {.tv_sec = 0, .tv_nsec = 1000000};
+    for (;;) {
+        if (drain(ex)) continue;
+        if (atomic_load_explicit(&ex->stop, memory_order_acquire)) {
+            drain(ex); // Pick up anything published right before stop was set
+            return NULL;
+        }
+        nanosleep(&idle, NULL);
+    }
+}
+
+static bool open_stream(export_t *ex) {
+    const bool to_stdout = strcmp(ex->config.stream_name, "-") == 0;
+    ex->file = to_stdout ? stdout : fopen(ex->config.stream_name, "wb");
+    ex->ring = malloc(EXPORT_RING_SIZE);
+    if (!ex->file || !ex->ring) {
+        fprintf(stderr, "Could not open export stream %s\n", ex->config.stream_name);
+        if (ex->file && !to_stdout) fclose(ex->file);
+        ex->file = NULL;
+        return false;
+    }
+    fwrite(EXPORT_STREAM_MAGIC, 1, 4, ex->file);
+    fputc(EXPORT_STREAM_VERSION, ex->file);
+    if (pthread_create(&ex->writer, NULL, writer_main, ex) != 0) {
+        fprintf(stderr, "Could not start export writer thread\n");
+        if (!to_stdout) fclose(ex->file);
+        ex->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+export_t *export_open(const export_config_t *config) {
+    export_t *ex = calloc(1, sizeof *ex);
+    if (!ex) return NULL;
+    ex->config = *config;
+    if ((config->shm_name && !open_shm(ex)) || (config->stream_name && !open_stream(ex))) {
+        export_close(ex);
+        return NULL;
+    }
+    return ex;
+}
+
+void export_close(export_t *ex) {
+    if (!ex) return;
+    if (ex->file) {
+        atomic_store_explicit(&ex->stop, true, memory_order_release);
+        pthread_join(ex->writer, NULL);
+        if (ex->file == stdout) fflush(stdout);
+        else fclose(ex->file);
+        if (ex->dropped) {
+            fprintf(stderr, "export: %llu records written, %llu dropped (writer too slow)\n",
+                (unsigned long long)ex->records, (unsigned long long)ex->dropped);
+        }
+    }
+    if (ex->header) {
+        munmap(ex->header, ex->map_size);
+        shm_unlink(ex->config.shm_name);
+    }
+    free(ex->ring);
+    free(ex);
+}
+
+static void write_shm(export_t *ex, const chip8_t *chip8) {
+    export_slot_t *slot = &ex->slots[(ex->frames - 1) % ex->header->slot_count];
+    __atomic_store_n(&slot->seq, 2 * ex->frames - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // Readers must see the odd seq before any of the new contents
+    slot->frame = ex->frames;
+    slot->cycles = chip8->cycles;
+    slot->hires = chip8->hires;
+    memcpy(slot->display, chip8->display, sizeof slot->display);
+    slot->has_registers = ex->config.registers;
+    if (ex->config.registers) {
+        slot->PC = chip8->PC;
+        slot->reg_i = chip8->reg_i;
+        slot->sp = chip8->sp;
+        slot->delay_timer = chip8->delay_timer;
+        slot->sound_timer = chip8->sound_timer;
+        memcpy(slot->V, chip8->V, sizeof slot->V);
+    }
+    __atomic_store_n(&slot->seq, 2 * ex->frames, __ATOMIC_RELEASE);
+    __atomic_store_n(&ex->header->latest, ex->frames, __ATOMIC_RELEASE);
+}
+
+static size_t put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+    return 2;
+}
+
+// Encodes the display as runs of unchanged and changed rows against base.
+size_t export_encode_record(const chip8_t *chip8, const display_row_t base[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT],
+                            uint64_t frame, uint64_t base_cycles, uint8_t flags, uint8_t *out) {
+    static const display_row_t blank[DISPLAY_HIRES_HEIGHT];
+    const uint32_t height = chip8_height(chip8);
+    const uint32_t row_bytes = chip8_width(chip8) / 8;
+    const bool keyframe = flags & EXPORT_KEYFRAME;
+    size_t pos = varint_put(out, frame);
+    pos += varint_put(&out[pos], keyframe ? chip8->cycles : chip8->cycles - base_cycles);
+    out[pos++] = (flags & (EXPORT_KEYFRAME | EXPORT_REGISTERS)) | (chip8->hires ? EXPORT_HIRES : 0);
+    if (flags & EXPORT_REGISTERS) {
+        pos += put_u16(&out[pos], chip8->PC);
+        pos += put_u16(&out[pos], chip8->reg_i);
+        out[pos++] = chip8->sp;
+        out[pos++] = chip8->delay_timer;
+        out[pos++] = chip8->sound_timer;
+        memcpy(&out[pos], chip8->V, sizeof chip8->V);
+        pos += sizeof chip8->V;
+    }
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        const display_row_t *rows = chip8->display[plane];
+        const display_row_t *prev = keyframe ? blank : base[plane];
+        uint32_t y = 0;
+        while (y < height) {
+            const uint32_t start = y;
+            while (y < height && rows[y] == prev[y]) y++;
+            const uint32_t unchanged = y - start;
+            while (y < height && rows[y] != prev[y]) y++;
+            pos += varint_put(&out[pos], unchanged);
+            pos += varint_put(&out[pos], y - start - unchanged);
+            for (uint32_t r = start + unchanged; r < y; r++) {
+                const display_row_t diff = rows[r] ^ prev[r];
+                for (uint32_t b = 0; b < row_bytes; b++) out[pos++] = (uint8_t)(diff >> (DISPLAY_HIRES_WIDTH - 8 - 8 * b));
+            }
+        }
+    }
+    return pos;
+}
+
+static void write_stream(export_t *ex, const chip8_t *chip8) {
+    uint8_t record[EXPORT_RECORD_MAX];
+    const bool keyframe = !ex->base_valid || ex->base_hires != chip8->hires
+        || (ex->frames - 1) % EXPORT_KEYFRAME_INTERVAL == 0;
+    const uint8_t flags = (keyframe ? EXPORT_KEYFRAME : 0) | (ex->config.registers ? EXPORT_REGISTERS : 0);
+    const size_t len = export_encode_record(chip8, ex->base, ex->frames, ex->base_cycles, flags, record);
+    const uint64_t head = atomic_load_explicit(&ex->head, memory_order_relaxed);
+    const uint64_t tail = atomic_load_explicit(&ex->tail, memory_order_acquire);
+    if (EXPORT_RING_SIZE - (head - tail) < len) {
+        ex->dropped++;
+        ex->base_valid = false; // The reader never sees this frame, so don't encode against it
+        return;
+    }
+    const size_t start = head & EXPORT_RING_MASK;
+    const size_t first = len < EXPORT_RING_SIZE - start ? len : EXPORT_RING_SIZE - start;
+    memcpy(&ex->ring[start], record, first);
+    memcpy(&ex->ring[0], record + first, len - first);
+    atomic_store_explicit(&ex->head, head + len, memory_order_release);
+    memcpy(ex->base, chip8->display, sizeof ex->base);
+    ex->base_hires = chip8->hires;
+    ex->base_cycles = chip8->cycles;
+    ex->base_valid = true;
+    ex->records++;
+}
+
+void export_frame(export_t *ex, const chip8_t *chip8) {
+    ex->frames++;
+    if (ex->header) write_shm(ex, chip8);
+    if (ex->file) write_stream(ex, chip8);
+}
+
+void export_restart(export_t *ex) {
+    ex->base_valid = false;
+}
+
+bool export_shm_read(const export_header_t *header, export_slot_t *out) {
+    const export_slot_t *slots = (const export_slot_t *)(header + 1);
+    for (int attempt = 0; attempt < 4; attempt++) {
+        const uint64_t frame = __atomic_load_n(&header->latest, __ATOMIC_ACQUIRE);
+        if (!frame) return false;
+        const export_slot_t *slot = &slots[(frame - 1) % header->slot_count];
+        const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq != 2 * frame) continue; // Already being overwritten by a newer frame
+        memcpy(out, slot, sizeof *out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // The copy must be done before seq is checked again
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) return true;
+    }
+    return false;
+}
@@ -0,0 +1,107 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "./chip8.h"
+#include "./varint.h"
+
+// Frame export for external consumers (recorders, bots, dashboards). After each
+// frame the frontend hands the machine to export_frame(), which can feed two
+// sinks, both written without ever waiting on a reader:
+//
+// Shared memory: a POSIX shared memory object holding an export_header_t and a
+// ring of export_slot_t, one per frame. Each slot is guarded by a seqlock: seq is
+// odd while the writer is in it and 2 * frame once it's complete. A reader maps
+// the object read-only, reads header.latest, copies that slot and accepts the
+// copy if seq was 2 * latest both before and after (export_shm_read does this).
+//
+// Stream: a file or pipe of delta-encoded frames. After EXPORT_STREAM_MAGIC and a
+// version byte, each record is
+//   varint frame number
+//   varint instructions since the previous record, or for a keyframe the
+//     machine's instruction count (the count can jump back on a rewind)
+//   u8 flags (EXPORT_HIRES, EXPORT_KEYFRAME, EXPORT_REGISTERS)
+//   [PC u16le, I u16le, SP, DT, ST, V0-VF]  when EXPORT_REGISTERS is set
+//   for each of the DISPLAY_PLANES planes, rows top to bottom as runs of
+//     varint unchanged rows, varint changed rows, then each changed row XORed
+//     with the same row of the previous record (of a blank screen for a
+//     keyframe), width / 8 bytes with the leftmost pixel in the top bit;
+//   the runs of a plane add up to the screen height.
+// Records are encoded on the emulation thread and written out by a thread of
+// its own. If that can't keep up, records are dropped and the next one is a
+// keyframe, so the stream always decodes.
+
+#define EXPORT_SHM_MAGIC 0x58453843u // "C8EX" in little endian
+#define EXPORT_SHM_VERSION 1
+#define EXPORT_STREAM_MAGIC "C8FS"
+#define EXPORT_STREAM_VERSION 2
+#define EXPORT_DEFAULT_SLOTS 8
+#define EXPORT_KEYFRAME_INTERVAL 600 // Frames between keyframes, so a reader can start mid-stream
+
+// Worst case size of a stream record: frame number and cycle varints, flags,
+// registers, then per plane every row changed plus its run counts.
+#define EXPORT_RECORD_MAX (2 * VARINT_MAX + 1 + 23 + DISPLAY_PLANES * DISPLAY_HIRES_HEIGHT * (DISPLAY_HIRES_WIDTH / 8 + 2))
+
+// Stream record flags
+#define EXPORT_HIRES 0x01
+#define EXPORT_KEYFRAME 0x02
+#define EXPORT_REGISTERS 0x04
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size; // sizeof(export_slot_t), so a reader can sanity check
+    uint64_t latest; // Newest complete frame, 0 before the first
+    uint64_t reserved;
+} export_header_t;
+
+// One frame in the shared memory ring, slot (frame - 1) % slot_count.
+typedef struct {
+    uint64_t seq; // Seqlock, see above
+    uint64_t frame;
+    uint64_t cycles;
+    uint16_t PC;
+    uint16_t reg_i;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t hires;
+    display_row_t display[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT]; // Host byte order, bit 127 is x = 0
+    uint8_t V[16];
+    uint8_t has_registers; // PC, I, SP, the timers and V are only filled in when set
+    uint8_t reserved[15];
+} export_slot_t;
+
+typedef struct {
+    const char *shm_name; // Shared memory object, e.g. "/chip8"; NULL = none
+    uint32_t shm_slots; // 0 = EXPORT_DEFAULT_SLOTS
+    const char *stream_name; // Delta stream, "-" = stdout; NULL = none
+    bool registers; // Export registers and timers along with the display
+} export_config_t;
+
+typedef struct export export_t;
+
+// Creates the shared memory object and/or opens the stream. NULL on failure.
+export_t *export_open(const export_config_t *config);
+// Flushes the stream, removes the shared memory object and reports dropped records.
+void export_close(export_t *ex);
+// Exports one frame; called by the emulation thread, never blocks.
+void export_frame(export_t *ex, const chip8_t *chip8);
+// Makes the next record a keyframe, for when the machine jumped to another
+// state (a rewind, a loaded snapshot or a reloaded ROM) since the last one.
+void export_restart(export_t *ex);
+
+// Encodes one stream record of chip8's display into out (EXPORT_RECORD_MAX bytes)
+// and returns its size. base and base_cycles are the display and instruction count
+// of the previous record, both unused for a keyframe. flags takes EXPORT_KEYFRAME and
+// EXPORT_REGISTERS, EXPORT_HIRES comes from chip8. Also used by the session server.
+size_t export_encode_record(const chip8_t *chip8, const display_row_t base[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT],
+                            uint64_t frame, uint64_t base_cycles, uint8_t flags, uint8_t *out);
+
+// Reader side: copies the newest complete frame out of a mapped ring. Returns
+// false when there is none yet or the writer kept overtaking the copy.
+bool export_shm_read(const export_header_t *header, export_slot_t *out);
+
+#endif
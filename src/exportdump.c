@@ -0,0 +1,207 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "./export.h"
+#include "./varint.h"
+
+// Reference reader for export.c: decodes a frame stream, or follows a shared
+// memory export, and prints one line per frame (plus the screen with --display).
+
+#define SHM_POLL_NS 2000000 // 2 ms, well under a frame
+#define SHM_IDLE_POLLS 500 // Give up after a second without a new frame
+
+typedef struct {
+    uint64_t frame;
+    uint64_t cycles;
+    bool hires;
+    bool has_registers;
+    uint16_t PC;
+    uint16_t reg_i;
+    uint8_t sp, delay_timer, sound_timer;
+    uint8_t V[16];
+    display_row_t display[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT];
+} frame_t;
+
+static void print_frame(const frame_t *frame, uint32_t changed_rows, bool show_display) {
+    printf("frame %llu  cycles %llu  %s", (unsigned long long)frame->frame, (unsigned long long)frame->cycles,
+        frame->hires ? "128x64" : "64x32");
+    if (changed_rows != UINT32_MAX) printf("  %u rows changed", changed_rows);
+    if (frame->has_registers) {
+        printf("  PC=0x%04X I=0x%04X SP=%u DT=%u ST=%u", frame->PC, frame->reg_i, frame->sp,
+            frame->delay_timer, frame->sound_timer);
+        for (int i = 0; i < 16; i++) printf(" V%X=0x%02X", i, frame->V[i]);
+    }
+    putchar('\n');
+    if (!show_display) return;
+    const uint32_t width = frame->hires ? DISPLAY_HIRES_WIDTH : DISPLAY_WIDTH;
+    const uint32_t height = frame->hires ? DISPLAY_HIRES_HEIGHT : DISPLAY_HEIGHT;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t shift = DISPLAY_HIRES_WIDTH - 1 - x;
+            const int pixel = (int)(frame->display[0][y] >> shift & 1) | (int)(frame->display[1][y] >> shift & 1) << 1;
+            putchar(".#+%"[pixel]);
+        }
+        putchar('\n');
+    }
+}
+
+static bool read_varint(FILE *in, uint64_t *value) {
+    uint8_t bytes[VARINT_MAX];
+    for (size_t n = 0; n < VARINT_MAX; n++) {
+        const int byte = fgetc(in);
+        if (byte == EOF) return false;
+        bytes[n] = byte;
+        if (!(byte & 0x80)) return varint_get(bytes, n + 1, value) == n + 1;
+    }
+    return false;
+}
+
+static bool read_bytes(FILE *in, uint8_t *out, size_t size) {
+    return fread(out, 1, size, in) == size;
+}
+
+// Applies one record to frame; returns the number of rows it changed, -1 at the end of
+// the stream, or -2 for a truncated or corrupt record.
+static int read_record(FILE *in, frame_t *frame, bool *synced) {
+    uint64_t cycles;
+    if (!read_varint(in, &frame->frame)) return -1;
+    uint8_t flags;
+    if (!read_varint(in, &cycles) || !read_bytes(in, &flags, 1)) return -2;
+    frame->cycles = flags & EXPORT_KEYFRAME ? cycles : frame->cycles + cycles;
+    frame->hires = flags & EXPORT_HIRES;
+    frame->has_registers = flags & EXPORT_REGISTERS;
+    if (frame->has_registers) {
+        uint8_t regs[7];
+        if (!read_bytes(in, regs, sizeof regs) || !read_bytes(in, frame->V, sizeof frame->V)) return -2;
+        frame->PC = regs[0] | regs[1] << 8;
+        frame->reg_i = regs[2] | regs[3] << 8;
+        frame->sp = regs[4];
+        frame->delay_timer = regs[5];
+        frame->sound_timer = regs[6];
+    }
+    if (flags & EXPORT_KEYFRAME) {
+        memset(frame->display, 0, sizeof frame->display);
+        *synced = true;
+    }
+    const uint32_t height = frame->hires ? DISPLAY_HIRES_HEIGHT : DISPLAY_HEIGHT;
+    const uint32_t row_bytes = (frame->hires ? DISPLAY_HIRES_WIDTH : DISPLAY_WIDTH) / 8;
+    int changed_rows = 0;
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        uint32_t y = 0;
+        while (y < height) {
+            uint64_t unchanged, changed;
+            if (!read_varint(in, &unchanged) || !read_varint(in, &changed)) return -2;
+            if (unchanged + changed > height - y) return -2;
+            y += unchanged;
+            for (uint64_t r = 0; r < changed; r++, y++) {
+                uint8_t bytes[DISPLAY_HIRES_WIDTH / 8];
+                if (!read_bytes(in, bytes, row_bytes)) return -2;
+                display_row_t diff = 0;
+                for (uint32_t b = 0; b < row_bytes; b++) diff |= (display_row_t)bytes[b] << (DISPLAY_HIRES_WIDTH - 8 - 8 * b);
+                frame->display[plane][y] ^= diff;
+                changed_rows++;
+            }
+        }
+    }
+    return changed_rows;
+}
+
+static int dump_stream(const char *name, bool show_display) {
+    const bool from_stdin = strcmp(name, "-") == 0;
+    FILE *in = from_stdin ? stdin : fopen(name, "rb");
+    if (!in) {
+        fprintf(stderr, "Could not open export stream %s\n", name);
+        return EXIT_FAILURE;
+    }
+    uint8_t magic[5];
+    if (!read_bytes(in, magic, sizeof magic) || memcmp(magic, EXPORT_STREAM_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not a chip8 frame stream\n", name);
+        return EXIT_FAILURE;
+    }
+    if (magic[4] != EXPORT_STREAM_VERSION) {
+        fprintf(stderr, "Unsupported frame stream version %u\n", magic[4]);
+        return EXIT_FAILURE;
+    }
+    frame_t frame = {0};
+    bool synced = false; // Deltas mean nothing until the first keyframe
+    int changed_rows;
+    while ((changed_rows = read_record(in, &frame, &synced)) >= 0) {
+        if (synced) print_frame(&frame, changed_rows, show_display);
+    }
+    if (!from_stdin) fclose(in);
+    if (changed_rows == -2) {
+        fprintf(stderr, "Truncated or corrupt record after frame %llu\n", (unsigned long long)frame.frame);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int follow_shm(const char *name, bool show_display) {
+    const int fd = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(export_header_t)) {
+        fprintf(stderr, "Could not open shared memory object %s\n", name);
+        return EXIT_FAILURE;
+    }
+    const export_header_t *header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "Could not map shared memory object %s\n", name);
+        return EXIT_FAILURE;
+    }
+    if (header->magic != EXPORT_SHM_MAGIC || header->version != EXPORT_SHM_VERSION
+        || header->slot_size != sizeof(export_slot_t)
+        || sizeof *header + (size_t)header->slot_count * sizeof(export_slot_t) > (size_t)st.st_size) {
+        fprintf(stderr, "%s is not a chip8 export (or a different version)\n", name);
+        return EXIT_FAILURE;
+    }
+    const struct timespec poll = {.tv_sec = 0, .tv_nsec = SHM_POLL_NS};
+    uint64_t last = 0, missed = 0;
+    for (int idle = 0; idle < SHM_IDLE_POLLS; idle++) {
+        export_slot_t slot;
+        if (export_shm_read(header, &slot) && slot.frame != last) {
+            if (last && slot.frame > last + 1) missed += slot.frame - last - 1;
+            last = slot.frame;
+            idle = 0;
+            frame_t frame = {
+                .frame = slot.frame, .cycles = slot.cycles, .hires = slot.hires, .has_registers = slot.has_registers,
+                .PC = slot.PC, .reg_i = slot.reg_i, .sp = slot.sp,
+                .delay_timer = slot.delay_timer, .sound_timer = slot.sound_timer,
+            };
+            memcpy(frame.V, slot.V, sizeof frame.V);
+            memcpy(frame.display, slot.display, sizeof frame.display);
+            print_frame(&frame, UINT32_MAX, show_display);
+            fflush(stdout);
+        }
+        nanosleep(&poll, NULL);
+    }
+    fprintf(stderr, "No new frame for a second; %llu frames skipped while following\n", (unsigned long long)missed);
+    munmap((void *)header, st.st_size);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    const char *shm_name = NULL;
+    const char *stream_name = NULL;
+    bool show_display = false;
+    bool valid = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--display") == 0) show_display = true;
+        else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) shm_name = argv[++i];
+        else if (!stream_name && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) stream_name = argv[i];
+        else valid = false;
+    }
+    if (!valid || !shm_name == !stream_name) {
+        fprintf(stderr, "Usage %s <stream_file|-> [--display]\n"
+            "       %s --shm NAME [--display]\n", argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return shm_name ? follow_shm(shm_name, show_display) : dump_stream(stream_name, show_display);
+}
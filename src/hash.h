@@ -0,0 +1,19 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FNV1A64_INIT 0xCBF29CE484222325ull
+
+// FNV-1a, 64 bit. Chain calls by passing the previous result as hash.
+static inline uint64_t fnv1a64(const void *data, size_t size, uint64_t hash) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+#endif
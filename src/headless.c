@@ -0,0 +1,383 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "./constants.h"
+#include "./aot.h"
+#include "./chip8.h"
+#include "./export.h"
+#include "./input.h"
+#include "./jit.h"
+#include "./lockstep.h"
+#include "./profile.h"
+#include "./snapshot.h"
+#include "./trace.h"
+
+// Headless runner: drives the core with no SDL at all, as fast as the host allows.
+// Emulated time is derived from the instruction count, so timers still tick
+// at 60Hz relative to the program no matter how fast we actually run.
+
+typedef enum {
+    ENGINE_INTERPRETER,
+    ENGINE_JIT,
+    ENGINE_JIT_VERIFY, // JIT with the interpreter running alongside as the reference
+    ENGINE_AOT,
+    ENGINE_AOT_VERIFY, // AOT module with the interpreter running alongside as the reference
+} engine_t;
+
+typedef struct {
+    const char *rom_name;
+    uint64_t max_cycles; // Instruction budget, 0 = unlimited
+    uint64_t max_time_ms; // Wall-clock limit, 0 = unlimited
+    const char *out_name; // Where to write the final state, NULL = stdout
+    const char *trace_name; // Binary instruction trace, NULL = off
+    const char *profile_name; // Profile report, "-" = stderr, NULL = off
+    const char *load_state_name; // Snapshot to resume from, NULL = start the ROM fresh
+    const char *save_state_name; // Where to write a snapshot of the final state, NULL = don't
+    const char *replay_name; // Input script or recorded log to feed in, NULL = no input
+    bool seeded;
+    uint32_t seed;
+    engine_t engine;
+    const char *aot_cache; // Where AOT modules are kept, NULL = the default (see aot.h)
+    uint32_t lanes; // > 1 runs that many instances in lockstep
+    quirks_t quirks; // Zero = plain CHIP-8
+    export_config_t export; // Per-frame shared memory and stream export
+} headless_config_t;
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage %s <rom_name> [options]\n"
+        "  --cycles N    stop after N instructions (default 1000000 when no limit is given)\n"
+        "  --time MS     stop after MS milliseconds of wall-clock time\n"
+        "  --ips N       emulated instructions per second (default %d)\n"
+        "  --quirks P    chip8 (default), vip, schip or xochip\n"
+        "  --out FILE    write the final state to FILE instead of stdout\n"
+        "  --trace FILE  write a binary instruction trace to FILE (decode with chip8trace)\n"
+        "  --export-shm NAME     publish every frame in the POSIX shared memory object NAME\n"
+        "  --export-stream FILE  write every frame to FILE (- for stdout, needs --out) as a delta stream\n"
+        "  --export-registers on|off  include registers and timers in the export (default off)\n"
+        "  --profile FILE  write an opcode/address profile to FILE (- for stderr; needs make headless-profile)\n"
+        "  --seed N      seed the CXNN random number generator (default: time based)\n"
+        "  --replay FILE feed keypad input from a text script or a recorded log\n"
+        "                (a log also sets the seed, --ips and, without --cycles, the length)\n"
+        "  --load-state FILE  resume from a snapshot instead of the start of the ROM\n"
+        "  --save-state FILE  write a snapshot of the final state to FILE\n"
+        "  --engine E    interp (default), jit, verify (jit checked against the interpreter),\n"
+        "                aot (precompiled module per ROM, built on first use) or aot-verify\n"
+        "  --aot-cache DIR  keep AOT modules in DIR instead of the default cache\n"
+        "  --lanes N     run N (up to %d) plain CHIP-8 instances in SIMD lockstep and summarise\n"
+        "                each; they differ only in their seed (--seed N gives lane l seed N + l), and\n"
+        "                only --cycles, --ips, --out and --skip-idle apply to them\n"
+        "  --skip-idle on|off  fast-forward through delay timer and key wait loops (default on;\n"
+        "                the result is the same either way)\n",
+        prog, INSTRUCTIONS_PER_SECOND, LOCKSTEP_LANES);
+}
+
+static bool parse_args(headless_config_t *hc, config_t *config, int argc, char **argv) {
+    if (argc < 2) return false;
+    hc->rom_name = argv[1];
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) return false; // Every option takes a value
+        if (strcmp(argv[i], "--cycles") == 0) {
+            hc->max_cycles = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--time") == 0) {
+            hc->max_time_ms = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--ips") == 0) {
+            config->insts_per_second = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--quirks") == 0) {
+            if (!chip8_quirks_by_name(argv[++i], &hc->quirks)) return false;
+        } else if (strcmp(argv[i], "--out") == 0) {
+            hc->out_name = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            hc->trace_name = argv[++i];
+        } else if (strcmp(argv[i], "--export-shm") == 0) {
+            hc->export.shm_name = argv[++i];
+        } else if (strcmp(argv[i], "--export-stream") == 0) {
+            hc->export.stream_name = argv[++i];
+        } else if (strcmp(argv[i], "--export-registers") == 0) {
+            const char *value = argv[++i];
+            if (strcmp(value, "on") == 0) hc->export.registers = true;
+            else if (strcmp(value, "off") == 0) hc->export.registers = false;
+            else return false;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            hc->profile_name = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            hc->seed = strtoul(argv[++i], NULL, 0);
+            hc->seeded = true;
+        } else if (strcmp(argv[i], "--replay") == 0) {
+            hc->replay_name = argv[++i];
+        } else if (strcmp(argv[i], "--load-state") == 0) {
+            hc->load_state_name = argv[++i];
+        } else if (strcmp(argv[i], "--save-state") == 0) {
+            hc->save_state_name = argv[++i];
+        } else if (strcmp(argv[i], "--lanes") == 0) {
+            hc->lanes = strtoul(argv[++i], NULL, 0);
+            if (hc->lanes > LOCKSTEP_LANES) return false;
+        } else if (strcmp(argv[i], "--skip-idle") == 0) {
+            const char *value = argv[++i];
+            if (strcmp(value, "on") == 0) config->skip_idle = true;
+            else if (strcmp(value, "off") == 0) config->skip_idle = false;
+            else return false;
+        } else if (strcmp(argv[i], "--engine") == 0) {
+            const char *engine = argv[++i];
+            if (strcmp(engine, "interp") == 0) hc->engine = ENGINE_INTERPRETER;
+            else if (strcmp(engine, "jit") == 0) hc->engine = ENGINE_JIT;
+            else if (strcmp(engine, "verify") == 0) hc->engine = ENGINE_JIT_VERIFY;
+            else if (strcmp(engine, "aot") == 0) hc->engine = ENGINE_AOT;
+            else if (strcmp(engine, "aot-verify") == 0) hc->engine = ENGINE_AOT_VERIFY;
+            else return false;
+        } else if (strcmp(argv[i], "--aot-cache") == 0) {
+            hc->aot_cache = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    if (config->insts_per_second < FPS) config->insts_per_second = FPS; // Timers need at least one instruction per tick
+    // The final state would end up in the middle of the stream
+    if (hc->export.stream_name && strcmp(hc->export.stream_name, "-") == 0 && !hc->out_name) return false;
+    return true;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void dump_state(FILE *out, const chip8_t *chip8, uint64_t cycles, uint64_t elapsed_ms) {
+    fprintf(out, "rom: %s\n", chip8->rom_name);
+    fprintf(out, "cycles: %llu\n", (unsigned long long)cycles);
+    fprintf(out, "idle_cycles: %llu\n", (unsigned long long)chip8->idle_cycles);
+    fprintf(out, "elapsed_ms: %llu\n", (unsigned long long)elapsed_ms);
+    if (chip8->fault) fprintf(out, "fault: %s at 0x%04X\n", chip8_fault_name(chip8->fault), chip8->fault_pc);
+    fprintf(out, "PC: 0x%04X I: 0x%04X SP: %d DT: %u ST: %u\n",
+        chip8->PC, chip8->reg_i, chip8->sp,
+        chip8->delay_timer, chip8->sound_timer);
+    for (int i = 0; i < 16; i++) {
+        fprintf(out, "V%X: 0x%02X%c", i, chip8->V[i], i % 8 == 7 ? '\n' : ' ');
+    }
+    fprintf(out, "display:\n");
+    for (uint32_t y = 0; y < chip8_height(chip8); y++) {
+        for (uint32_t x = 0; x < chip8_width(chip8); x++) {
+            fputc(".#+%"[chip8_pixel(chip8, x, y)], out); // Second and both XO-CHIP planes as + and %
+        }
+        fputc('\n', out);
+    }
+}
+
+// Compares everything an instruction can change; the instruction cache and trace sink are not machine state.
+static bool same_state(const chip8_t *a, const chip8_t *b) {
+    return a->PC == b->PC && a->reg_i == b->reg_i
+        && a->sp == b->sp
+        && a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer
+        && memcmp(a->V, b->V, sizeof a->V) == 0
+        && memcmp(a->stack, b->stack, sizeof a->stack) == 0
+        && a->hires == b->hires && a->planes == b->planes
+        && memcmp(a->display, b->display, sizeof a->display) == 0
+        && memcmp(a->flags, b->flags, sizeof a->flags) == 0
+        && memcmp(a->ram, b->ram, sizeof a->ram) == 0;
+}
+
+// The first option given that a lockstep run has no use for, or NULL if there's none.
+static const char *lanes_unsupported(const headless_config_t *hc) {
+    if (hc->max_time_ms) return "--time";
+    if (hc->trace_name) return "--trace";
+    if (hc->profile_name) return "--profile";
+    if (hc->replay_name) return "--replay";
+    if (hc->load_state_name) return "--load-state";
+    if (hc->save_state_name) return "--save-state";
+    if (hc->export.shm_name || hc->export.stream_name || hc->export.registers) return "--export-*";
+    if (hc->engine != ENGINE_INTERPRETER || hc->aot_cache) return "--engine";
+    if (!chip8_quirks_plain(&hc->quirks)) return "--quirks";
+    return NULL;
+}
+
+static int run_lockstep(const headless_config_t *hc, config_t *config) {
+    lockstep_t *ls = aligned_alloc(_Alignof(lockstep_t), sizeof *ls);
+    if (!ls || !lockstep_init(ls, hc->rom_name, hc->lanes)) exit(EXIT_FAILURE);
+    // One seed per lane, so a seeded sweep is reproducible
+    for (uint32_t l = 0; hc->seeded && l < ls->lanes; l++) chip8_seed(ls->lane[l], hc->seed + l);
+    const uint64_t start_ms = now_ms();
+    lockstep_run(ls, config, hc->max_cycles);
+    const uint64_t elapsed_ms = now_ms() - start_ms;
+
+    FILE *out = hc->out_name ? fopen(hc->out_name, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Could not open %s for writing\n", hc->out_name);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(out, "rom: %s\ncycles: %llu\nelapsed_ms: %llu\n", hc->rom_name,
+        (unsigned long long)ls->cycles, (unsigned long long)elapsed_ms);
+    for (uint32_t l = 0; l < ls->lanes; l++) {
+        const chip8_t *chip8 = lockstep_lane(ls, l);
+        fprintf(out, "lane %2u: PC: 0x%04X I: 0x%04X display: %016llx state: %016llx\n", l, chip8->PC,
+            chip8->reg_i, (unsigned long long)chip8_display_hash(chip8), (unsigned long long)chip8_state_hash(chip8));
+    }
+    if (out != stdout) fclose(out);
+    lockstep_report(ls, stderr);
+    lockstep_free(ls);
+    free(ls);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    headless_config_t hc = {0};
+    chip8_t chip8 = {0};
+    config_t config = {0};
+    config.window_width = 64;
+    config.window_height = 32;
+    config.scale_factor = 1;
+    config.insts_per_second = INSTRUCTIONS_PER_SECOND;
+    config.skip_idle = true;
+    if (!parse_args(&hc, &config, argc, argv)) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (hc.lanes > 1 && lanes_unsupported(&hc)) {
+        fprintf(stderr, "--lanes can't be combined with %s\n", lanes_unsupported(&hc));
+        exit(EXIT_FAILURE);
+    }
+    input_script_t script = {0};
+    if (hc.replay_name) {
+        if (!input_script_load(&script, hc.replay_name)) exit(EXIT_FAILURE);
+        // A recording replays under the conditions it was made in
+        if (script.insts_per_second) config.insts_per_second = script.insts_per_second;
+        if (!hc.max_cycles && !hc.max_time_ms) hc.max_cycles = script.end_cycle;
+    }
+    if (hc.max_cycles == 0 && hc.max_time_ms == 0) hc.max_cycles = 1000000;
+    if (hc.lanes > 1) return run_lockstep(&hc, &config);
+    chip8.quirks = hc.quirks;
+    if (!init_chip8(&chip8, hc.rom_name)) exit(EXIT_FAILURE);
+    if (hc.seeded) chip8_seed(&chip8, hc.seed);
+    if (script.rng_state) chip8.rng_state = script.rng_state;
+    // The program as loaded, which is what an AOT module is built from even when resuming a snapshot
+    uint8_t image[AOT_IMAGE_SIZE];
+    memcpy(image, chip8.ram, sizeof image);
+    if (hc.load_state_name) {
+        chip8_snapshot_t snap;
+        if (!snapshot_read_file(hc.load_state_name, &snap) || !snapshot_load(&chip8, &snap)) exit(EXIT_FAILURE);
+    }
+    if (hc.trace_name) {
+#if CHIP8_TRACE
+        chip8.trace = trace_open(hc.trace_name);
+        if (!chip8.trace) exit(EXIT_FAILURE);
+#else
+        fprintf(stderr, "Tracing was compiled out (CHIP8_NO_TRACE)\n");
+#endif
+    }
+    if (hc.profile_name) {
+#if CHIP8_PROFILING
+        chip8.profile = profile_create();
+        if (!chip8.profile) exit(EXIT_FAILURE);
+        profile_install_signal();
+        // Only the interpreter counts instructions
+        hc.engine = ENGINE_INTERPRETER;
+#else
+        fprintf(stderr, "Profiling is not compiled in; build with make headless-profile\n");
+#endif
+    }
+
+    export_t *exporter = NULL;
+    if (hc.export.shm_name || hc.export.stream_name) {
+        exporter = export_open(&hc.export);
+        if (!exporter) exit(EXIT_FAILURE);
+    }
+
+    jit_t *jit = NULL;
+    aot_t *aot = NULL;
+    chip8_t *reference = NULL;
+    if (hc.engine == ENGINE_JIT || hc.engine == ENGINE_JIT_VERIFY) {
+        jit = jit_create();
+        if (!jit) hc.engine = ENGINE_INTERPRETER;
+    } else if (hc.engine == ENGINE_AOT || hc.engine == ENGINE_AOT_VERIFY) {
+        if (chip8_quirks_plain(&chip8.quirks)) aot = aot_load(image, hc.aot_cache);
+        else fprintf(stderr, "The AOT engine only translates plain CHIP-8 (--quirks chip8), using the interpreter\n");
+        if (aot) aot_sync(aot, &chip8);
+        else hc.engine = ENGINE_INTERPRETER;
+    }
+    config_t reference_config = config;
+    reference_config.skip_idle = false; // Check the fast-forwarding as well
+    if (hc.engine == ENGINE_JIT_VERIFY || hc.engine == ENGINE_AOT_VERIFY) {
+        reference = malloc(sizeof *reference);
+        *reference = chip8;
+        reference->trace = NULL;
+    }
+
+    const uint64_t start_ms = now_ms();
+    uint64_t cycles = 0;
+    while (chip8.state != QUIT) {
+        if (hc.max_cycles && cycles >= hc.max_cycles) break;
+        // Reading the clock is far more expensive than an instruction, so only check it once per frame
+        if (hc.max_time_ms && now_ms() - start_ms >= hc.max_time_ms) break;
+        // Run up to the next 60Hz timer tick (or the end of the budget) in one go. Ticks follow the
+        // machine's own instruction count, so a run resumed from a snapshot keeps the same timing.
+        const uint64_t tick = chip8_next_tick(chip8.cycles, config.insts_per_second);
+        uint64_t batch = tick - chip8.cycles;
+        if (hc.max_cycles && batch > hc.max_cycles - cycles) batch = hc.max_cycles - cycles;
+        // Stop at the next input event so it lands on exactly the recorded instruction
+        const uint64_t next_event = input_script_apply(&script, &chip8);
+        if (batch > next_event - chip8.cycles) batch = next_event - chip8.cycles;
+        if (reference) memcpy(reference->keypad, chip8.keypad, sizeof chip8.keypad);
+        if (jit) jit_run(jit, &chip8, &config, batch);
+        else if (aot) aot_run(aot, &chip8, &config, batch);
+        else emulate_cycles(&chip8, &config, batch);
+        if (reference) {
+            emulate_cycles(reference, &reference_config, batch);
+            if (!same_state(&chip8, reference)) {
+                fprintf(stderr, "%s diverged from the interpreter between cycles %llu and %llu "
+                    "(PC 0x%04X, interpreter PC 0x%04X)\n", jit ? "JIT" : "AOT module", (unsigned long long)cycles,
+                    (unsigned long long)(cycles + batch), chip8.PC, reference->PC);
+                exit(EXIT_FAILURE);
+            }
+        }
+        cycles += batch;
+        if (chip8.cycles == tick) {
+            update_timers(&chip8);
+            if (reference) update_timers(reference);
+            if (exporter) export_frame(exporter, &chip8);
+        }
+#if CHIP8_PROFILING
+        if (chip8.profile && profile_dump_requested()) profile_dump(chip8.profile, &chip8, stderr);
+#endif
+    }
+    const uint64_t elapsed_ms = now_ms() - start_ms;
+    if (jit) {
+        jit_report(jit, stderr);
+        jit_destroy(jit);
+    }
+    if (aot) {
+        aot_report(aot, stderr);
+        aot_destroy(aot);
+    }
+    free(reference);
+    input_script_free(&script);
+    export_close(exporter);
+#if CHIP8_TRACE
+    trace_close(chip8.trace);
+#endif
+#if CHIP8_PROFILING
+    if (chip8.profile) {
+        profile_write(chip8.profile, &chip8, hc.profile_name);
+        profile_destroy(chip8.profile);
+    }
+#endif
+
+    FILE *out = stdout;
+    if (hc.out_name) {
+        out = fopen(hc.out_name, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open %s for writing\n", hc.out_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    dump_state(out, &chip8, cycles, elapsed_ms);
+    if (out != stdout) fclose(out);
+    if (hc.save_state_name) {
+        chip8_snapshot_t snap;
+        snapshot_save(&chip8, &snap);
+        if (!snapshot_write_file(hc.save_state_name, &snap)) exit(EXIT_FAILURE);
+    }
+    return 0;
+}
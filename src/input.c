@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./constants.h"
+#include "./input.h"
+#include "./varint.h"
+
+static bool push_event(input_script_t *script, input_event_t event) {
+    if (script->count == script->capacity) {
+        const size_t capacity = script->capacity ? script->capacity * 2 : 64;
+        input_event_t *events = realloc(script->events, capacity * sizeof *events);
+        if (!events) return false;
+        script->events = events;
+        script->capacity = capacity;
+    }
+    script->events[script->count++] = event;
+    return true;
+}
+
+static bool load_binary(input_script_t *script, FILE *file, const char *path) {
+    input_log_header_t header;
+    if (fread(&header, sizeof header, 1, file) != 1 || header.version != INPUT_LOG_VERSION) {
+        fprintf(stderr, "Input log %s has an unsupported version\n", path);
+        return false;
+    }
+    // Timers tick FPS times per insts_per_second instructions, so a slower clock can't be replayed
+    if (header.insts_per_second && header.insts_per_second < FPS) {
+        fprintf(stderr, "Input log %s was recorded at %u instructions per second, below the %d minimum\n", path,
+            header.insts_per_second, FPS);
+        return false;
+    }
+    script->rng_state = header.rng_state;
+    script->insts_per_second = header.insts_per_second;
+    script->end_cycle = header.end_cycle;
+    // Logs are small; decode them from memory
+    uint8_t *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    for (size_t n = 1; n > 0; size += n) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            uint8_t *grown = realloc(data, capacity);
+            if (!grown) {
+                free(data);
+                return false;
+            }
+            data = grown;
+        }
+        n = fread(&data[size], 1, capacity - size, file);
+    }
+    uint64_t cycle = 0;
+    for (size_t pos = 0; pos < size;) {
+        uint64_t delta;
+        const size_t n = varint_get(&data[pos], size - pos, &delta);
+        if (n == 0 || pos + n >= size) {
+            fprintf(stderr, "Input log %s is truncated\n", path);
+            free(data);
+            return false;
+        }
+        const uint8_t event = data[pos + n];
+        pos += n + 1;
+        cycle += delta;
+        if (!push_event(script, (input_event_t){.cycle = cycle, .key = event & 0x0F, .pressed = event >> 4})) {
+            free(data);
+            return false;
+        }
+    }
+    free(data);
+    return true;
+}
+
+static bool load_text(input_script_t *script, FILE *file, const char *path) {
+    char line[256];
+    unsigned line_number = 0;
+    uint64_t last_cycle = 0;
+    while (fgets(line, sizeof line, file)) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        unsigned long long cycle;
+        unsigned key;
+        char state[8];
+        const int fields = sscanf(line, "%llu %x %7s", &cycle, &key, state);
+        if (fields <= 0) continue; // Blank line
+        const bool pressed = fields == 3 && strcmp(state, "down") == 0;
+        if (fields != 3 || key > 0xF || (!pressed && strcmp(state, "up") != 0) || cycle < last_cycle) {
+            fprintf(stderr, "%s:%u: expected '<cycle> <key> <down|up>' in cycle order\n", path, line_number);
+            return false;
+        }
+        last_cycle = cycle;
+        if (!push_event(script, (input_event_t){.cycle = cycle, .key = key, .pressed = pressed})) return false;
+    }
+    return true;
+}
+
+bool input_script_load(input_script_t *script, const char *path) {
+    *script = (input_script_t){0};
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Input script %s is invalid\n", path);
+        return false;
+    }
+    char magic[4] = {0};
+    const bool binary = fread(magic, sizeof magic, 1, file) == 1 && memcmp(magic, INPUT_LOG_MAGIC, 4) == 0;
+    rewind(file);
+    const bool ok = binary ? load_binary(script, file, path) : load_text(script, file, path);
+    fclose(file);
+    if (!ok) input_script_free(script);
+    return ok;
+}
+
+bool input_script_save(const input_script_t *script, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return false;
+    }
+    input_log_header_t header = {
+        .version = INPUT_LOG_VERSION,
+        .rng_state = script->rng_state,
+        .insts_per_second = script->insts_per_second,
+        .end_cycle = script->end_cycle,
+    };
+    memcpy(header.magic, INPUT_LOG_MAGIC, sizeof header.magic);
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1;
+    uint64_t last_cycle = 0;
+    for (size_t i = 0; ok && i < script->count; i++) {
+        const input_event_t *event = &script->events[i];
+        uint8_t buf[VARINT_MAX + 1];
+        size_t n = varint_put(buf, event->cycle - last_cycle);
+        buf[n++] = event->key | event->pressed << 4;
+        ok = fwrite(buf, n, 1, file) == 1;
+        last_cycle = event->cycle;
+    }
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Could not write input log to %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void input_script_free(input_script_t *script) {
+    free(script->events);
+    *script = (input_script_t){0};
+}
+
+bool input_script_record(input_script_t *script, uint64_t cycle, uint8_t key, bool pressed) {
+    return push_event(script, (input_event_t){.cycle = cycle, .key = key & 0x0F, .pressed = pressed});
+}
+
+void input_script_truncate(input_script_t *script, uint64_t cycle) {
+    while (script->count > 0 && script->events[script->count - 1].cycle >= cycle) script->count--;
+    if (script->next > script->count) script->next = script->count;
+}
+
+uint64_t input_script_apply(input_script_t *script, chip8_t *chip8) {
+    while (script->next < script->count && script->events[script->next].cycle <= chip8->cycles) {
+        const input_event_t *event = &script->events[script->next++];
+        chip8->keypad[event->key] = event->pressed;
+    }
+    return script->next < script->count ? script->events[script->next].cycle : UINT64_MAX;
+}
@@ -0,0 +1,57 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "./chip8.h"
+
+// Keypad input keyed by instruction count, so a run can be reproduced exactly.
+// Text format, one event per line, '#' starts a comment:
+//   <cycle> <key 0-F> <down|up>
+// Binary format, written by the recorder: an input_log_header_t, then per event
+// the cycles since the previous event as a varint and one byte key | pressed << 4.
+// It also carries what else a replay needs to be bit-exact: the PRNG state and
+// the clock rate (timers tick FPS times per insts_per_second instructions).
+
+#define INPUT_LOG_MAGIC "C8IN"
+#define INPUT_LOG_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t rng_state; // chip8->rng_state when recording started
+    uint32_t insts_per_second;
+    uint64_t end_cycle; // Instruction count when recording stopped
+} input_log_header_t;
+
+typedef struct {
+    uint64_t cycle;
+    uint8_t key;
+    bool pressed;
+} input_event_t;
+
+typedef struct {
+    input_event_t *events; // Sorted by cycle
+    size_t count;
+    size_t capacity;
+    size_t next; // First event not applied yet
+    // Only known for recordings, 0 otherwise
+    uint32_t rng_state;
+    uint32_t insts_per_second;
+    uint64_t end_cycle;
+} input_script_t;
+
+// Loads either format, telling them apart by the magic.
+bool input_script_load(input_script_t *script, const char *path);
+bool input_script_save(const input_script_t *script, const char *path);
+void input_script_free(input_script_t *script);
+// Applies every event due at or before chip8->cycles and returns the cycle of
+// the next pending event, or UINT64_MAX when there is none.
+uint64_t input_script_apply(input_script_t *script, chip8_t *chip8);
+// Recording: appends a keypad transition at cycle, which must not be before the last one.
+bool input_script_record(input_script_t *script, uint64_t cycle, uint8_t key, bool pressed);
+// Recording: forgets every event at or after cycle, e.g. once the machine was rewound to it.
+void input_script_truncate(input_script_t *script, uint64_t cycle);
+
+#endif
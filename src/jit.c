@@ -0,0 +1,440 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./decode.h"
+#include "./jit.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (4u << 20) // Flushed and refilled when it runs out
+#define JIT_MAX_BLOCK_INSTS 64
+#define JIT_MAX_BLOCK_BYTES 1024 // Worst case code for one block, checked before compiling
+#define JIT_MAX_EXITS 16384
+
+// Generated blocks follow the SysV calling convention:
+//   int64_t block(chip8_t *chip8 /* rdi */, int64_t budget /* rsi */)
+// and return the remaining instruction budget in rax. Every block first checks
+// that the budget covers all of its instructions and returns untouched if not,
+// so chained blocks can never overrun the count the caller asked for.
+typedef int64_t (*jit_block_fn)(chip8_t *chip8, int64_t budget);
+
+typedef struct {
+    uint8_t *entry;
+    uint16_t start_pc;
+    uint32_t insts;
+} jit_block_t;
+
+// A block exit: "mov word [PC], target; jmp rel32". The rel32 initially points at
+// the block's return stub and is patched to jump straight into the target block
+// once that exists.
+typedef struct {
+    uint8_t *rel32;
+    uint16_t target;
+    bool patched;
+} jit_exit_t;
+
+struct jit {
+    uint8_t *code;
+    size_t code_used;
+    uint8_t *emit; // Write position while compiling a block
+    jit_block_t *block_at[4096]; // Compiled block starting at each address
+    bool interpret_at[4096]; // First instruction can't be compiled, always interpret
+    bool covered[4096]; // RAM bytes some compiled block was translated from
+    jit_block_t blocks[4096];
+    uint32_t block_count;
+    jit_exit_t exits[JIT_MAX_EXITS];
+    uint32_t exit_count;
+    uint64_t compiled_total;
+    uint64_t flushes;
+};
+
+static void emit8(jit_t *jit, uint8_t byte) { *jit->emit++ = byte; }
+static void emit16(jit_t *jit, uint16_t value) { memcpy(jit->emit, &value, 2); jit->emit += 2; }
+static void emit32(jit_t *jit, uint32_t value) { memcpy(jit->emit, &value, 4); jit->emit += 4; }
+
+#define OFF_V(reg) ((uint32_t)(offsetof(chip8_t, V) + (reg)))
+#define OFF_PC ((uint32_t)offsetof(chip8_t, PC))
+#define OFF_I ((uint32_t)offsetof(chip8_t, reg_i))
+#define OFF_KEYPAD ((uint32_t)offsetof(chip8_t, keypad))
+#define OFF_DT ((uint32_t)offsetof(chip8_t, delay_timer))
+#define OFF_ST ((uint32_t)offsetof(chip8_t, sound_timer))
+
+// <op> r8, byte [rdi + disp32], with r8 = al (reg 0) or cl (reg 1)
+static void emit_rm8(jit_t *jit, uint8_t opcode, uint8_t reg, uint32_t disp) {
+    emit8(jit, opcode);
+    emit8(jit, 0x87 | (reg << 3)); // mod=10 (disp32), rm=rdi
+    emit32(jit, disp);
+}
+
+static void emit_load_al(jit_t *jit, uint32_t disp) { emit_rm8(jit, 0x8A, 0, disp); } // mov al, [rdi+disp]
+static void emit_store_al(jit_t *jit, uint32_t disp) { emit_rm8(jit, 0x88, 0, disp); } // mov [rdi+disp], al
+static void emit_store_cl(jit_t *jit, uint32_t disp) { emit_rm8(jit, 0x88, 1, disp); } // mov [rdi+disp], cl
+
+static void emit_set_pc(jit_t *jit, uint16_t pc) {
+    emit8(jit, 0x66); emit8(jit, 0xC7); emit8(jit, 0x87); emit32(jit, OFF_PC); emit16(jit, pc); // mov word [rdi+PC], imm16
+}
+
+static void emit_return(jit_t *jit) {
+    emit8(jit, 0x48); emit8(jit, 0x89); emit8(jit, 0xF0); // mov rax, rsi
+    emit8(jit, 0xC3); // ret
+}
+
+// Flags from the last ALU op: setc/setnc cl, then VX = al, VF = cl (VF last so it wins for X = F)
+static void emit_flag_result(jit_t *jit, uint8_t setcc, uint8_t X) {
+    emit8(jit, 0x0F); emit8(jit, setcc); emit8(jit, 0xC1);
+    emit_store_al(jit, OFF_V(X));
+    emit_store_cl(jit, OFF_V(0xF));
+}
+
+static void emit_exit(jit_t *jit, uint16_t target) {
+    emit_set_pc(jit, target);
+    emit8(jit, 0xE9); // jmp rel32
+    jit_exit_t *exit = &jit->exits[jit->exit_count++];
+    exit->rel32 = jit->emit;
+    exit->target = target;
+    exit->patched = false;
+    emit32(jit, 0); // Pointed at the return stub once the block is complete
+}
+
+static void patch_exit(jit_exit_t *exit, const jit_block_t *target) {
+    const int32_t rel = (int32_t)(target->entry - (exit->rel32 + 4));
+    memcpy(exit->rel32, &rel, 4);
+    exit->patched = true;
+}
+
+static bool compilable(const decoded_inst_t *inst) {
+    switch (inst->op) {
+        case OP_LD_VX_NN: case OP_ADD_VX_NN: case OP_LD_VX_VY:
+        case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_VX_VY: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_I: case OP_ADD_I_VX: case OP_LD_F_VX:
+        case OP_LD_VX_DT: case OP_LD_DT_VX: case OP_LD_ST_VX:
+        case OP_JP:
+        case OP_SE_VX_NN: case OP_SNE_VX_NN: case OP_SE_VX_VY: case OP_SNE_VX_VY:
+        case OP_SKP: case OP_SKNP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Jumps and skips are translated, but control flow leaves the block after them.
+static bool ends_block(const decoded_inst_t *inst) {
+    switch (inst->op) {
+        case OP_JP:
+        case OP_SE_VX_NN: case OP_SNE_VX_NN: case OP_SE_VX_VY: case OP_SNE_VX_VY:
+        case OP_SKP: case OP_SKNP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void emit_body(jit_t *jit, const decoded_inst_t *inst) {
+    const uint8_t X = inst->X;
+    const uint8_t Y = inst->Y;
+    switch (inst->op) {
+        case OP_LD_VX_NN: // mov byte [VX], imm8
+            emit8(jit, 0xC6); emit8(jit, 0x87); emit32(jit, OFF_V(X)); emit8(jit, (uint8_t)inst->NNN);
+            break;
+        case OP_ADD_VX_NN: // add byte [VX], imm8
+            emit8(jit, 0x80); emit8(jit, 0x87); emit32(jit, OFF_V(X)); emit8(jit, (uint8_t)inst->NNN);
+            break;
+        case OP_LD_VX_VY:
+            emit_load_al(jit, OFF_V(Y));
+            emit_store_al(jit, OFF_V(X));
+            break;
+        case OP_OR: // or/and/xor [VX], al
+            emit_load_al(jit, OFF_V(Y));
+            emit_rm8(jit, 0x08, 0, OFF_V(X));
+            break;
+        case OP_AND:
+            emit_load_al(jit, OFF_V(Y));
+            emit_rm8(jit, 0x20, 0, OFF_V(X));
+            break;
+        case OP_XOR:
+            emit_load_al(jit, OFF_V(Y));
+            emit_rm8(jit, 0x30, 0, OFF_V(X));
+            break;
+        case OP_ADD_VX_VY: // al = VX + VY, VF = carry
+            emit_load_al(jit, OFF_V(X));
+            emit_rm8(jit, 0x02, 0, OFF_V(Y));
+            emit_flag_result(jit, 0x92, X);
+            break;
+        case OP_SUB: // al = VX - VY, VF = !borrow
+            emit_load_al(jit, OFF_V(X));
+            emit_rm8(jit, 0x2A, 0, OFF_V(Y));
+            emit_flag_result(jit, 0x93, X);
+            break;
+        case OP_SUBN: // al = VY - VX, VF = !borrow
+            emit_load_al(jit, OFF_V(Y));
+            emit_rm8(jit, 0x2A, 0, OFF_V(X));
+            emit_flag_result(jit, 0x93, X);
+            break;
+        case OP_SHR: // shr al, 1; VF = bit shifted out
+            emit_load_al(jit, OFF_V(X));
+            emit8(jit, 0xD0); emit8(jit, 0xE8);
+            emit_flag_result(jit, 0x92, X);
+            break;
+        case OP_SHL: // shl al, 1; VF = bit shifted out
+            emit_load_al(jit, OFF_V(X));
+            emit8(jit, 0xD0); emit8(jit, 0xE0);
+            emit_flag_result(jit, 0x92, X);
+            break;
+        case OP_LD_I: // mov word [I], imm16
+            emit8(jit, 0x66); emit8(jit, 0xC7); emit8(jit, 0x87); emit32(jit, OFF_I); emit16(jit, inst->NNN);
+            break;
+        case OP_ADD_I_VX: // movzx eax, byte [VX]; add word [I], ax
+            emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0x87); emit32(jit, OFF_V(X));
+            emit8(jit, 0x66); emit8(jit, 0x01); emit8(jit, 0x87); emit32(jit, OFF_I);
+            break;
+        case OP_LD_F_VX: // movzx eax, byte [VX]; and eax, 0xF; lea eax, [rax+rax*4]; mov word [I], ax
+            emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0x87); emit32(jit, OFF_V(X));
+            emit8(jit, 0x83); emit8(jit, 0xE0); emit8(jit, 0x0F);
+            emit8(jit, 0x8D); emit8(jit, 0x04); emit8(jit, 0x80);
+            emit8(jit, 0x66); emit8(jit, 0x89); emit8(jit, 0x87); emit32(jit, OFF_I);
+            break;
+        case OP_LD_VX_DT:
+            emit_load_al(jit, OFF_DT);
+            emit_store_al(jit, OFF_V(X));
+            break;
+        case OP_LD_DT_VX:
+            emit_load_al(jit, OFF_V(X));
+            emit_store_al(jit, OFF_DT);
+            break;
+        case OP_LD_ST_VX:
+            emit_load_al(jit, OFF_V(X));
+            emit_store_al(jit, OFF_ST);
+            break;
+    }
+}
+
+// Emits the compare for a skip instruction and returns the jcc opcode byte
+// (second byte of 0F 8x) that is taken when the next instruction is skipped.
+static uint8_t emit_skip_test(jit_t *jit, const decoded_inst_t *inst) {
+    const uint8_t X = inst->X;
+    switch (inst->op) {
+        case OP_SE_VX_NN:
+        case OP_SNE_VX_NN: // cmp byte [VX], imm8
+            emit8(jit, 0x80); emit8(jit, 0xBF); emit32(jit, OFF_V(X)); emit8(jit, (uint8_t)inst->NNN);
+            return inst->op == OP_SE_VX_NN ? 0x84 : 0x85;
+        case OP_SE_VX_VY:
+        case OP_SNE_VX_VY: // mov al, [VX]; cmp al, [VY]
+            emit_load_al(jit, OFF_V(X));
+            emit_rm8(jit, 0x3A, 0, OFF_V(inst->Y));
+            return inst->op == OP_SE_VX_VY ? 0x84 : 0x85;
+        default: // SKP/SKNP: movzx eax, byte [VX]; and eax, 0xF; cmp byte [rdi+rax+keypad], 0
+            emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0x87); emit32(jit, OFF_V(X));
+            emit8(jit, 0x83); emit8(jit, 0xE0); emit8(jit, 0x0F);
+            emit8(jit, 0x80); emit8(jit, 0xBC); emit8(jit, 0x07); emit32(jit, OFF_KEYPAD); emit8(jit, 0x00);
+            return inst->op == OP_SKP ? 0x85 : 0x84;
+    }
+}
+
+void jit_flush(jit_t *jit) {
+    jit->code_used = 0;
+    jit->block_count = 0;
+    jit->exit_count = 0;
+    memset(jit->block_at, 0, sizeof jit->block_at);
+    memset(jit->interpret_at, 0, sizeof jit->interpret_at);
+    memset(jit->covered, 0, sizeof jit->covered);
+    jit->flushes++;
+}
+
+static uint16_t fetch_opcode(const chip8_t *chip8, uint16_t pc) {
+    return chip8->ram[pc & 0x0FFF] << 8 | chip8->ram[(pc + 1) & 0x0FFF];
+}
+
+static jit_block_t *compile_block(jit_t *jit, const chip8_t *chip8, uint16_t start_pc) {
+    if (jit->block_count == 4096 || jit->exit_count + 2 > JIT_MAX_EXITS
+        || jit->code_used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) {
+        jit_flush(jit);
+    }
+    // Find the extent of the block first so the prologue knows its instruction count
+    decoded_inst_t insts[JIT_MAX_BLOCK_INSTS];
+    uint32_t count = 0;
+    bool terminated = false;
+    uint16_t pc = start_pc;
+    while (count < JIT_MAX_BLOCK_INSTS) {
+        const decoded_inst_t inst = decode_instruction(fetch_opcode(chip8, pc));
+        if (!compilable(&inst)) break;
+        insts[count++] = inst;
+        pc += 2;
+        if (ends_block(&inst)) {
+            terminated = true;
+            break;
+        }
+    }
+    if (count == 0) {
+        jit->interpret_at[start_pc & 0x0FFF] = true;
+        return NULL;
+    }
+
+    jit_block_t *block = &jit->blocks[jit->block_count++];
+    block->entry = jit->code + jit->code_used;
+    block->start_pc = start_pc;
+    block->insts = count;
+    jit->emit = block->entry;
+
+    // Prologue: cmp rsi, count; jl bail; sub rsi, count
+    emit8(jit, 0x48); emit8(jit, 0x81); emit8(jit, 0xFE); emit32(jit, count);
+    emit8(jit, 0x0F); emit8(jit, 0x8C);
+    uint8_t *bail_rel = jit->emit;
+    emit32(jit, 0);
+    emit8(jit, 0x48); emit8(jit, 0x81); emit8(jit, 0xEE); emit32(jit, count);
+
+    const uint32_t first_exit = jit->exit_count;
+    const uint32_t body_count = terminated ? count - 1 : count;
+    for (uint32_t i = 0; i < body_count; i++) emit_body(jit, &insts[i]);
+
+    const uint16_t term_pc = start_pc + 2 * body_count;
+    if (!terminated) {
+        emit_exit(jit, term_pc); // Stops right before an instruction we can't compile
+    } else if (insts[count - 1].op == OP_JP) {
+        emit_exit(jit, insts[count - 1].NNN);
+    } else {
+        const uint8_t jcc = emit_skip_test(jit, &insts[count - 1]);
+        emit8(jit, 0x0F); emit8(jit, jcc);
+        uint8_t *skip_rel = jit->emit;
+        emit32(jit, 0);
+        emit_exit(jit, term_pc + 2);
+        const int32_t rel = (int32_t)(jit->emit - (skip_rel + 4));
+        memcpy(skip_rel, &rel, 4);
+        emit_exit(jit, term_pc + 4);
+    }
+
+    // Bail path for an insufficient budget: PC stays at the block start
+    const int32_t bail = (int32_t)(jit->emit - (bail_rel + 4));
+    memcpy(bail_rel, &bail, 4);
+    emit_set_pc(jit, start_pc);
+    uint8_t *return_stub = jit->emit;
+    emit_return(jit);
+    for (uint32_t i = first_exit; i < jit->exit_count; i++) {
+        const int32_t rel = (int32_t)(return_stub - (jit->exits[i].rel32 + 4));
+        memcpy(jit->exits[i].rel32, &rel, 4);
+    }
+    jit->code_used = jit->emit - jit->code;
+
+    for (uint16_t a = start_pc; a != (uint16_t)(start_pc + 2 * count); a++) jit->covered[a & 0x0FFF] = true;
+    jit->block_at[start_pc & 0x0FFF] = block;
+    jit->compiled_total++;
+
+    // Chain: exits of this block into existing blocks, and earlier exits into this one
+    for (uint32_t i = 0; i < jit->exit_count; i++) {
+        jit_exit_t *exit = &jit->exits[i];
+        if (exit->patched) continue;
+        jit_block_t *target = jit->block_at[exit->target & 0x0FFF];
+        if (target && target->start_pc == exit->target) patch_exit(exit, target);
+    }
+    return block;
+}
+
+jit_t *jit_create(void) {
+    jit_t *jit = calloc(1, sizeof *jit);
+    if (!jit) return NULL;
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        fprintf(stderr, "Could not map executable memory for the JIT\n");
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void jit_destroy(jit_t *jit) {
+    if (!jit) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+// Address range [start, start + len) an interpreted instruction is about to write, if any.
+static bool ram_write_range(const chip8_t *chip8, uint16_t *start, uint16_t *len) {
+    const uint16_t opcode = fetch_opcode(chip8, chip8->PC);
+    if ((opcode & 0xF0FF) == 0xF033) *len = 3;
+    else if ((opcode & 0xF0FF) == 0xF055) *len = ((opcode >> 8) & 0x0F) + 1;
+    else return false;
+    *start = chip8->reg_i;
+    return true;
+}
+
+void jit_run(jit_t *jit, chip8_t *chip8, config_t *config, uint64_t cycles) {
+#if CHIP8_TRACE
+    if (chip8->trace) {
+        emulate_cycles(chip8, config, cycles); // Compiled code doesn't emit trace records
+        return;
+    }
+#endif
+    if (!chip8_quirks_plain(&chip8->quirks)) {
+        emulate_cycles(chip8, config, cycles); // Blocks are translated with the default quirks baked in
+        return;
+    }
+    int64_t budget = cycles;
+    while (budget > 0) {
+        // Only caught when a batch enters the loop through here; once compiled, a wait
+        // loop chains back into itself and spins on until the budget runs out
+        if (config->skip_idle) {
+            const uint32_t skipped = chip8_skip_idle(chip8, budget);
+            budget -= skipped;
+            if (skipped) continue;
+        }
+        const uint16_t pc = chip8->PC & 0x0FFF;
+        jit_block_t *block = jit->block_at[pc];
+        if (block && block->start_pc != chip8->PC) block = NULL;
+        if (!block && !jit->interpret_at[pc]) block = compile_block(jit, chip8, chip8->PC);
+        if (block && budget >= block->insts) {
+            const int64_t left = ((jit_block_fn)block->entry)(chip8, budget);
+            chip8->cycles += budget - left;
+            budget = left;
+            continue;
+        }
+        // Fall back to the interpreter for one instruction. Self-modifying code is
+        // rare, so a write over any compiled code simply flushes the whole cache.
+        uint16_t start, len;
+        const bool writes = ram_write_range(chip8, &start, &len);
+        emulate_commands(chip8, config);
+        budget--;
+        if (writes) {
+            for (uint16_t i = 0; i < len; i++) {
+                if (jit->covered[(start + i) & 0x0FFF]) {
+                    jit_flush(jit);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void jit_report(const jit_t *jit, FILE *out) {
+    fprintf(out, "jit: %llu blocks compiled, %llu flushes, %zu bytes of code in use\n",
+        (unsigned long long)jit->compiled_total, (unsigned long long)jit->flushes, jit->code_used);
+}
+
+#else // No backend for this architecture
+
+jit_t *jit_create(void) {
+    fprintf(stderr, "The JIT only supports x86-64, using the interpreter\n");
+    return NULL;
+}
+
+void jit_destroy(jit_t *jit) {
+    (void)jit;
+}
+
+void jit_run(jit_t *jit, chip8_t *chip8, config_t *config, uint64_t cycles) {
+    (void)jit;
+    emulate_cycles(chip8, config, cycles);
+}
+
+void jit_flush(jit_t *jit) {
+    (void)jit;
+}
+
+void jit_report(const jit_t *jit, FILE *out) {
+    (void)jit;
+    (void)out;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "./chip8.h"
+
+// Optional basic-block recompiler to x86-64. Straight-line runs of ALU/load
+// instructions are translated to native code; a block ends at a jump or skip
+// (which become direct, patchable jumps to the next block) or right before any
+// instruction it can't translate, which the interpreter then executes.
+// On other architectures jit_create() returns NULL and callers stay on the interpreter.
+
+typedef struct jit jit_t;
+
+jit_t *jit_create(void);
+void jit_destroy(jit_t *jit);
+// Executes exactly cycles instructions, mixing compiled blocks and the
+// interpreter, with the same effect as emulate_cycles().
+void jit_run(jit_t *jit, chip8_t *chip8, config_t *config, uint64_t cycles);
+// Throws away all compiled code, e.g. after RAM was replaced from outside.
+void jit_flush(jit_t *jit);
+// Prints how many blocks were compiled and how often the cache was flushed.
+void jit_report(const jit_t *jit, FILE *out);
+
+#endif
@@ -0,0 +1,424 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "./constants.h"
+#include "./server.h"
+#include "./snapshot.h"
+#include "./varint.h"
+
+// Load generator for chip8server: opens a number of connections, creates the
+// requested sessions over them, presses keys at random while frames stream in,
+// then snapshots and destroys every session. Reports how much CPU the server
+// used per session (as sessions per fully busy core) and the latency from each
+// frame's deadline to its arrival here, both measured over the same window.
+
+#define LOADGEN_READ_SIZE 65536
+
+typedef struct {
+    const char *socket_path;
+    const char *rom_name;
+    uint8_t rom[RAM_SIZE];
+    size_t rom_size;
+    const char *quirks_name;
+    uint32_t insts_per_second;
+    uint32_t sessions;
+    uint32_t connections;
+    double seconds;
+    double key_rate; // Key presses per session per second
+    pthread_barrier_t ready; // Passed twice: sessions created, then window set
+    uint64_t start_ns;
+    uint64_t end_ns;
+} loadgen_t;
+
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t len;
+    size_t pos; // Start of the first message not handed out yet
+} client_t;
+
+typedef struct {
+    loadgen_t *lg;
+    uint32_t first_session; // Sessions [first, first + count) of the whole run
+    uint32_t session_count;
+    uint32_t *ids;
+    uint64_t *last_frame; // Per session, to spot frames that never arrived
+    uint64_t *latencies; // ns, one per frame received while measuring
+    size_t latency_count;
+    size_t latency_cap;
+    uint64_t frames;
+    uint64_t missed;
+    uint64_t errors;
+    uint64_t snapshots;
+    uint64_t snapshot_bytes;
+    uint64_t destroyed;
+    bool failed;
+} worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool client_connect(client_t *client, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+    client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    client->buffer = malloc(2 * (SERVER_HEADER_SIZE + SERVER_MAX_PAYLOAD));
+    client->len = client->pos = 0;
+    if (client->fd < 0 || !client->buffer || connect(client->fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        fprintf(stderr, "Could not connect to %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void client_close(client_t *client) {
+    if (client->fd >= 0) close(client->fd);
+    free(client->buffer);
+}
+
+static bool client_send(client_t *client, uint8_t type, const uint8_t *payload, uint32_t size) {
+    uint8_t header[SERVER_HEADER_SIZE];
+    server_put_header(header, type, size);
+    if (send(client->fd, header, sizeof header, MSG_NOSIGNAL) != (ssize_t)sizeof header) return false;
+    size_t sent = 0;
+    while (sent < size) {
+        const ssize_t n = send(client->fd, &payload[sent], size - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Hands out the next message, waiting at most until deadline_ns for it. Returns
+// 1 with a message, 0 when the deadline passed first, -1 when the server went away.
+static int client_next(client_t *client, uint64_t deadline_ns, uint8_t *type, const uint8_t **payload, uint32_t *size) {
+    for (;;) {
+        const long message = server_message_size(&client->buffer[client->pos], client->len - client->pos);
+        if (message < 0) return -1;
+        if (message > 0) {
+            *type = client->buffer[client->pos + 4];
+            *payload = &client->buffer[client->pos + SERVER_HEADER_SIZE];
+            *size = message - SERVER_HEADER_SIZE;
+            client->pos += message;
+            return 1;
+        }
+        // Keep the partial message, make room behind it
+        memmove(client->buffer, &client->buffer[client->pos], client->len - client->pos);
+        client->len -= client->pos;
+        client->pos = 0;
+        const uint64_t now = now_ns();
+        if (now >= deadline_ns) return 0;
+        struct pollfd pfd = {.fd = client->fd, .events = POLLIN};
+        const int timeout_ms = (deadline_ns - now + 999999) / 1000000;
+        const int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) return -1;
+        if (ready <= 0) continue;
+        const ssize_t n = recv(client->fd, &client->buffer[client->len], LOADGEN_READ_SIZE, 0);
+        if (n <= 0) return -1;
+        client->len += n;
+    }
+}
+
+static void record_latency(worker_t *w, uint64_t latency) {
+    if (w->latency_count == w->latency_cap) {
+        w->latency_cap = w->latency_cap ? 2 * w->latency_cap : 4096;
+        uint64_t *grown = realloc(w->latencies, w->latency_cap * sizeof *grown);
+        if (!grown) return;
+        w->latencies = grown;
+    }
+    w->latencies[w->latency_count++] = latency;
+}
+
+// Handles a message that isn't the reply being waited for.
+static void handle_frame(worker_t *w, uint8_t type, const uint8_t *payload, uint32_t size, uint64_t received) {
+    if (type == SERVER_ERROR) {
+        w->errors++;
+        fprintf(stderr, "loadgen: server error: %.*s\n", (int)(size > 1 ? size - 1 : 0), (const char *)&payload[1]);
+        return;
+    }
+    if (type != SERVER_FRAME || size < 13) return;
+    const uint32_t id = server_get_u32(payload);
+    const uint64_t due = server_get_u64(&payload[4]);
+    uint64_t frame;
+    if (!varint_get(&payload[12], size - 12, &frame)) return;
+    for (uint32_t i = 0; i < w->session_count; i++) {
+        if (w->ids[i] != id) continue;
+        if (w->last_frame[i] && frame > w->last_frame[i] + 1) w->missed += frame - w->last_frame[i] - 1;
+        w->last_frame[i] = frame;
+        break;
+    }
+    if (received >= w->lg->start_ns && received < w->lg->end_ns) {
+        w->frames++;
+        record_latency(w, received > due ? received - due : 0);
+    }
+}
+
+// Reads until a message of type arrives, handling frames on the way.
+static const uint8_t *await_reply(worker_t *w, client_t *client, uint8_t type, uint32_t *size) {
+    for (;;) {
+        uint8_t got;
+        const uint8_t *payload;
+        if (client_next(client, now_ns() + 5000000000ull, &got, &payload, size) != 1) return NULL;
+        if (got == type) return payload;
+        handle_frame(w, got, payload, *size, now_ns());
+        if (got == SERVER_ERROR) return NULL;
+    }
+}
+
+static bool create_sessions(worker_t *w, client_t *client) {
+    loadgen_t *lg = w->lg;
+    const size_t name_len = strlen(lg->quirks_name);
+    const uint32_t size = 10 + name_len + lg->rom_size;
+    uint8_t *request = malloc(size);
+    if (!request) return false;
+    server_put_u32(&request[4], lg->insts_per_second);
+    request[8] = 0;
+    request[9] = name_len;
+    memcpy(&request[10], lg->quirks_name, name_len);
+    memcpy(&request[10 + name_len], lg->rom, lg->rom_size);
+    bool ok = true;
+    for (uint32_t i = 0; i < w->session_count && ok; i++) {
+        server_put_u32(request, w->first_session + i + 1); // Seed
+        uint32_t reply_size;
+        const uint8_t *reply;
+        ok = client_send(client, SERVER_CREATE, request, size)
+            && (reply = await_reply(w, client, SERVER_CREATED, &reply_size)) && reply_size >= 4;
+        if (ok) w->ids[i] = server_get_u32(reply);
+    }
+    free(request);
+    return ok;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    loadgen_t *lg = w->lg;
+    client_t client = {.fd = -1};
+    w->ids = calloc(w->session_count, sizeof *w->ids);
+    w->last_frame = calloc(w->session_count, sizeof *w->last_frame);
+    w->failed = !w->ids || !w->last_frame || !client_connect(&client, lg->socket_path)
+        || !create_sessions(w, &client);
+    pthread_barrier_wait(&lg->ready);
+    pthread_barrier_wait(&lg->ready); // Main has set the window
+    if (w->failed) {
+        client_close(&client);
+        return NULL;
+    }
+    // Random key presses, spread evenly over the sessions of this connection
+    uint32_t rng = 0x9E3779B9u ^ w->first_session;
+    const double presses_per_second = lg->key_rate * w->session_count;
+    const uint64_t press_interval = presses_per_second > 0 ? 1e9 / presses_per_second : UINT64_MAX;
+    uint64_t next_press = lg->start_ns + press_interval / 2;
+    uint32_t next_session = 0;
+    uint8_t held[4096] = {0}; // Key + 1 each session is holding, 0 = none
+    for (;;) {
+        const uint64_t now = now_ns();
+        if (now >= lg->end_ns) break;
+        if (now >= next_press) {
+            const uint32_t i = next_session++ % w->session_count;
+            uint8_t input[6];
+            server_put_u32(input, w->ids[i]);
+            if (i < sizeof held && held[i]) {
+                input[4] = held[i] - 1;
+                input[5] = 0;
+                held[i] = 0;
+            } else {
+                rng ^= rng << 13;
+                rng ^= rng >> 17;
+                rng ^= rng << 5;
+                input[4] = rng & 0x0F;
+                input[5] = 1;
+                if (i < sizeof held) held[i] = input[4] + 1;
+            }
+            if (!client_send(&client, SERVER_INPUT, input, sizeof input)) break;
+            next_press += press_interval;
+            continue;
+        }
+        uint8_t type;
+        const uint8_t *payload;
+        uint32_t size;
+        const uint64_t deadline = next_press < lg->end_ns ? next_press : lg->end_ns;
+        const int got = client_next(&client, deadline, &type, &payload, &size);
+        if (got < 0) {
+            w->failed = true;
+            break;
+        }
+        if (got) handle_frame(w, type, payload, size, now_ns());
+    }
+    // Tear down through the protocol rather than by hanging up
+    for (uint32_t i = 0; i < w->session_count && !w->failed; i++) {
+        uint8_t request[4];
+        uint32_t size;
+        server_put_u32(request, w->ids[i]);
+        if (client_send(&client, SERVER_SNAPSHOT, request, sizeof request)
+            && await_reply(w, &client, SERVER_SNAPSHOT_DATA, &size)) {
+            w->snapshots++;
+            w->snapshot_bytes += size - 4;
+        }
+        if (client_send(&client, SERVER_DESTROY, request, sizeof request) && await_reply(w, &client, SERVER_OK, &size)) {
+            w->destroyed++;
+        }
+    }
+    client_close(&client);
+    return NULL;
+}
+
+// Asks the server for its CPU time and frame counters.
+static bool server_stats(client_t *client, uint64_t *cpu_ns, uint64_t counters[3], uint32_t *workers) {
+    if (!client_send(client, SERVER_STATS, NULL, 0)) return false;
+    for (;;) {
+        uint8_t type;
+        const uint8_t *payload;
+        uint32_t size;
+        if (client_next(client, now_ns() + 5000000000ull, &type, &payload, &size) != 1) return false;
+        if (type != SERVER_STATS_DATA || size < 48) continue;
+        *cpu_ns = server_get_u64(payload);
+        *workers = server_get_u32(&payload[20]);
+        for (int i = 0; i < 3; i++) counters[i] = server_get_u64(&payload[24 + 8 * i]);
+        return true;
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage %s <rom> [options]\n"
+        "  --socket PATH      server socket (default %s)\n"
+        "  --sessions N       sessions to run (default 64)\n"
+        "  --connections N    spread them over N connections, one thread each (default 4)\n"
+        "  --seconds S        how long to measure (default 10)\n"
+        "  --ips N            instructions per second per session (default %d)\n"
+        "  --quirks P         chip8 (default), vip, schip or xochip\n"
+        "  --keys R           key presses per session per second (default 2)\n",
+        prog, SERVER_DEFAULT_SOCKET, INSTRUCTIONS_PER_SECOND);
+}
+
+int main(int argc, char **argv) {
+    static loadgen_t lg = {
+        .socket_path = SERVER_DEFAULT_SOCKET, .quirks_name = "", .insts_per_second = INSTRUCTIONS_PER_SECOND,
+        .sessions = 64, .connections = 4, .seconds = 10, .key_rate = 2,
+    };
+    bool valid = argc >= 2;
+    for (int i = 2; i < argc && valid; i++) {
+        if (i + 1 >= argc) valid = false;
+        else if (strcmp(argv[i], "--socket") == 0) lg.socket_path = argv[++i];
+        else if (strcmp(argv[i], "--sessions") == 0) lg.sessions = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--connections") == 0) lg.connections = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--seconds") == 0) lg.seconds = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--ips") == 0) lg.insts_per_second = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--quirks") == 0) lg.quirks_name = argv[++i];
+        else if (strcmp(argv[i], "--keys") == 0) lg.key_rate = strtod(argv[++i], NULL);
+        else valid = false;
+    }
+    if (!valid || !lg.sessions || lg.seconds <= 0 || strlen(lg.quirks_name) > 255) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (lg.connections < 1) lg.connections = 1;
+    if (lg.connections > lg.sessions) lg.connections = lg.sessions;
+    lg.rom_name = argv[1];
+    FILE *rom = fopen(lg.rom_name, "rb");
+    if (!rom) {
+        fprintf(stderr, "Rom file %s is invalid\n", lg.rom_name);
+        exit(EXIT_FAILURE);
+    }
+    lg.rom_size = fread(lg.rom, 1, sizeof lg.rom, rom);
+    fclose(rom);
+
+    client_t control = {.fd = -1};
+    if (!client_connect(&control, lg.socket_path)) exit(EXIT_FAILURE);
+    lg.start_ns = lg.end_ns = UINT64_MAX; // Nothing counts until every session exists
+    pthread_barrier_init(&lg.ready, NULL, lg.connections + 1);
+    worker_t *workers = calloc(lg.connections, sizeof *workers);
+    pthread_t *threads = calloc(lg.connections, sizeof *threads);
+    for (uint32_t c = 0, first = 0; c < lg.connections; c++) {
+        const uint32_t count = lg.sessions / lg.connections + (c < lg.sessions % lg.connections);
+        workers[c] = (worker_t){.lg = &lg, .first_session = first, .session_count = count};
+        first += count;
+    }
+    const uint64_t setup_ns = now_ns();
+    for (uint32_t c = 0; c < lg.connections; c++) pthread_create(&threads[c], NULL, worker_main, &workers[c]);
+    uint64_t cpu_start = 0, cpu_end = 0, counters_start[3] = {0}, counters_end[3] = {0};
+    uint32_t server_workers = 0;
+    pthread_barrier_wait(&lg.ready);
+    const double setup_s = (now_ns() - setup_ns) / 1e9;
+    lg.start_ns = now_ns();
+    lg.end_ns = lg.start_ns + (uint64_t)(lg.seconds * 1e9);
+    pthread_barrier_wait(&lg.ready);
+    const bool stats_ok = server_stats(&control, &cpu_start, counters_start, &server_workers);
+    const struct timespec window = {.tv_sec = (time_t)lg.seconds,
+                                    .tv_nsec = (long)((lg.seconds - (time_t)lg.seconds) * 1e9)};
+    nanosleep(&window, NULL);
+    const bool stats_end_ok = server_stats(&control, &cpu_end, counters_end, &server_workers);
+    const uint64_t wall_ns = now_ns() - lg.start_ns;
+    for (uint32_t c = 0; c < lg.connections; c++) pthread_join(threads[c], NULL);
+    client_close(&control);
+
+    uint64_t frames = 0, missed = 0, errors = 0, snapshots = 0, snapshot_bytes = 0, destroyed = 0;
+    size_t latency_count = 0;
+    uint32_t failed = 0;
+    for (uint32_t c = 0; c < lg.connections; c++) {
+        frames += workers[c].frames;
+        missed += workers[c].missed;
+        errors += workers[c].errors;
+        snapshots += workers[c].snapshots;
+        snapshot_bytes += workers[c].snapshot_bytes;
+        destroyed += workers[c].destroyed;
+        latency_count += workers[c].latency_count;
+        failed += workers[c].failed;
+    }
+    uint64_t *latencies = malloc((latency_count ? latency_count : 1) * sizeof *latencies);
+    size_t n = 0;
+    for (uint32_t c = 0; c < lg.connections; c++) {
+        if (workers[c].latency_count) memcpy(&latencies[n], workers[c].latencies, workers[c].latency_count * sizeof *latencies);
+        n += workers[c].latency_count;
+        free(workers[c].latencies);
+        free(workers[c].ids);
+        free(workers[c].last_frame);
+    }
+    qsort(latencies, latency_count, sizeof *latencies, compare_u64);
+
+    printf("loadgen: %u sessions of %s over %u connections, %.1f s measured (setup %.2f s)\n",
+        lg.sessions, lg.rom_name, lg.connections, wall_ns / 1e9, setup_s);
+    printf("frames: %llu received, %.0f expected, %llu missed\n", (unsigned long long)frames,
+        lg.sessions * lg.seconds * FPS, (unsigned long long)missed);
+    if (latency_count) {
+        static const double percentiles[] = {0.50, 0.90, 0.99, 0.999};
+        printf("latency:");
+        for (size_t p = 0; p < sizeof percentiles / sizeof percentiles[0]; p++) {
+            printf(" p%g %.3f ms", percentiles[p] * 100,
+                latencies[(size_t)(percentiles[p] * (latency_count - 1))] / 1e6);
+        }
+        printf(" max %.3f ms\n", latencies[latency_count - 1] / 1e6);
+    }
+    if (stats_ok && stats_end_ok) {
+        const double cores_busy = (double)(cpu_end - cpu_start) / wall_ns;
+        printf("server: %u workers, %.3f cores busy, %.0f sessions per core, %llu late and %llu dropped frames\n",
+            server_workers, cores_busy, cores_busy > 0 ? lg.sessions / cores_busy : 0.0,
+            (unsigned long long)(counters_end[1] - counters_start[1]),
+            (unsigned long long)(counters_end[2] - counters_start[2]));
+    }
+    printf("teardown: %llu snapshots (%llu bytes each), %llu sessions destroyed, %llu errors\n",
+        (unsigned long long)snapshots, (unsigned long long)(snapshots ? snapshot_bytes / snapshots : 0),
+        (unsigned long long)destroyed, (unsigned long long)errors);
+    free(latencies);
+    free(workers);
+    free(threads);
+    if (failed) fprintf(stderr, "loadgen: %u connections failed\n", failed);
+    return failed || errors ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include "./constants.h"
+#include "./lockstep.h"
+
+static void lane_to_chip8(lockstep_t *ls, uint32_t l) {
+    chip8_t *chip8 = ls->lane[l];
+    for (int r = 0; r < 16; r++) chip8->V[r] = ls->V[r][l];
+    chip8->PC = ls->PC[l];
+    chip8->reg_i = ls->reg_i[l];
+    chip8->delay_timer = ls->delay_timer[l];
+    chip8->sound_timer = ls->sound_timer[l];
+    chip8->cycles = ls->cycles;
+}
+
+static void chip8_to_lane(lockstep_t *ls, uint32_t l) {
+    const chip8_t *chip8 = ls->lane[l];
+    for (int r = 0; r < 16; r++) ls->V[r][l] = chip8->V[r];
+    ls->PC[l] = chip8->PC;
+    ls->reg_i[l] = chip8->reg_i;
+    ls->delay_timer[l] = chip8->delay_timer;
+    ls->sound_timer[l] = chip8->sound_timer;
+}
+
+bool lockstep_init(lockstep_t *ls, const char *rom_name, uint32_t lanes) {
+    memset(ls, 0, sizeof *ls);
+    if (lanes == 0 || lanes > LOCKSTEP_LANES) return false;
+    ls->lanes = lanes;
+    for (uint32_t l = 0; l < lanes; l++) {
+        ls->lane[l] = calloc(1, sizeof(chip8_t));
+        if (!ls->lane[l] || !init_chip8(ls->lane[l], rom_name)) {
+            lockstep_free(ls);
+            return false;
+        }
+        chip8_to_lane(ls, l);
+    }
+    return true;
+}
+
+void lockstep_free(lockstep_t *ls) {
+    for (uint32_t l = 0; l < LOCKSTEP_LANES; l++) {
+        free(ls->lane[l]);
+        ls->lane[l] = NULL;
+    }
+}
+
+chip8_t *lockstep_lane(lockstep_t *ls, uint32_t lane) {
+    lane_to_chip8(ls, lane);
+    return ls->lane[lane];
+}
+
+static bool has_vector_kernel(uint8_t op) {
+    switch (op) {
+        case OP_JP: case OP_LD_I:
+        case OP_SE_VX_NN: case OP_SNE_VX_NN: case OP_SE_VX_VY: case OP_SNE_VX_VY:
+        case OP_LD_VX_NN: case OP_ADD_VX_NN: case OP_LD_VX_VY:
+        case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_VX_VY: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_VX_DT: case OP_LD_DT_VX: case OP_LD_ST_VX:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Takes lanes of value where mask is set and of old elsewhere. A macro rather than a
+// function so no 32 byte vector crosses a call boundary (and its ABI) without AVX.
+#define blend(mask, value, old) (((value) & (mask)) | ((old) & ~(mask)))
+
+// Executes inst for every lane in group at once. mask has 0xFF in the lanes of the group.
+static void vector_step(lockstep_t *ls, const decoded_inst_t *inst, uint32_t group, const lane_vec_t *lanes) {
+    const lane_vec_t mask = *lanes;
+    lane_vec_t *VX = &ls->V[inst->X];
+    const lane_vec_t VY = ls->V[inst->Y];
+    const lane_vec_t NN = (lane_vec_t){0} + (uint8_t)inst->NNN; // Broadcast to every lane
+    lane_vec_t skip = {0}; // 0xFF in lanes that skip the next instruction
+
+    // Comparisons yield 0 / -1 per lane; & 1 turns them into CHIP8 flag values.
+    switch (inst->op) {
+        case OP_LD_VX_NN: *VX = blend(mask, NN, *VX); break;
+        case OP_ADD_VX_NN: *VX = blend(mask, *VX + NN, *VX); break;
+        case OP_LD_VX_VY: *VX = blend(mask, VY, *VX); break;
+        case OP_OR: *VX = blend(mask, *VX | VY, *VX); break;
+        case OP_AND: *VX = blend(mask, *VX & VY, *VX); break;
+        case OP_XOR: *VX = blend(mask, *VX ^ VY, *VX); break;
+        case OP_ADD_VX_VY: {
+            const lane_vec_t sum = *VX + VY;
+            const lane_vec_t carry = (lane_vec_t)(sum < *VX) & 1;
+            *VX = blend(mask, sum, *VX);
+            ls->V[0xF] = blend(mask, carry, ls->V[0xF]); // VF last, so it wins when X is F
+            break;
+        }
+        case OP_SUB: {
+            const lane_vec_t no_borrow = (lane_vec_t)(*VX >= VY) & 1;
+            *VX = blend(mask, *VX - VY, *VX);
+            ls->V[0xF] = blend(mask, no_borrow, ls->V[0xF]);
+            break;
+        }
+        case OP_SUBN: {
+            const lane_vec_t no_borrow = (lane_vec_t)(VY >= *VX) & 1;
+            *VX = blend(mask, VY - *VX, *VX);
+            ls->V[0xF] = blend(mask, no_borrow, ls->V[0xF]);
+            break;
+        }
+        case OP_SHR: {
+            const lane_vec_t lsb = *VX & 1;
+            *VX = blend(mask, *VX >> 1, *VX);
+            ls->V[0xF] = blend(mask, lsb, ls->V[0xF]);
+            break;
+        }
+        case OP_SHL: {
+            const lane_vec_t msb = *VX >> 7;
+            *VX = blend(mask, *VX << 1, *VX);
+            ls->V[0xF] = blend(mask, msb, ls->V[0xF]);
+            break;
+        }
+        case OP_LD_VX_DT: *VX = blend(mask, ls->delay_timer, *VX); break;
+        case OP_LD_DT_VX: ls->delay_timer = blend(mask, *VX, ls->delay_timer); break;
+        case OP_LD_ST_VX: ls->sound_timer = blend(mask, *VX, ls->sound_timer); break;
+        case OP_SE_VX_NN: skip = (lane_vec_t)(*VX == NN); break;
+        case OP_SNE_VX_NN: skip = (lane_vec_t)(*VX != NN); break;
+        case OP_SE_VX_VY: skip = (lane_vec_t)(*VX == VY); break;
+        case OP_SNE_VX_VY: skip = (lane_vec_t)(*VX != VY); break;
+    }
+
+    // PC and I are 16 bit, so they are updated with plain per-lane loops the compiler vectorizes
+    for (uint32_t l = 0; l < LOCKSTEP_LANES; l++) {
+        if (!(group >> l & 1)) continue;
+        if (inst->op == OP_JP) ls->PC[l] = inst->NNN;
+        else ls->PC[l] += 2 + (skip[l] & 2); // A skipping lane may leave the group here
+        if (inst->op == OP_LD_I) ls->reg_i[l] = inst->NNN;
+    }
+}
+
+static void scalar_step(lockstep_t *ls, config_t *config, uint32_t l) {
+    lane_to_chip8(ls, l);
+    emulate_commands(ls->lane[l], config);
+    chip8_to_lane(ls, l);
+    ls->scalar_steps++;
+}
+
+static uint16_t lane_opcode(const lockstep_t *ls, uint32_t l, uint16_t pc) {
+    const uint8_t *ram = ls->lane[l]->ram;
+    return ram[pc & 0x0FFF] << 8 | ram[(pc + 1) & 0x0FFF];
+}
+
+// One instruction on every lane.
+static void step(lockstep_t *ls, config_t *config) {
+    uint32_t pending = ls->lanes == 32 ? 0xFFFFFFFFu : (1u << ls->lanes) - 1;
+    while (pending) {
+        const uint32_t first = __builtin_ctz(pending);
+        const uint16_t pc = ls->PC[first];
+        const uint16_t opcode = lane_opcode(ls, first, pc);
+        // Lanes at the same PC running the same opcode (their RAM may differ) form a group
+        uint32_t group = 0;
+        for (uint32_t l = first; l < ls->lanes; l++) {
+            if ((pending >> l & 1) && ls->PC[l] == pc && lane_opcode(ls, l, pc) == opcode) group |= 1u << l;
+        }
+        pending &= ~group;
+
+        decoded_inst_t *inst = &ls->decoded[pc & 0x0FFF];
+        if (inst->op == OP_UNDECODED || inst->opcode != opcode) *inst = decode_instruction(opcode);
+        if (group == (1u << first) || !has_vector_kernel(inst->op)) {
+            for (uint32_t l = first; l < ls->lanes; l++) {
+                if (group >> l & 1) scalar_step(ls, config, l);
+            }
+            continue;
+        }
+        lane_vec_t mask;
+        for (uint32_t l = 0; l < LOCKSTEP_LANES; l++) mask[l] = (group >> l & 1) ? 0xFF : 0x00;
+        vector_step(ls, inst, group, &mask);
+        ls->vector_steps++;
+    }
+    ls->cycles++;
+}
+
+void lockstep_run(lockstep_t *ls, config_t *config, uint64_t cycles) {
+    uint64_t tick = chip8_next_tick(ls->cycles, config->insts_per_second);
+    for (uint64_t i = 0; i < cycles; i++) {
+        step(ls, config);
+        if (ls->cycles == tick) {
+            tick = chip8_next_tick(ls->cycles, config->insts_per_second);
+            // Saturating decrement of every lane's timers at once
+            ls->delay_timer -= (lane_vec_t)(ls->delay_timer != 0) & 1;
+            ls->sound_timer -= (lane_vec_t)(ls->sound_timer != 0) & 1;
+        }
+    }
+    for (uint32_t l = 0; l < ls->lanes; l++) lane_to_chip8(ls, l);
+}
+
+void lockstep_report(const lockstep_t *ls, FILE *out) {
+    const uint64_t total = ls->cycles * ls->lanes;
+    const uint64_t vector_lanes = total - ls->scalar_steps;
+    fprintf(out, "lockstep: %u lanes, %llu lane-instructions, %.1f%% in vector groups "
+        "(%llu vector steps, %llu scalar steps)\n",
+        ls->lanes, (unsigned long long)total, total ? 100.0 * vector_lanes / total : 0.0,
+        (unsigned long long)ls->vector_steps, (unsigned long long)ls->scalar_steps);
+}
@@ -0,0 +1,49 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "./chip8.h"
+#include "./decode.h"
+
+// Runs up to LOCKSTEP_LANES instances of the same ROM side by side, e.g. to sweep
+// RNG seeds or input sequences. The hot registers (V, I, PC, timers) are stored
+// structure-of-arrays, one vector of lanes per register, so ALU opcodes execute
+// for every lane at once with vector instructions (AVX2/SSE on x86, NEON on ARM,
+// via the compiler's vector extensions).
+//
+// Each step groups the lanes by PC. A group whose instruction has a vector kernel
+// runs it under a lane mask; anything else (draws, calls, memory ops, ...) is
+// handed to the regular interpreter one lane at a time. RAM, display, stack and
+// keypad stay in a per-lane chip8_t, which is also what callers inspect.
+
+#define LOCKSTEP_LANES 32
+
+typedef uint8_t lane_vec_t __attribute__((vector_size(LOCKSTEP_LANES)));
+
+typedef struct {
+    lane_vec_t V[16]; // V[register][lane]
+    uint16_t PC[LOCKSTEP_LANES];
+    uint16_t reg_i[LOCKSTEP_LANES];
+    lane_vec_t delay_timer;
+    lane_vec_t sound_timer;
+    chip8_t *lane[LOCKSTEP_LANES]; // Cold state and the scalar fallback
+    uint32_t lanes;
+    uint64_t cycles; // Instructions executed by every lane
+    decoded_inst_t decoded[4096]; // Shared decode cache, checked against each lane's opcode
+    uint64_t vector_steps; // Lane groups executed with a vector kernel
+    uint64_t scalar_steps; // Single-lane interpreter steps
+} lockstep_t;
+
+// Loads rom_name into lanes instances; each gets its own PRNG seed from init_chip8().
+bool lockstep_init(lockstep_t *ls, const char *rom_name, uint32_t lanes);
+void lockstep_free(lockstep_t *ls);
+// Runs cycles instructions on every lane, ticking the timers from emulated time
+// like run_cycles() does.
+void lockstep_run(lockstep_t *ls, config_t *config, uint64_t cycles);
+// Copies a lane's registers back into its chip8_t so it can be inspected or hashed.
+chip8_t *lockstep_lane(lockstep_t *ls, uint32_t lane);
+void lockstep_report(const lockstep_t *ls, FILE *out);
+
+#endif
@@ -3,59 +3,96 @@
 #include <SDL2/SDL_render.h>
 #include <SDL2/SDL_timer.h>
 #include <SDL2/SDL_video.h>
-#include <arm_neon.h>
-#include <complex.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "./constants.h"
+#include "./chip8.h"
+#include "./export.h"
+#include "./input.h"
+#include "./profile.h"
+#include "./render.h"
+#include "./rewind.h"
+#include "./romlib.h"
+#include "./scheduler.h"
+#include "./snapshot.h"
+#include "./trace.h"
+#include "./triple_buffer.h"
 
-int last_frame_time = 0;
-
-typedef enum {
-    QUIT,
-    RUNNING,
-    PAUSED,
-} emulator_state_t;
+typedef struct {
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture; // Streaming texture big enough for hi-res; low resolution uses its top left quarter
+    uint32_t pixels[DISPLAY_HIRES_WIDTH * DISPLAY_HIRES_HEIGHT]; // ARGB8888 staging buffer for the texture
+} sdl_t;
 
+// Frontend actions requested from the keyboard, as opposed to CHIP8 keypad input
 typedef struct {
-    uint32_t scale_factor;
-    uint32_t window_width;
-    uint32_t window_height;
-} config_t;
+    bool rewind; // Held: step backwards through the history
+    bool save_state; // Pressed since the emulation thread last looked
+    bool load_state;
+    int8_t rom_step; // Switch to the next (+1) or previous (-1) ROM in the library
+    bool reload; // Restart the current ROM
+} hotkeys_t;
 
 typedef struct {
-    uint16_t opcode;
-    uint16_t NNN; // 12 bit address/constant
-    uint16_t NN; // 8 bit address/constat
-    uint16_t N; // 4 bit constant
-    uint16_t X; // 4 bit register identifyer
-    uint16_t Y; // 4 bit register identifyer
-    uint16_t reg_i; // 12 bit register
-} instruction_t;
+    display_row_t display[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT];
+    bool hires;
+} frame_t;
+
+// Background, first plane, second plane, both planes
+static const uint32_t palette[4] = {0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555};
 
+// The SDL thread owns the window and the event queue, the emulation thread owns
+// the chip8_t. This is all they share: plain fields are only touched with atomics,
+// frames go through the triple buffer, so neither thread ever waits on the other.
 typedef struct {
-    emulator_state_t state;
-    uint8_t ram[4096];
-    bool display[64*32]; // display = &ram[0xF00];
-    uint16_t stack[12]; // subroutine stack;
-    uint16_t *stack_ptr;
-    uint16_t PC; // program counter
-    uint8_t V[16]; // Data registers V0-VF;
-    uint8_t delay_timer; // Decrements at 60Hz when > 0;
-    uint8_t sound_timer;
-    bool keypad[16]; // Hexadecimal keypad
-    const char *rom_name; // Currently running rom
-    instruction_t inst; // Currently executing instruction
-} chip8_t;
+    emulator_state_t state; // Only the SDL thread changes it
+    uint16_t keys; // Keypad as the SDL thread last saw it, bit n = key n
+    hotkeys_t hotkeys;
+    SDL_sem *input; // Posted on every input change, so a sleeping emulation thread wakes at once
+    triple_buffer_t frames; // Of frame_t, published at the display refresh rate
+    uint32_t frame_event; // Pushed after each publish to wake the SDL thread
+} shared_t;
 
 typedef struct {
-    SDL_Window *window;
-    SDL_Renderer *renderer;
-} sdl_t;
+    const char *rom_name;
+    const char *library_dir; // ROMs to switch between, NULL = the directory rom_name is in
+    uint32_t insts_per_second; // From --ips, 0 = the ROM's profile or the default
+    bool has_quirks; // From --quirks; false = the ROM's profile or plain CHIP-8
+    quirks_t quirks;
+    const char *trace_name;
+    const char *profile_name; // Profile report written on exit, "-" = stderr
+    const char *record_name; // Input log to write on exit, NULL = not recording
+    const char *replay_name; // Input to play back instead of the keyboard, NULL = keyboard
+    bool seeded;
+    uint32_t seed;
+    export_config_t export; // Per-frame shared memory and stream export
+} options_t;
+
+#define REWIND_SECONDS 300
+#define REWIND_KEYFRAME_INTERVAL 60
+#define IDLE_WAIT_MS 250 // Longest single sleep while nothing can happen without input
+
+// What the emulation thread runs with; main() sets it up and gets it back after joining.
+typedef struct {
+    shared_t *shared;
+    chip8_t *chip8;
+    config_t *config;
+    const options_t *options;
+    input_script_t *replay;
+    input_script_t *recording;
+    romlib_t *library;
+    size_t rom_index; // Library entry that is loaded
+    scheduler_t sched;
+    rewind_t history;
+    export_t *exporter; // NULL = not exporting
+} emulation_t;
 
 int initialize_window(sdl_t *sdl, config_t *config) {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
@@ -78,472 +115,486 @@ int initialize_window(sdl_t *sdl, config_t *config) {
           fprintf(stderr, "Error creating renderer\n");
           return false;
       }
+      sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+          DISPLAY_HIRES_WIDTH, DISPLAY_HIRES_HEIGHT);
+      if (!sdl->texture) {
+          fprintf(stderr, "Error creating texture\n");
+          return false;
+      }
       SDL_SetRenderDrawColor(sdl->renderer, 255, 255, 0, 255);
       SDL_RenderClear(sdl->renderer);
       SDL_RenderPresent(sdl->renderer);
     return true;
 }
 
-void handle_input(chip8_t *chip8) {
+// QWERTY keys standing in for the COSMAC VIP hex keypad:
+//   1 2 3 4      1 2 3 C
+//   Q W E R  ->  4 5 6 D
+//   A S D F      7 8 9 E
+//   Z X C V      A 0 B F
+static const struct {
+    SDL_Keycode sym;
+    uint8_t key;
+} keymap[16] = {
+    {SDLK_1, 0x1}, {SDLK_2, 0x2}, {SDLK_3, 0x3}, {SDLK_4, 0xC},
+    {SDLK_q, 0x4}, {SDLK_w, 0x5}, {SDLK_e, 0x6}, {SDLK_r, 0xD},
+    {SDLK_a, 0x7}, {SDLK_s, 0x8}, {SDLK_d, 0x9}, {SDLK_f, 0xE},
+    {SDLK_z, 0xA}, {SDLK_x, 0x0}, {SDLK_c, 0xB}, {SDLK_v, 0xF},
+};
+
+// Returns the keypad key sym stands for, or -1 when it isn't mapped.
+static int keypad_key(SDL_Keycode sym) {
+    for (size_t i = 0; i < sizeof keymap / sizeof keymap[0]; i++) {
+        if (keymap[i].sym == sym) return keymap[i].key;
+    }
+    return -1;
+}
+
+static void set_key(shared_t *shared, int key, bool pressed) {
+    if (pressed) __atomic_fetch_or(&shared->keys, 1u << key, __ATOMIC_RELEASE);
+    else __atomic_fetch_and(&shared->keys, ~(1u << key), __ATOMIC_RELEASE);
+}
+
+// Handles every pending event, first sleeping up to wait_ms for one to arrive, so
+// the thread is woken by input or a new frame rather than spinning on them.
+void handle_input(shared_t *shared, uint32_t wait_ms) {
     SDL_Event event;
-    while (SDL_PollEvent(&event)) {
+    bool pending = wait_ms ? SDL_WaitEventTimeout(&event, wait_ms) : SDL_PollEvent(&event);
+    for (; pending; pending = SDL_PollEvent(&event)) {
         switch (event.type) {
             case SDL_QUIT: // This event triggers whenever you click ESC button.
                 printf("esc");
-                chip8->state = QUIT;
+                __atomic_store_n(&shared->state, QUIT, __ATOMIC_RELEASE);
                 return;
 
             case SDL_KEYDOWN: // when some key is down
             switch (event.key.keysym.sym) {
                 case SDLK_ESCAPE:
-                    chip8->state = QUIT;
+                    __atomic_store_n(&shared->state, QUIT, __ATOMIC_RELEASE);
                     return;
 
                 case SDLK_SPACE:
-                    if (chip8->state==RUNNING) {
-                        chip8->state = PAUSED;
+                    if (__atomic_load_n(&shared->state, __ATOMIC_ACQUIRE) == RUNNING) {
+                        __atomic_store_n(&shared->state, PAUSED, __ATOMIC_RELEASE);
                         puts("===== PAUSED =====");
                     } else {
-                        chip8->state = RUNNING;
+                        __atomic_store_n(&shared->state, RUNNING, __ATOMIC_RELEASE);
                     }
                     break;
-                    // Map qwerty keys to CHIP8 keypad
-                    case SDLK_1: chip8->keypad[0x1] = true; break;
-                    case SDLK_2: chip8->keypad[0x2] = true; break;
-                    case SDLK_3: chip8->keypad[0x3] = true; break;
-                    case SDLK_4: chip8->keypad[0xC] = true; break;
-
-                    case SDLK_q: chip8->keypad[0x4] = true; break;
-                    case SDLK_w: chip8->keypad[0x5] = true; break;
-                    case SDLK_e: chip8->keypad[0x6] = true; break;
-                    case SDLK_r: chip8->keypad[0xD] = true; break;
-
-                    case SDLK_a: chip8->keypad[0x7] = true; break;
-                    case SDLK_s: chip8->keypad[0x8] = true; break;
-                    case SDLK_d: chip8->keypad[0x9] = true; break;
-                    case SDLK_f: chip8->keypad[0xE] = true; break;
-
-                    case SDLK_z: chip8->keypad[0xA] = true; break;
-                    case SDLK_x: chip8->keypad[0x0] = true; break;
-                    case SDLK_c: chip8->keypad[0xB] = true; break;
-                    case SDLK_v: chip8->keypad[0xF] = true; break;
-
-                default:
+
+                case SDLK_BACKSPACE: __atomic_store_n(&shared->hotkeys.rewind, true, __ATOMIC_RELEASE); break;
+                case SDLK_F5: __atomic_store_n(&shared->hotkeys.save_state, true, __ATOMIC_RELEASE); break;
+                case SDLK_F9: __atomic_store_n(&shared->hotkeys.load_state, true, __ATOMIC_RELEASE); break;
+                case SDLK_PAGEDOWN: __atomic_store_n(&shared->hotkeys.rom_step, 1, __ATOMIC_RELEASE); break;
+                case SDLK_PAGEUP: __atomic_store_n(&shared->hotkeys.rom_step, -1, __ATOMIC_RELEASE); break;
+                case SDLK_F2: __atomic_store_n(&shared->hotkeys.reload, true, __ATOMIC_RELEASE); break;
+
+                default: {
+                    const int key = keypad_key(event.key.keysym.sym);
+                    if (key >= 0) set_key(shared, key, true);
                     break;
+                }
             }
+            SDL_SemPost(shared->input);
             break;
-            case SDL_KEYUP:
-                            switch (event.key.keysym.sym) {
-                                // Map qwerty keys to CHIP8 keypad
-                                case SDLK_1: chip8->keypad[0x1] = false; break;
-                                case SDLK_2: chip8->keypad[0x2] = false; break;
-                                case SDLK_3: chip8->keypad[0x3] = false; break;
-                                case SDLK_4: chip8->keypad[0xC] = false; break;
-
-                                case SDLK_q: chip8->keypad[0x4] = false; break;
-                                case SDLK_w: chip8->keypad[0x5] = false; break;
-                                case SDLK_e: chip8->keypad[0x6] = false; break;
-                                case SDLK_r: chip8->keypad[0xD] = false; break;
-
-                                case SDLK_a: chip8->keypad[0x7] = false; break;
-                                case SDLK_s: chip8->keypad[0x8] = false; break;
-                                case SDLK_d: chip8->keypad[0x9] = false; break;
-                                case SDLK_f: chip8->keypad[0xE] = false; break;
-
-                                case SDLK_z: chip8->keypad[0xA] = false; break;
-                                case SDLK_x: chip8->keypad[0x0] = false; break;
-                                case SDLK_c: chip8->keypad[0xB] = false; break;
-                                case SDLK_v: chip8->keypad[0xF] = false; break;
-
-                                default: break;
-                            }
+            case SDL_KEYUP: {
+                if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                    __atomic_store_n(&shared->hotkeys.rewind, false, __ATOMIC_RELEASE);
+                }
+                const int key = keypad_key(event.key.keysym.sym);
+                if (key >= 0) set_key(shared, key, false);
+                SDL_SemPost(shared->input);
                 break;
+            }
             default:
-                break;
+                break; // Including frame_event, which only needs to wake us
         }
     }
+}
+
+void close_window(sdl_t *sdl) {
+    SDL_DestroyTexture(sdl->texture);
+    SDL_DestroyRenderer(sdl->renderer);
+    SDL_DestroyWindow(sdl->window);
+    SDL_Quit();
+}
+
+void update_screen(sdl_t *sdl, const frame_t *frame) {
+        // Expand the display into the pixel buffer in one pass, upload it as a single texture
+        // and let SDL scale it up to the window size (config->scale_factor)
+        const SDL_Rect area = {0, 0, frame->hires ? DISPLAY_HIRES_WIDTH : DISPLAY_WIDTH,
+                               frame->hires ? DISPLAY_HIRES_HEIGHT : DISPLAY_HEIGHT};
+        render_rows(frame->display, frame->hires, sdl->pixels, palette);
+        SDL_UpdateTexture(sdl->texture, &area, sdl->pixels, area.w * sizeof sdl->pixels[0]);
+        SDL_RenderCopy(sdl->renderer, sdl->texture, &area, NULL);
+        SDL_RenderPresent(sdl->renderer);
+}
+
+static bool parse_args(options_t *options, int argc, char **argv) {
+    if (argc < 2) return false;
+    options->rom_name = argv[1];
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) return false; // Every option takes a value
+        if (strcmp(argv[i], "--ips") == 0) {
+            options->insts_per_second = strtoul(argv[++i], NULL, 0);
+            if (!options->insts_per_second) return false;
+        } else if (strcmp(argv[i], "--quirks") == 0) {
+            if (!chip8_quirks_by_name(argv[++i], &options->quirks)) return false;
+            options->has_quirks = true;
+        } else if (strcmp(argv[i], "--library") == 0) {
+            options->library_dir = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            options->trace_name = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            options->profile_name = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            options->seed = strtoul(argv[++i], NULL, 0);
+            options->seeded = true;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            options->record_name = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0) {
+            options->replay_name = argv[++i];
+        } else if (strcmp(argv[i], "--export-shm") == 0) {
+            options->export.shm_name = argv[++i];
+        } else if (strcmp(argv[i], "--export-stream") == 0) {
+            options->export.stream_name = argv[++i];
+        } else if (strcmp(argv[i], "--export-registers") == 0) {
+            const char *value = argv[++i];
+            if (strcmp(value, "on") == 0) options->export.registers = true;
+            else if (strcmp(value, "off") == 0) options->export.registers = false;
+            else return false;
+        } else {
+            return false;
+        }
     }
+    return true;
+}
 
+// --ips wins over the ROM's profile, which wins over the default.
+static uint32_t rom_insts_per_second(const options_t *options, const romlib_t *library, const rom_entry_t *rom) {
+    uint32_t insts_per_second = options->insts_per_second;
+    if (!insts_per_second) insts_per_second = romlib_profile(library, rom->hash).insts_per_second;
+    if (!insts_per_second) insts_per_second = INSTRUCTIONS_PER_SECOND;
+    return insts_per_second < FPS ? FPS : insts_per_second; // Timers need at least one instruction per tick
+}
 
-void close_window(sdl_t sdl) {
-    SDL_DestroyRenderer(sdl.renderer);
-    SDL_DestroyWindow(sdl.window);
-    SDL_Quit();
+// Same order for the quirk profile, which has to be in place before the ROM is loaded.
+static quirks_t rom_quirks(const options_t *options, const romlib_t *library, const rom_entry_t *rom) {
+    if (options->has_quirks) return options->quirks;
+    const rom_profile_t profile = romlib_profile(library, rom->hash);
+    return profile.has_quirks ? profile.quirks : (quirks_t){0};
 }
 
-bool init_chip8(chip8_t *chip8, const char rom_name[]) {
-    const uint32_t entry_point = 0x200; // CHIP8 roms will be loaded to 0x200
-    chip8->state = RUNNING;
-    chip8->PC = entry_point; // Start PC at ROM entry point
-    chip8->rom_name = rom_name;
-    chip8->stack_ptr = &chip8->stack[0];
-    // Load font
-    const uint32_t font[] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-
-    memcpy(&chip8->ram[0], font, sizeof(font));
-    // Load rom
-    FILE *rom = fopen(rom_name, "rb");
-    if (!rom) {
-        SDL_Log("Rom file %s is invalid", rom_name);
-        return false;
-    };
-    // Set chip8 machine defaults
-    fseek(rom, 0, SEEK_END);
-    const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof chip8->ram - entry_point;
-    rewind(rom);
-    if (rom_size > max_size) {
-        SDL_Log("Rom size %zu is too big.", rom_size);
-        return false;
+// Catalogs the library directory, with its profiles.tsv if it has one, and adds the ROM
+// given on the command line. Returns the ROM's index, or -1 if it can't be read.
+static long open_library(romlib_t *library, const options_t *options) {
+    romlib_init(library);
+    char dir[4096];
+    if (options->library_dir) {
+        snprintf(dir, sizeof dir, "%s", options->library_dir);
+    } else {
+        const char *slash = strrchr(options->rom_name, '/');
+        snprintf(dir, sizeof dir, "%.*s", slash ? (int)(slash - options->rom_name) : 1, slash ? options->rom_name : ".");
     }
-    if (fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1) {
-        SDL_Log("Could not read rom file into chip memory");
-        return false;
-    };
-    fclose(rom);
-    return true; // Success
+    romlib_scan(library, dir); // Without a library only the ROM itself can be reloaded
+    char profiles[4096 + 16];
+    snprintf(profiles, sizeof profiles, "%s/profiles.tsv", dir);
+    if (access(profiles, R_OK) == 0) romlib_load_profiles(library, profiles);
+    return romlib_add(library, options->rom_name);
 }
 
-void update_screen(const sdl_t *sdl, chip8_t *chip8, config_t *config) {
-        SDL_Rect rect = {.x=0, .y=0, .w = config->scale_factor, .h = config->scale_factor};
-        // Loop through display pixels, draw a rectangle per pixel to the SDL window
-        for (uint32_t i = 0; i < sizeof chip8->display; i++) {
-            // Translate 1D index i value to 2D X/Y coords
-            rect.x = (i % config->window_width) * config->scale_factor;
-            rect.y = (i / config->window_width) * config->scale_factor;
-            // If pixel is on
-            if (chip8->display[i]) {
-                SDL_SetRenderDrawColor(sdl->renderer, 255, 255, 255, 255);
-                SDL_RenderFillRect(sdl->renderer, &rect);
-            } else {
-                // If it's off
-                SDL_SetRenderDrawColor(sdl->renderer, 0, 0, 0, 255);
-                SDL_RenderFillRect(sdl->renderer, &rect);
-            }
-        }
-        SDL_RenderPresent(sdl->renderer);
+// F5/F9 save to and load from <rom>.state next to the ROM. Returns whether a state was loaded.
+static bool handle_state_hotkeys(chip8_t *chip8, hotkeys_t *hotkeys, const char *rom_name) {
+    if (!hotkeys->save_state && !hotkeys->load_state) return false;
+    char path[4096];
+    snprintf(path, sizeof path, "%s.state", rom_name);
+    chip8_snapshot_t snap;
+    if (hotkeys->save_state) {
+        snapshot_save(chip8, &snap);
+        if (snapshot_write_file(path, &snap)) printf("Saved state to %s\n", path);
+    }
+    bool loaded = false;
+    if (hotkeys->load_state && snapshot_read_file(path, &snap)) {
+        // Keys are whatever the player holds now, not what they held when saving
+        bool keypad[16];
+        memcpy(keypad, chip8->keypad, sizeof keypad);
+        loaded = snapshot_load(chip8, &snap);
+        if (loaded) printf("Loaded state from %s\n", path);
+        memcpy(chip8->keypad, keypad, sizeof keypad);
+    }
+    hotkeys->save_state = hotkeys->load_state = false;
+    return loaded;
 }
 
-typedef void (*MachineCodeRoutine)();
+// Logs the keypad transitions from before to after as happening at the current instruction.
+static void record_keys(input_script_t *recording, const chip8_t *chip8, const bool before[16], const bool after[16]) {
+    for (uint8_t key = 0; key < 16; key++) {
+        if (before[key] != after[key]) input_script_record(recording, chip8->cycles, key, after[key]);
+    }
+}
 
-void executeMachineCodeRoutine(chip8_t *chip8) {
-    // Assuming machine code routines are stored in the chip8->ram array
-    MachineCodeRoutine routine = (MachineCodeRoutine)&chip8->inst.NNN;
-    routine(); // Call the machine code routine
+// Runs instructions with the timers ticking on instruction counts rather than on the
+// wall clock, exactly like the headless runner, so a recorded session replays bit-exactly.
+// Replayed input is applied on the instruction it was recorded at.
+static void run_instructions(chip8_t *chip8, config_t *config, input_script_t *replay, uint32_t instructions) {
+    const uint64_t end = chip8->cycles + instructions;
+    while (chip8->cycles < end && chip8->state != QUIT) {
+        const uint64_t next_event = input_script_apply(replay, chip8);
+        run_cycles(chip8, config, (next_event < end ? next_event : end) - chip8->cycles);
+    }
 }
 
+// Presentation follows the monitor; fall back to the CHIP8 60Hz when SDL can't tell us.
+static uint32_t display_refresh_rate(const sdl_t *sdl) {
+    SDL_DisplayMode mode;
+    const int display = SDL_GetWindowDisplayIndex(sdl->window);
+    if (display < 0 || SDL_GetCurrentDisplayMode(display, &mode) != 0 || mode.refresh_rate <= 0) return FPS;
+    return mode.refresh_rate;
+}
 
-void emulate_commands(chip8_t *chip8, config_t *config) {
-    // Get next opcode from ram
-    chip8->inst.opcode = chip8->ram[chip8->PC] << 8 | chip8->ram[chip8->PC+1]; // Reading 2 bytes and combining them
-    chip8->PC += 2; // Pre-increment program counter for next opcode
-    // Fill out current instruction format
-    chip8->inst.NNN = chip8->inst.opcode & 0x0FFF; // 0FFF is 4096; address
-    chip8->inst.NN = chip8->inst.opcode & 0x0FF; // 255;
-    chip8->inst.N = chip8->inst.opcode & 0x0F;
-    chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-    chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
-    // Emulate opcode
-    printf("Address: 0x%04X Opcode: 0x%04X, desc: ", chip8->PC - 2, chip8->inst.opcode);
-    switch ((chip8->inst.opcode >> 12) & 0x0F) {
-        case 0x00:
-            if (chip8->inst.NN == 0xE0) {
-                // 0x00E0: Clear screen
-                printf("Clear screen\n");
-                memset(&chip8->display[0], false, sizeof chip8->display);
-            } else if (chip8->inst.NN == 0xEE) {
-                // 0x00EE: Return from subroutine
-                // Set program counter to last address on subroutine stack ("pop" it off the stack)
-                //   so that next opcode will be gotten from that address.
-                printf("Return from subroutine\n");
-                chip8->PC = *--chip8->stack_ptr;
-            } else {
-                // Calls machine code routine (RCA 1802 for COSMAC VIP) at address NNN
-                executeMachineCodeRoutine(chip8);
-            }
-            break;
-        case 0x01:
-            // Jump to NNN
-            printf("Jump to NNN (0x%04X)\n", chip8->inst.NNN);
-            chip8->PC = chip8->inst.NNN;
-            break;
-        case 0x02:
-            // Calls subroutine at NNN.
-            printf("Calls subroutine at NNN.");
-            *chip8->stack_ptr++ = chip8->PC;
-            chip8->PC = chip8->inst.NNN;
-            break;
-        case 0x03:
-            printf("Skips the next instruction if VX equals NN\n");
-            if (chip8->V[chip8->inst.X] == chip8->inst.NN) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0x04:
-            printf("Skips the next instruction if VX NOT equals NN\n");
-            if (chip8->V[chip8->inst.X] != chip8->inst.NN) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0x05:
-            printf("Skips the next instruction if VX equals VY\n");
-            if (chip8->V[chip8->inst.X] == chip8->V[chip8->inst.Y]) {
-                chip8->PC += 2;
-            }
-            break;
-        case 0x06:
-            // 0x6XNN - Set register VX to NN
-            printf("Set register V%X(0x%04X) to NN (0x%04x)\n", chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
-            chip8->V[chip8->inst.X] = chip8->inst.NN;
-            break;
-        case 0x07:
-            printf("Adds NN (%04X) to VX (%04X)\n", chip8->V[chip8->inst.X], chip8->inst.NN);
-            chip8->V[chip8->inst.X] += chip8->inst.NN;
-            break;
-        case 0x08:
-            switch (chip8->inst.N) {
-                case 0x0:
-                    printf("Sets VX (%04X) to the value of VY (%04X).", chip8->inst.X, chip8->inst.Y);
-                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y];
-                    break;
-                case 0x1:
-                    // Sets VX to VX OR VY
-                    printf("Sets VX (%04X) to VX or VY (%04X).", chip8->inst.X, chip8->inst.Y);
-                    chip8->V[chip8->inst.X] |= chip8->V[chip8->inst.Y];
-                    break;
-                case 0x2:
-                    printf("Sets VX (%04X) to VX and VY (%04X).", chip8->inst.X, chip8->inst.Y);
-                    chip8->V[chip8->inst.X] &= chip8->V[chip8->inst.Y];
-                    break;
-                case 0x3:
-                    // Sets VX to VX xor VY
-                    printf("Sets VX (%04X) to VX xor VY (%04X).", chip8->inst.X, chip8->inst.Y);
-                    chip8->V[chip8->inst.X] ^= chip8->V[chip8->inst.Y];
-                    break;
-                case 0x4:
-                    printf("Adds VY (%04X) to VX (%04X).", chip8->inst.Y, chip8->inst.X);
-                    chip8->inst.X += chip8->inst.Y;
-                    break;
-                case 0x5:
-                    printf("Substract VY (%04X) from VX (%04X).", chip8->inst.Y, chip8->inst.X);
-                    chip8->inst.X -= chip8->inst.Y;
-                    break;
-                case 0x6:
-                    // Stores the least significant bit of VX in VF and then shifts VX to the right by 1.
-                    printf("Stores the least significant bit of VX (%04X) in VF.", chip8->inst.X);
-                    int LSB = chip8->V[chip8->inst.X] & 0x01; // least significant bit of VX
-                    chip8->V[chip8->inst.X] >>= 1;
-                    break;
-                case 0x7:
-                    // Sets VX to VY minus VX. VF is set to 0 when there's an underflow, and 1 when there is not.
-                    printf("Sets VX (%04X) to VY (%04X) minus VX.", chip8->inst.X, chip8->inst.Y);
-                    chip8->V[chip8->inst.X] = chip8->V[chip8->inst.Y] - chip8->V[chip8->inst.X];
-                    if (chip8->V[chip8->inst.Y] >= chip8->V[chip8->inst.X]) {
-                        chip8->V[15] = 1;
-                    } else {
-                        chip8->V[15] = 0;
-                    }
-                    break;
-                case 0xE:
-                    // Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
-                    printf("Stores the most significant bit of VX (%04X) in VF.", chip8->inst.X);
-                    int MSB = chip8->V[chip8->inst.X] | 0x01; // least significant bit of VX
-                    chip8->V[chip8->inst.X] <<= 1;
-                    break;
-            }
-        case 0x09:
-            printf("Skips the next instruction if VX NOT equals VY\n");
-            if (chip8->V[chip8->inst.X] != chip8->V[chip8->inst.Y])
-                chip8->PC += 2;
+// Hands the display over to the SDL thread. Frames it hasn't shown yet are simply replaced.
+static void publish_frame(shared_t *shared, chip8_t *chip8) {
+    frame_t *frame = triple_buffer_back(&shared->frames);
+    memcpy(frame->display, chip8->display, sizeof frame->display);
+    frame->hires = chip8->hires;
+    triple_buffer_publish(&shared->frames);
+    chip8->draw = false;
+    SDL_Event event = {.type = shared->frame_event};
+    SDL_PushEvent(&event);
+}
 
-            break;
-        case 0x0A:
-            printf("Sets I (0x%04X) to the address NNN (0x%04X)\n", chip8->inst.reg_i, chip8->inst.NNN);
-            chip8->inst.reg_i = chip8->inst.NNN;
-            break;
-        case 0x0B:
-            //Jumps to the address NNN plus V0.
-            printf("Jumps to the address NNN plus V0\n");
-            chip8->V[chip8->inst.X] = (rand() % 256) & chip8->inst.NN;
-            break;
-        case 0x0C:
-            //Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
-            printf("Sets VX to the result of a bitwise and operation on a random numbe.\n");
-            srand(time(NULL));   // Initialization, should only be called once.
-            int r = rand();
-            chip8->V[chip8->inst.X] = r & chip8->inst.NN;
-            break;
-        case 0x0D:
-            // 0xDXYN - Draw N-height sprite at coords X, Y; Read from memory location I
-            // Screen pixels are XOR'd with sprite bits,
-            // VX (Carry flag) is set if any screen pixels are set off; This is usefult for
-            // collision detection or other reasons
-            printf("Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) from memory location I (0x%04X).\n",
-                chip8->inst.N, chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y, chip8->V[chip8->inst.Y], chip8->inst.reg_i);
-                uint8_t x_coord = chip8->V[chip8->inst.X] % config->window_width;
-                uint8_t y_coord = chip8->V[chip8->inst.Y] % config->window_height;
-                const uint8_t original_x = x_coord;
-                chip8->V[0xF] = 0; // Initialize carry flag to 0
-                // Loop over all N rows of the sprite
-                for (uint8_t i = 0; i < chip8->inst.N; i++) {
-                    // Get next byte/row of sprite data
-                    const uint8_t sprite_data = chip8->ram[chip8->inst.reg_i + i];
-                    x_coord = original_x; // Reset X for next raw draw
-
-                    for (int8_t j = 7; j >= 0; j--) {
-                        // If sprite pixel/bit is on and display pixel is on, set carry flag
-                        bool *pixel = &chip8->display[y_coord * config->window_width + x_coord];
-                        const bool sprite_bit = (sprite_data & (1 << j));
-                        if (sprite_bit && *pixel) {
-                            chip8->V[0xF] = 1;
-                        }
-                        // XOR display pixel with sprite pixel/bit
-                        *pixel ^= sprite_bit;
-                        // Stop drawing if hit right edge of screen
-                        if (++x_coord >= config->window_width *config->scale_factor) break;
-                    }
-                    // Stop drawing entire sprite if hit bottom edge of screen
-                    if (++y_coord >= config->window_height * config->scale_factor) break;
-                }
-                break;
-            case 0x0E:
-                       if (chip8->inst.NN == 0x9E) {
-                           // 0xEX9E: Skip next instruction if key in VX is pressed
-                           printf("Skip next instruction if key in VX is pressed");
-                           if (chip8->keypad[chip8->V[chip8->inst.X]])
-                               chip8->PC += 2;
-
-                       } else if (chip8->inst.NN == 0xA1) {
-                           printf("Skip next instruction if key in VX is not pressed");
-                           // 0xEX9E: Skip next instruction if key in VX is not pressed
-                           if (!chip8->keypad[chip8->V[chip8->inst.X]])
-                               chip8->PC += 2;
-                       }
-                       break;
-            case 0x0F:
-                switch (chip8->inst.NN) {
-                    case 0x0A: {
-                        // A key press is awaited, and then stored in VX
-                        printf("A key press is awaited, and then stored in VX");
-                        static bool any_key_pressed = false;
-                        static uint8_t key = 0xFF;
-                        for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keypad; i++) {
-                            if (chip8->keypad[i]) {
-                                key = i;
-                                any_key_pressed = true;
-                                break;
-                            }
-                            if (!any_key_pressed) {
-                                chip8->PC -= 2;
-                            } else {
-                                if (chip8->keypad[key]) {
-                                    chip8->PC -= 2;
-                                } else {
-                                    chip8->V[chip8->inst.X] = key;
-                                    key = 0xFF;
-                                    any_key_pressed = false;
-                                }
-                            }
-                            break;
-                        }
-                    }
-                    case 0x07:
-                        // Sets VX to the value of the delay timer.
-                        printf("Sets VX to the value of the delay timer.");
-                        chip8->V[chip8->inst.X] = chip8->delay_timer;
-                        break;
-                    case 0x15:
-                        // Sets the delay timer to VX
-                        printf("Sets the delay timer to VX");
-                        chip8->delay_timer = chip8->V[chip8->inst.X];
-                        break;
-                    case 0x18:
-                        // Sets the sound timer to VX.
-                        printf("Sets the sound timer to VX.");
-                        chip8->sound_timer = chip8->V[chip8->inst.X];
-                        break;
-                    case 0x1E:
-                        // Adds VX to I. VF is not affected.
-                        printf("Adds VX to I. VF is not affected.");
-                        chip8->inst.reg_i += chip8->V[chip8->inst.X];
-                        break;
-                    case 0x29:
-                        // Sets I to the location of the sprite for the character in VX.
-                        printf("Sets I to the location of the sprite for the character in VX.");
-                        chip8->inst.reg_i = chip8->V[chip8->inst.X] * 5;
-                        break;
-                    case 0x33: {
-                        printf("Stores the binary-coded decimal representation of VX");
-                        // Stores the binary-coded decimal representation of VX,
-                        // with the hundreds digit in memory at location in I,
-                        // the tens digit at location I+1, and the ones digit at location I+2
-                        uint8_t bcd = chip8->V[chip8->inst.X];
-                        chip8->ram[chip8->inst.reg_i+2] = bcd % 10;
-                        bcd /= 10;
-                        chip8->ram[chip8->inst.reg_i+1] = bcd % 10;
-                        bcd /= 10;
-                        chip8->ram[chip8->inst.reg_i] = bcd;
-                        break;
-                case 0x55:
-                printf("Stores from V0 to VX (including VX) in memory, starting at address I.");
-                for (uint8_t i = 0; i <= chip8->inst.X; i++)  {
-                    chip8->ram[chip8->inst.reg_i++] = chip8->V[i]; // Increment I each time
-                    }
-                    break;
-                case 0x65:
-                printf("Fills from V0 to VX (including VX) with values from memory, starting at address I.");
-                // 0xFX65: Register load V0-VX inclusive from memory offset from I;
-                //   SCHIP does not increment I, CHIP8 does increment I
-                for (uint8_t i = 0; i <= chip8->inst.X; i++) {
-                    chip8->V[i] = chip8->ram[chip8->inst.reg_i++]; // Increment I each time
-                    break;
-                }
+// Sleeps until input arrives or ms pass, then swallows the other wakeups already queued.
+static void wait_for_input(SDL_sem *input, uint32_t ms) {
+    if (ms) SDL_SemWaitTimeout(input, ms);
+    while (SDL_SemTryWait(input) == 0) {}
+}
 
-        default:
-            break;
-                    }
+// PageDown/PageUp switch to the next/previous ROM in the library and F2 restarts
+// the current one, all inside the running instance. Returns whether a ROM was loaded.
+static bool handle_rom_hotkeys(emulation_t *emu, const hotkeys_t *hotkeys) {
+    if (!hotkeys->rom_step && !hotkeys->reload) return false;
+    if (emu->options->replay_name || emu->options->record_name) {
+        puts("Switching ROMs is disabled while recording or replaying input");
+        return false;
+    }
+    const size_t count = emu->library->count;
+    const quirks_t previous = emu->chip8->quirks;
+    // Keep stepping past ROMs that won't load, short of coming back round to the current
+    // one; a reload (or a library of one) only tries the current ROM
+    const size_t attempts = hotkeys->rom_step && count > 1 ? count - 1 : 1;
+    size_t index = emu->rom_index;
+    const rom_entry_t *rom = NULL;
+    for (size_t i = 0; i < attempts && !rom; i++) {
+        index = (index + count + hotkeys->rom_step) % count;
+        emu->chip8->quirks = rom_quirks(emu->options, emu->library, &emu->library->roms[index]);
+        if (romlib_load(&emu->library->roms[index], emu->chip8)) rom = &emu->library->roms[index];
+    }
+    if (!rom) {
+        emu->chip8->quirks = previous; // The machine was left as it was, keep running it the same way
+        return false;
+    }
+    emu->rom_index = index;
+    if (emu->options->seeded) chip8_seed(emu->chip8, emu->options->seed);
+    emu->config->insts_per_second = rom_insts_per_second(emu->options, emu->library, rom);
+    emu->sched.insts_per_second = emu->config->insts_per_second;
+    rewind_clear(&emu->history); // That history belongs to the previous ROM
+    printf("Loaded %s (%016llx), %u instructions per second\n", rom->name, (unsigned long long)rom->hash,
+        emu->config->insts_per_second);
+    return true;
+}
+
+// The emulation thread: runs the core on the scheduler's clock, so a present that
+// blocks on vsync in the SDL thread can't hold it up.
+static int emulation_main(void *data) {
+    emulation_t *emu = data;
+    shared_t *shared = emu->shared;
+    chip8_t *chip8 = emu->chip8;
+    const options_t *options = emu->options;
+    bool blocked = false; // Nothing can change until the player does something
+    scheduler_resync(&emu->sched, SDL_GetPerformanceCounter());
+    for (;;) {
+        // Sleep until the next frame is due, or for as long as it takes when blocked; input cuts either short
+        wait_for_input(shared->input,
+            blocked ? IDLE_WAIT_MS : scheduler_ms_until_frame(&emu->sched, SDL_GetPerformanceCounter()));
+        // Don't let the time spent blocked count as lag
+        if (blocked) scheduler_resync(&emu->sched, SDL_GetPerformanceCounter());
+        chip8->state = __atomic_load_n(&shared->state, __ATOMIC_ACQUIRE);
+        if (chip8->state == QUIT) break;
+
+        bool keypad[16];
+        memcpy(keypad, chip8->keypad, sizeof keypad);
+        hotkeys_t hotkeys = {
+            .rewind = __atomic_load_n(&shared->hotkeys.rewind, __ATOMIC_ACQUIRE),
+            .save_state = __atomic_exchange_n(&shared->hotkeys.save_state, false, __ATOMIC_ACQ_REL),
+            .load_state = __atomic_exchange_n(&shared->hotkeys.load_state, false, __ATOMIC_ACQ_REL),
+            .rom_step = __atomic_exchange_n(&shared->hotkeys.rom_step, 0, __ATOMIC_ACQ_REL),
+            .reload = __atomic_exchange_n(&shared->hotkeys.reload, false, __ATOMIC_ACQ_REL),
+        };
+        if (options->replay_name) {
+            // The log drives the keypad, and jumping around would leave it behind
+            hotkeys.rewind = false;
+        } else {
+            const uint16_t keys = __atomic_load_n(&shared->keys, __ATOMIC_ACQUIRE);
+            for (int key = 0; key < 16; key++) chip8->keypad[key] = keys >> key & 1;
+            if (options->record_name) record_keys(emu->recording, chip8, keypad, chip8->keypad);
+        }
+        if (hotkeys.load_state && (options->replay_name || options->record_name)) {
+            puts("Loading a state is disabled while recording or replaying input");
+            hotkeys.load_state = false;
+        }
+        const bool loaded_state = handle_state_hotkeys(chip8, &hotkeys, chip8->rom_name);
+        const bool loaded_rom = handle_rom_hotkeys(emu, &hotkeys);
+        // The stream's next frame can't be a delta from a machine that is gone
+        if ((loaded_state || loaded_rom) && emu->exporter) export_restart(emu->exporter);
+        blocked = chip8->state == PAUSED;
+        if (blocked) continue;
+        uint32_t instructions, timer_ticks;
+        bool present;
+        scheduler_advance(&emu->sched, SDL_GetPerformanceCounter(), &instructions, &timer_ticks, &present);
+        if (hotkeys.rewind) {
+            // Play the history backwards at about the speed it was recorded
+            memcpy(keypad, chip8->keypad, sizeof keypad);
+            if (timer_ticks && rewind_pop(&emu->history, chip8)) {
+                if (emu->exporter) export_restart(emu->exporter);
+                if (options->record_name) {
+                    // Continue the recording from here: the undone future goes, and whatever
+                    // the player holds now counts as pressed at this point
+                    input_script_truncate(emu->recording, chip8->cycles);
+                    record_keys(emu->recording, chip8, chip8->keypad, keypad);
                 }
+                memcpy(chip8->keypad, keypad, sizeof keypad);
+            }
+        } else {
+            run_instructions(chip8, emu->config, emu->replay, instructions);
+            if (timer_ticks) rewind_push(&emu->history, chip8);
+        }
+        if (timer_ticks && emu->exporter) export_frame(emu->exporter, chip8);
+#if CHIP8_PROFILING
+        if (chip8->profile && profile_dump_requested()) profile_dump(chip8->profile, chip8, stderr);
+#endif
+        // Nothing was cleared or drawn since the last frame, so what's on screen is still correct
+        if (present && chip8->draw) publish_frame(shared, chip8);
+        // Parked in FX0A with both timers run down: emulating on would only count cycles.
+        // Skipped cycles don't matter, since recorded input is logged at the instruction count.
+        blocked = !options->replay_name && !hotkeys.rewind && !chip8->delay_timer && !chip8->sound_timer
+            && !chip8->draw && chip8_waiting_for_key(chip8);
     }
+    return 0;
 }
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage %s <rom_name>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
     sdl_t sdl = {0};
     chip8_t chip8 = {0};
     config_t config = {0};
     config.window_width = 64;
     config.window_height = 32;
     config.scale_factor = 10;
-    const char *rom_name = argv[1];
-    init_chip8(&chip8, rom_name);
-    initialize_window(&sdl, &config);
-    while (chip8.state != QUIT) {
-        handle_input(&chip8);
-        if (chip8.state == PAUSED) continue;
-        emulate_commands(&chip8, &config);
-        SDL_Delay(16);
-        update_screen(&sdl, &chip8, &config);
+    config.skip_idle = true;
+    options_t options = {0};
+    if (!parse_args(&options, argc, argv)) {
+        fprintf(stderr, "Usage %s <rom_name> [--ips N] [--quirks chip8|vip|schip|xochip] [--library DIR] [--trace FILE] "
+            "[--profile FILE] [--seed N] [--record FILE] [--replay FILE] [--export-shm NAME] [--export-stream FILE] "
+            "[--export-registers on|off]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    romlib_t library;
+    const long rom_index = open_library(&library, &options);
+    if (rom_index < 0) exit(EXIT_FAILURE);
+    chip8.quirks = rom_quirks(&options, &library, &library.roms[rom_index]);
+    if (!romlib_load(&library.roms[rom_index], &chip8)) exit(EXIT_FAILURE);
+    config.insts_per_second = rom_insts_per_second(&options, &library, &library.roms[rom_index]);
+    input_script_t replay = {0};
+    if (options.replay_name) {
+        if (!input_script_load(&replay, options.replay_name)) exit(EXIT_FAILURE);
+        if (replay.insts_per_second) config.insts_per_second = replay.insts_per_second;
+    }
+    if (options.seeded) chip8_seed(&chip8, options.seed);
+    if (replay.rng_state) chip8.rng_state = replay.rng_state;
+    // Everything a replay needs besides the key presses
+    input_script_t recording = {.rng_state = chip8.rng_state, .insts_per_second = config.insts_per_second};
+#if CHIP8_TRACE
+    if (options.trace_name) chip8.trace = trace_open(options.trace_name);
+#endif
+#if CHIP8_PROFILING
+    if (options.profile_name) {
+        chip8.profile = profile_create();
+        profile_install_signal();
+    }
+#else
+    if (options.profile_name) fprintf(stderr, "Profiling is not compiled in; build with make profile\n");
+#endif
+    if (!initialize_window(&sdl, &config)) exit(EXIT_FAILURE);
+
+    shared_t shared = {.state = RUNNING, .input = SDL_CreateSemaphore(0), .frame_event = SDL_RegisterEvents(1)};
+    if (!shared.input || shared.frame_event == (uint32_t)-1) {
+        fprintf(stderr, "Error setting up the emulation thread: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    if (!triple_buffer_init(&shared.frames, sizeof(frame_t))) exit(EXIT_FAILURE);
+    emulation_t emu = {.shared = &shared, .chip8 = &chip8, .config = &config, .options = &options,
+                       .replay = &replay, .recording = &recording, .library = &library, .rom_index = rom_index};
+    if (!rewind_init(&emu.history, REWIND_SECONDS * FPS, REWIND_KEYFRAME_INTERVAL)) exit(EXIT_FAILURE);
+    if (options.export.shm_name || options.export.stream_name) {
+        emu.exporter = export_open(&options.export);
+        if (!emu.exporter) exit(EXIT_FAILURE);
+    }
+    scheduler_init(&emu.sched, SDL_GetPerformanceCounter(), SDL_GetPerformanceFrequency(),
+        config.insts_per_second, display_refresh_rate(&sdl));
+    SDL_Thread *thread = SDL_CreateThread(emulation_main, "emulation", &emu);
+    if (!thread) {
+        fprintf(stderr, "Error creating the emulation thread: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+#if CHIP8_PROFILING
+    uint64_t screen_updates = 0, screen_ns = 0; // chip8 belongs to the other thread until it is joined
+#endif
+    // This thread only handles events and presents whatever frame was published last
+    while (__atomic_load_n(&shared.state, __ATOMIC_ACQUIRE) != QUIT) {
+        handle_input(&shared, IDLE_WAIT_MS);
+        const frame_t *frame = triple_buffer_take(&shared.frames);
+        if (!frame) continue;
+#if CHIP8_PROFILING
+        const uint64_t start = SDL_GetPerformanceCounter();
+        update_screen(&sdl, frame);
+        screen_ns += (SDL_GetPerformanceCounter() - start) * 1000000000 / SDL_GetPerformanceFrequency();
+        screen_updates++;
+#else
+        update_screen(&sdl, frame);
+#endif
+    }
+    SDL_SemPost(shared.input);
+    SDL_WaitThread(thread, NULL);
+#if CHIP8_PROFILING
+    if (chip8.profile) {
+        chip8.profile->screen_updates += screen_updates;
+        chip8.profile->screen_ns += screen_ns;
+    }
+#endif
+    scheduler_report(&emu.sched, stderr);
+    fprintf(stderr, "rewind: %u frames in %.1f KiB\n", rewind_frames(&emu.history), rewind_memory(&emu.history) / 1024.0);
+    rewind_free(&emu.history);
+    export_close(emu.exporter);
+    triple_buffer_free(&shared.frames);
+    SDL_DestroySemaphore(shared.input);
+    if (options.record_name) {
+        recording.end_cycle = chip8.cycles;
+        if (input_script_save(&recording, options.record_name)) {
+            printf("Recorded %zu key events over %llu instructions to %s\n", recording.count,
+                (unsigned long long)recording.end_cycle, options.record_name);
+        }
+    }
+    input_script_free(&recording);
+    input_script_free(&replay);
+    close_window(&sdl);
+#if CHIP8_TRACE
+    trace_close(chip8.trace);
+#endif
+#if CHIP8_PROFILING
+    if (chip8.profile) {
+        profile_write(chip8.profile, &chip8, options.profile_name);
+        profile_destroy(chip8.profile);
     }
-    close_window(sdl);
+#endif
+    romlib_free(&library);
     return 0;
 }
@@ -0,0 +1,169 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./disasm.h"
+#include "./profile.h"
+
+#define HOT_ADDRESSES 32
+#define BAR_WIDTH 30
+
+static const char *const op_names[OP_COUNT] = {
+    [OP_UNDECODED] = "(undecoded)",
+    [OP_CLS] = "00E0 CLS",
+    [OP_RET] = "00EE RET",
+    [OP_SYS] = "0NNN SYS",
+    [OP_JP] = "1NNN JP",
+    [OP_CALL] = "2NNN CALL",
+    [OP_SE_VX_NN] = "3XNN SE Vx, byte",
+    [OP_SNE_VX_NN] = "4XNN SNE Vx, byte",
+    [OP_SE_VX_VY] = "5XY0 SE Vx, Vy",
+    [OP_LD_VX_NN] = "6XNN LD Vx, byte",
+    [OP_ADD_VX_NN] = "7XNN ADD Vx, byte",
+    [OP_LD_VX_VY] = "8XY0 LD Vx, Vy",
+    [OP_OR] = "8XY1 OR",
+    [OP_AND] = "8XY2 AND",
+    [OP_XOR] = "8XY3 XOR",
+    [OP_ADD_VX_VY] = "8XY4 ADD Vx, Vy",
+    [OP_SUB] = "8XY5 SUB",
+    [OP_SHR] = "8XY6 SHR",
+    [OP_SUBN] = "8XY7 SUBN",
+    [OP_SHL] = "8XYE SHL",
+    [OP_SNE_VX_VY] = "9XY0 SNE Vx, Vy",
+    [OP_LD_I] = "ANNN LD I",
+    [OP_JP_V0] = "BNNN JP V0",
+    [OP_RND] = "CXNN RND",
+    [OP_DRW] = "DXYN DRW",
+    [OP_SKP] = "EX9E SKP",
+    [OP_SKNP] = "EXA1 SKNP",
+    [OP_LD_VX_DT] = "FX07 LD Vx, DT",
+    [OP_LD_VX_K] = "FX0A LD Vx, K",
+    [OP_LD_DT_VX] = "FX15 LD DT, Vx",
+    [OP_LD_ST_VX] = "FX18 LD ST, Vx",
+    [OP_ADD_I_VX] = "FX1E ADD I, Vx",
+    [OP_LD_F_VX] = "FX29 LD F, Vx",
+    [OP_LD_B_VX] = "FX33 LD B, Vx",
+    [OP_LD_MEM_VX] = "FX55 LD [I], Vx",
+    [OP_LD_VX_MEM] = "FX65 LD Vx, [I]",
+    [OP_SCD] = "00CN SCD",
+    [OP_SCR] = "00FB SCR",
+    [OP_SCL] = "00FC SCL",
+    [OP_EXIT] = "00FD EXIT",
+    [OP_LOW] = "00FE LOW",
+    [OP_HIGH] = "00FF HIGH",
+    [OP_LD_HF_VX] = "FX30 LD HF, Vx",
+    [OP_LD_R_VX] = "FX75 LD R, Vx",
+    [OP_LD_VX_R] = "FX85 LD Vx, R",
+    [OP_SCU] = "00DN SCU",
+    [OP_SAVE_VX_VY] = "5XY2 LD [I], Vx-Vy",
+    [OP_LOAD_VX_VY] = "5XY3 LD Vx-Vy, [I]",
+    [OP_LD_I_LONG] = "F000 LD I, long",
+    [OP_PLANE] = "FN01 PLANE",
+    [OP_AUDIO] = "F002 AUDIO",
+    [OP_PITCH] = "FX3A PITCH",
+    [OP_INVALID] = "(invalid)",
+};
+
+static volatile sig_atomic_t dump_requested;
+
+profile_t *profile_create(void) {
+    profile_t *profile = calloc(1, sizeof *profile);
+    if (!profile) fprintf(stderr, "Could not allocate the profiler\n");
+    return profile;
+}
+
+void profile_destroy(profile_t *profile) {
+    free(profile);
+}
+
+static void on_sigusr1(int sig) {
+    (void)sig;
+    dump_requested = 1;
+}
+
+void profile_install_signal(void) {
+    signal(SIGUSR1, on_sigusr1);
+}
+
+bool profile_dump_requested(void) {
+    if (!dump_requested) return false;
+    dump_requested = 0;
+    return true;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+void profile_dump(const profile_t *profile, const chip8_t *chip8, FILE *out) {
+    const uint64_t total = profile->instructions;
+    fprintf(out, "profile: %llu instructions\n", (unsigned long long)total);
+
+    // Flat profile, most executed opcode first
+    uint8_t ops[OP_COUNT];
+    uint32_t op_total = 0;
+    for (uint32_t op = 0; op < OP_COUNT; op++) {
+        if (profile->op_count[op]) ops[op_total++] = op;
+    }
+    for (uint32_t i = 1; i < op_total; i++) {
+        for (uint32_t j = i; j > 0 && profile->op_count[ops[j]] > profile->op_count[ops[j - 1]]; j--) {
+            const uint8_t op = ops[j];
+            ops[j] = ops[j - 1];
+            ops[j - 1] = op;
+        }
+    }
+    fprintf(out, "\n%14s %7s  opcode\n", "count", "%");
+    for (uint32_t i = 0; i < op_total; i++) {
+        const uint64_t count = profile->op_count[ops[i]];
+        fprintf(out, "%14llu %6.2f%%  %s\n", (unsigned long long)count, percent(count, total), op_names[ops[i]]);
+    }
+
+    const uint64_t draws = profile->op_count[OP_DRW];
+    fprintf(out, "\ndraw: %llu DXYN, %llu rows (%.1f per sprite), %llu pixels, %llu collisions\n",
+        (unsigned long long)draws, (unsigned long long)profile->draw_rows,
+        draws ? (double)profile->draw_rows / draws : 0.0, (unsigned long long)profile->draw_pixels,
+        (unsigned long long)profile->draw_collisions);
+    if (profile->screen_updates) {
+        fprintf(out, "screen: %llu updates, %.1f us each\n", (unsigned long long)profile->screen_updates,
+            profile->screen_ns / 1000.0 / profile->screen_updates);
+    }
+
+    // Hot addresses: repeatedly pick the largest remaining count; HOT_ADDRESSES passes over 4K is cheap
+    bool taken[4096] = {false};
+    uint64_t top = 0;
+    fprintf(out, "\n%-6s %14s %7s  %-*s  %s\n", "addr", "count", "%", BAR_WIDTH, "", "instruction");
+    for (int n = 0; n < HOT_ADDRESSES; n++) {
+        int best = -1;
+        for (int pc = 0; pc < 4096; pc++) {
+            if (!taken[pc] && profile->pc_count[pc] && (best < 0 || profile->pc_count[pc] > profile->pc_count[best])) {
+                best = pc;
+            }
+        }
+        if (best < 0) break;
+        taken[best] = true;
+        const uint64_t count = profile->pc_count[best];
+        if (n == 0) top = count;
+        char bar[BAR_WIDTH + 1];
+        const int length = (int)(count * BAR_WIDTH / top);
+        memset(bar, '#', length);
+        bar[length] = '\0';
+        char text[32];
+        disassemble(chip8->ram[best] << 8 | chip8->ram[(best + 1) & 0x0FFF], text, sizeof text);
+        fprintf(out, "0x%04X %14llu %6.2f%%  %-*s  %s\n", best, (unsigned long long)count,
+            percent(count, total), BAR_WIDTH, bar, text);
+    }
+    fflush(out);
+}
+
+bool profile_write(const profile_t *profile, const chip8_t *chip8, const char *path) {
+    if (strcmp(path, "-") == 0) {
+        profile_dump(profile, chip8, stderr);
+        return true;
+    }
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return false;
+    }
+    profile_dump(profile, chip8, out);
+    return fclose(out) == 0;
+}
@@ -0,0 +1,49 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "./chip8.h"
+#include "./decode.h"
+
+// Execution profiler. Unlike tracing it is compiled out by default, so the hot
+// loop carries no trace of it; build with -DCHIP8_PROFILE (make profile) and
+// set chip8->profile to turn it on. Counts instructions per opcode and per
+// address, sprite work, and the time the frontend spends presenting frames.
+#ifdef CHIP8_PROFILE
+#define CHIP8_PROFILING 1
+#else
+#define CHIP8_PROFILING 0
+#endif
+
+typedef struct profile {
+    uint64_t instructions;
+    uint64_t op_count[OP_COUNT];
+    uint64_t pc_count[4096];
+    uint64_t draw_rows; // Sprite rows actually drawn (clipped rows don't count)
+    uint64_t draw_pixels; // Sprite pixels XORed onto the screen
+    uint64_t draw_collisions; // DXYN that set VF
+    uint64_t screen_updates;
+    uint64_t screen_ns; // Time spent in the frontend's update_screen
+} profile_t;
+
+profile_t *profile_create(void);
+void profile_destroy(profile_t *profile);
+// Flat profile by opcode, sprite and screen stats, and the hottest addresses
+// disassembled from chip8's RAM as it is now.
+void profile_dump(const profile_t *profile, const chip8_t *chip8, FILE *out);
+// profile_dump() into path, or to stderr when path is "-".
+bool profile_write(const profile_t *profile, const chip8_t *chip8, const char *path);
+// SIGUSR1 requests a dump; the frontend polls this once per frame, since
+// writing from the signal handler itself isn't safe.
+void profile_install_signal(void);
+bool profile_dump_requested(void);
+
+static inline void profile_instruction(profile_t *profile, uint16_t pc, uint8_t op) {
+    profile->instructions++;
+    profile->op_count[op]++;
+    profile->pc_count[pc & 0x0FFF]++;
+}
+
+#endif
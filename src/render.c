@@ -0,0 +1,20 @@
+#include "./render.h"
+#include "./simd.h"
+
+void render_rows(const display_row_t rows[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT], bool hires, uint32_t *pixels,
+                 const uint32_t palette[4]) {
+    const uint32_t width = hires ? DISPLAY_HIRES_WIDTH : DISPLAY_WIDTH;
+    const uint32_t height = hires ? DISPLAY_HIRES_HEIGHT : DISPLAY_HEIGHT;
+    const simd_t *simd = simd_get();
+    // Rows are expanded 64 pixels at a time from plain 64 bit words, the width every backend takes.
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t word = 0; word < width / 64; word++) {
+            simd->expand((uint64_t)(rows[0][y] >> (64 - 64 * word)), (uint64_t)(rows[1][y] >> (64 - 64 * word)),
+                         &pixels[y * width + word * 64], palette);
+        }
+    }
+}
+
+void render_display(const chip8_t *chip8, uint32_t *pixels, const uint32_t palette[4]) {
+    render_rows(chip8->display, chip8->hires, pixels, palette);
+}
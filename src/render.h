@@ -0,0 +1,17 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "./chip8.h"
+
+// Expands chip8->display into one 32-bit pixel per CHIP8 pixel (row-major, at
+// the current resolution: 64x32, or 128x64 in hi-res), ready to be uploaded to
+// a streaming texture. palette[] is indexed by a pixel's plane bits: background,
+// first plane, second plane, both.
+void render_display(const chip8_t *chip8, uint32_t *pixels, const uint32_t palette[4]);
+// Same for a copy of the display rows, e.g. a frame handed over from another thread.
+void render_rows(const display_row_t rows[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT], bool hires, uint32_t *pixels,
+                 const uint32_t palette[4]);
+
+#endif
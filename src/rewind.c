@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./rewind.h"
+
+bool rewind_init(rewind_t *rw, uint32_t frames, uint32_t keyframe_interval) {
+    memset(rw, 0, sizeof *rw);
+    if (keyframe_interval == 0) keyframe_interval = 1;
+    rw->keyframe_interval = keyframe_interval;
+    // One extra segment, so dropping the oldest still leaves frames of history behind it
+    rw->segment_count = (frames + keyframe_interval - 1) / keyframe_interval + 1;
+    rw->segments = calloc(rw->segment_count, sizeof *rw->segments);
+    if (!rw->segments) {
+        fprintf(stderr, "Could not allocate the rewind buffer\n");
+        return false;
+    }
+    for (uint32_t s = 0; s < rw->segment_count; s++) {
+        rw->segments[s].ends = malloc(keyframe_interval * sizeof(uint32_t));
+        if (!rw->segments[s].ends) {
+            fprintf(stderr, "Could not allocate the rewind buffer\n");
+            rewind_free(rw);
+            return false;
+        }
+    }
+    return true;
+}
+
+void rewind_free(rewind_t *rw) {
+    for (uint32_t s = 0; s < rw->segment_count; s++) {
+        free(rw->segments[s].key);
+        free(rw->segments[s].deltas);
+        free(rw->segments[s].ends);
+    }
+    free(rw->segments);
+    free(rw->encoded);
+    memset(rw, 0, sizeof *rw);
+}
+
+void rewind_clear(rewind_t *rw) {
+    // Segments are reinitialised as they get reused, so forgetting them is enough
+    rw->first = 0;
+    rw->used = 0;
+}
+
+static rewind_segment_t *newest(rewind_t *rw) {
+    return &rw->segments[(rw->first + rw->used - 1) % rw->segment_count];
+}
+
+// Stores the snapshot in scratch as the keyframe of a new segment.
+static void push_keyframe(rewind_t *rw) {
+    // When full this is the oldest segment, which makes room for the new keyframe
+    rewind_segment_t *seg = &rw->segments[(rw->first + rw->used) % rw->segment_count];
+    const size_t size = snapshot_size(&rw->scratch);
+    if (seg->key_capacity < size) {
+        // Grown before anything is evicted, so a failure leaves the history as it was
+        uint8_t *key = realloc(seg->key, size);
+        if (!key) return; // Losing a frame of history beats stopping the emulator
+        seg->key = key;
+        seg->key_capacity = size;
+    }
+    if (rw->used == rw->segment_count) {
+        rw->first = (rw->first + 1) % rw->segment_count;
+        rw->used--;
+    }
+    memcpy(seg->key, &rw->scratch, size);
+    seg->key_size = size;
+    seg->frames = 1;
+    seg->size = 0;
+    rw->used++;
+}
+
+void rewind_push(rewind_t *rw, const chip8_t *chip8) {
+    snapshot_save(chip8, &rw->scratch);
+    // A delta needs both states the same size, so a change of model starts a new segment too
+    if (rw->used == 0 || newest(rw)->frames == rw->keyframe_interval
+        || newest(rw)->key_size != snapshot_size(&rw->scratch)) {
+        push_keyframe(rw);
+        return;
+    }
+    rewind_segment_t *seg = newest(rw);
+    // Encode into a buffer sized for this state's worst case, then keep only what the delta needed
+    if (rw->encoded_capacity < DELTA_MAX(seg->key_size)) {
+        uint8_t *encoded = realloc(rw->encoded, DELTA_MAX(seg->key_size));
+        if (!encoded) return;
+        rw->encoded = encoded;
+        rw->encoded_capacity = DELTA_MAX(seg->key_size);
+    }
+    const size_t size = snapshot_delta_encode(seg->key, &rw->scratch, rw->encoded);
+    if (seg->capacity - seg->size < size) {
+        const size_t capacity = seg->capacity * 2 > seg->size + size ? seg->capacity * 2 : seg->size + size;
+        uint8_t *deltas = realloc(seg->deltas, capacity);
+        if (!deltas) return;
+        seg->deltas = deltas;
+        seg->capacity = capacity;
+    }
+    memcpy(&seg->deltas[seg->size], rw->encoded, size);
+    seg->size += size;
+    seg->ends[seg->frames - 1] = seg->size;
+    seg->frames++;
+}
+
+bool rewind_pop(rewind_t *rw, chip8_t *chip8) {
+    if (rw->used == 0) return false;
+    rewind_segment_t *seg = newest(rw);
+    const uint32_t frame = --seg->frames;
+    bool ok;
+    memcpy(&rw->scratch, seg->key, seg->key_size);
+    if (frame == 0) {
+        ok = snapshot_load(chip8, &rw->scratch);
+        rw->used--;
+    } else {
+        const size_t start = frame > 1 ? seg->ends[frame - 2] : 0;
+        snapshot_delta_apply(&rw->scratch, &seg->deltas[start], seg->ends[frame - 1] - start);
+        ok = snapshot_load(chip8, &rw->scratch);
+        seg->size = start;
+    }
+    return ok;
+}
+
+uint32_t rewind_frames(const rewind_t *rw) {
+    uint32_t frames = 0;
+    for (uint32_t i = 0; i < rw->used; i++) frames += rw->segments[(rw->first + i) % rw->segment_count].frames;
+    return frames;
+}
+
+size_t rewind_memory(const rewind_t *rw) {
+    size_t bytes = rw->segment_count * (sizeof(rewind_segment_t) + rw->keyframe_interval * sizeof(uint32_t))
+        + rw->encoded_capacity;
+    for (uint32_t s = 0; s < rw->segment_count; s++) bytes += rw->segments[s].key_capacity + rw->segments[s].capacity;
+    return bytes;
+}
@@ -0,0 +1,50 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "./chip8.h"
+#include "./snapshot.h"
+
+// History of recent machine states for stepping backwards. Frames are grouped
+// into segments of keyframe_interval: a full keyframe snapshot followed by the
+// XOR/RLE deltas of the later frames against it, so any frame is one delta away
+// from its keyframe. When the ring is full the oldest segment is dropped whole.
+
+typedef struct {
+    uint8_t *key; // The keyframe's snapshot_size() bytes
+    size_t key_size;
+    size_t key_capacity;
+    uint8_t *deltas; // Encoded deltas of frames 1.. back to back
+    uint32_t *ends; // ends[i - 1] is where frame i's delta stops
+    uint32_t frames; // Frames stored, the keyframe included
+    size_t size;
+    size_t capacity;
+} rewind_segment_t;
+
+typedef struct {
+    rewind_segment_t *segments;
+    uint32_t segment_count;
+    uint32_t keyframe_interval;
+    uint32_t first; // Oldest segment
+    uint32_t used; // Segments holding frames, newest is (first + used - 1) % segment_count
+    chip8_snapshot_t scratch;
+    uint8_t *encoded; // Room for the worst case delta of the newest state, before it is stored
+    size_t encoded_capacity;
+} rewind_t;
+
+// Keeps at least frames frames of history, with a keyframe every keyframe_interval frames.
+bool rewind_init(rewind_t *rw, uint32_t frames, uint32_t keyframe_interval);
+void rewind_free(rewind_t *rw);
+// Drops all history but keeps the memory, e.g. when a different ROM is loaded.
+void rewind_clear(rewind_t *rw);
+void rewind_push(rewind_t *rw, const chip8_t *chip8);
+// Removes the newest frame from the history and loads it into chip8.
+// Returns false once the history is empty.
+bool rewind_pop(rewind_t *rw, chip8_t *chip8);
+uint32_t rewind_frames(const rewind_t *rw);
+// Bytes of history held, for reporting.
+size_t rewind_memory(const rewind_t *rw);
+
+#endif
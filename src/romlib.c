@@ -0,0 +1,188 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "./constants.h"
+#include "./hash.h"
+#include "./romlib.h"
+
+void romlib_init(romlib_t *lib) {
+    *lib = (romlib_t){0};
+}
+
+void romlib_free(romlib_t *lib) {
+    for (size_t i = 0; i < lib->count; i++) {
+        if (lib->roms[i].data) munmap((void *)lib->roms[i].data, lib->roms[i].size);
+        free(lib->roms[i].path);
+    }
+    free(lib->roms);
+    free(lib->by_hash);
+    free(lib->profiles);
+    *lib = (romlib_t){0};
+}
+
+// Index of the first entry of by_hash whose ROM hash is >= hash.
+static size_t hash_lower_bound(const romlib_t *lib, uint64_t hash) {
+    size_t low = 0, high = lib->count;
+    while (low < high) {
+        const size_t mid = (low + high) / 2;
+        if (lib->roms[lib->by_hash[mid]].hash < hash) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Maps the whole file read-only; an empty file has nothing to map.
+static bool map_file(const char *path, const uint8_t **data, size_t *size) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Rom file %s is invalid\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Rom file %s is invalid\n", path);
+        close(fd);
+        return false;
+    }
+    *size = st.st_size;
+    *data = NULL;
+    if (*size) {
+        void *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Could not map rom file %s\n", path);
+            close(fd);
+            return false;
+        }
+        *data = map;
+    }
+    close(fd); // The mapping stays valid without it
+    return true;
+}
+
+long romlib_add(romlib_t *lib, const char *path) {
+    // "x.ch8" and the "./x.ch8" a scan of "." finds are the same file
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Rom file %s is invalid\n", path);
+        return -1;
+    }
+    for (size_t i = 0; i < lib->count; i++) {
+        if (lib->roms[i].dev == st.st_dev && lib->roms[i].ino == st.st_ino) return i;
+    }
+    rom_entry_t rom = {.dev = st.st_dev, .ino = st.st_ino};
+    if (!map_file(path, &rom.data, &rom.size)) return -1;
+    if (lib->count == lib->capacity) {
+        lib->capacity = lib->capacity ? lib->capacity * 2 : 64;
+        lib->roms = realloc(lib->roms, lib->capacity * sizeof *lib->roms);
+        lib->by_hash = realloc(lib->by_hash, lib->capacity * sizeof *lib->by_hash);
+    }
+    rom.path = strdup(path);
+    const char *slash = strrchr(rom.path, '/');
+    rom.name = slash ? slash + 1 : rom.path;
+    rom.hash = fnv1a64(rom.data, rom.size, FNV1A64_INIT);
+    // Keep the hash index sorted as we go; a few thousand ROMs make that a few MB of memmove at most
+    const size_t at = hash_lower_bound(lib, rom.hash);
+    memmove(&lib->by_hash[at + 1], &lib->by_hash[at], (lib->count - at) * sizeof *lib->by_hash);
+    lib->by_hash[at] = lib->count;
+    lib->roms[lib->count] = rom;
+    return lib->count++;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+long romlib_scan(romlib_t *lib, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "ROM directory %s is invalid\n", dir);
+        return -1;
+    }
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    for (struct dirent *entry = readdir(d); entry; entry = readdir(d)) {
+        const size_t length = strlen(entry->d_name);
+        if (length < 4 || strcmp(&entry->d_name[length - 4], ".ch8") != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            names = realloc(names, capacity * sizeof *names);
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof *names, compare_names);
+    const size_t before = lib->count;
+    for (size_t i = 0; i < count; i++) {
+        char path[4096];
+        snprintf(path, sizeof path, "%s/%s", dir, names[i]);
+        romlib_add(lib, path); // An unreadable file is reported and skipped
+        free(names[i]);
+    }
+    free(names);
+    return lib->count - before;
+}
+
+const rom_entry_t *romlib_find(const romlib_t *lib, uint64_t hash) {
+    const size_t at = hash_lower_bound(lib, hash);
+    if (at == lib->count || lib->roms[lib->by_hash[at]].hash != hash) return NULL;
+    return &lib->roms[lib->by_hash[at]];
+}
+
+static int compare_profiles(const void *a, const void *b) {
+    const uint64_t x = ((const rom_profile_entry_t *)a)->hash;
+    const uint64_t y = ((const rom_profile_entry_t *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+bool romlib_load_profiles(romlib_t *lib, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Profiles file %s is invalid\n", path);
+        return false;
+    }
+    char line[1024];
+    unsigned line_number = 0;
+    while (fgets(line, sizeof line, file)) {
+        line_number++;
+        line[strcspn(line, "\r\n#")] = '\0';
+        char *hash = strtok(line, "\t ");
+        if (!hash) continue;
+        char *ips = strtok(NULL, "\t ");
+        char *quirks = strtok(NULL, "\t ");
+        rom_profile_t profile = {.has_quirks = quirks != NULL};
+        char *ips_end;
+        const bool hash_ok = strlen(hash) == 16 && strspn(hash, "0123456789abcdefABCDEF") == 16;
+        const unsigned long ips_value = ips ? strtoul(ips, &ips_end, 0) : 0;
+        // Timers need at least one instruction per tick, so slower clocks are refused too
+        if (!hash_ok || !ips || *ips_end || ips_value < FPS || ips_value > UINT32_MAX
+            || (quirks && !chip8_quirks_by_name(quirks, &profile.quirks))) {
+            fprintf(stderr, "%s:%u: expected '<hash>\\t<instructions per second, at least %d>[\\t<quirk profile>]', "
+                "skipping the line\n", path, line_number, FPS);
+            continue;
+        }
+        profile.insts_per_second = ips_value;
+        lib->profiles = realloc(lib->profiles, (lib->profile_count + 1) * sizeof *lib->profiles);
+        lib->profiles[lib->profile_count++] = (rom_profile_entry_t){
+            .hash = strtoull(hash, NULL, 16),
+            .profile = profile,
+        };
+    }
+    fclose(file);
+    qsort(lib->profiles, lib->profile_count, sizeof *lib->profiles, compare_profiles);
+    return true;
+}
+
+rom_profile_t romlib_profile(const romlib_t *lib, uint64_t hash) {
+    const rom_profile_entry_t key = {.hash = hash};
+    const rom_profile_entry_t *found = bsearch(&key, lib->profiles, lib->profile_count, sizeof key, compare_profiles);
+    return found ? found->profile : (rom_profile_t){0};
+}
+
+bool romlib_load(const rom_entry_t *rom, chip8_t *chip8) {
+    return init_chip8_rom(chip8, rom->path, rom->data, rom->size);
+}
@@ -0,0 +1,65 @@
+#ifndef ROMLIB_H
+#define ROMLIB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "./chip8.h"
+
+// ROM catalog. Files are memory-mapped once and indexed by a hash of their
+// contents, so switching ROMs or running thousands of jobs never goes back to
+// the file system, and per-ROM settings follow a ROM whatever it is called.
+//
+// Profiles file, tab separated, '#' starts a comment:
+//   <content hash, 16 hex digits>\t<instructions per second>[\t<quirk profile>]
+// where the quirk profile is a name chip8_quirks_by_name() knows, e.g. schip.
+
+typedef struct {
+    uint32_t insts_per_second; // 0 = the frontend's own setting
+    bool has_quirks; // False = the frontend's own setting
+    quirks_t quirks;
+} rom_profile_t;
+
+typedef struct {
+    char *path;
+    const char *name; // File name part of path
+    const uint8_t *data; // Read-only mapping, NULL for an empty file
+    size_t size;
+    uint64_t hash; // FNV-1a of the contents
+    dev_t dev; // Identify the file whatever path it was reached by
+    ino_t ino;
+} rom_entry_t;
+
+typedef struct {
+    uint64_t hash;
+    rom_profile_t profile;
+} rom_profile_entry_t;
+
+typedef struct {
+    rom_entry_t *roms; // In the order they were added; a scan adds a directory sorted by name
+    size_t count;
+    size_t capacity;
+    size_t *by_hash; // Indexes into roms, sorted by hash
+    rom_profile_entry_t *profiles; // Sorted by hash
+    size_t profile_count;
+} romlib_t;
+
+void romlib_init(romlib_t *lib);
+void romlib_free(romlib_t *lib);
+// Maps path into the library and returns its index, or -1 when it can't be read.
+// A file that is already in the library, under this or any other path, is not mapped again.
+long romlib_add(romlib_t *lib, const char *path);
+// Adds every *.ch8 file in dir (not recursively). Returns how many ROMs the library
+// gained, or -1 when dir can't be opened.
+long romlib_scan(romlib_t *lib, const char *dir);
+// Returns some ROM with these contents, NULL if there is none.
+const rom_entry_t *romlib_find(const romlib_t *lib, uint64_t hash);
+// Adds the per-ROM settings in path to the library. Malformed lines are reported and skipped.
+bool romlib_load_profiles(romlib_t *lib, const char *path);
+// The settings for the ROM with this hash; all defaults when it has no profile.
+rom_profile_t romlib_profile(const romlib_t *lib, uint64_t hash);
+// init_chip8_rom() from the mapping; chip8->rom_name points into the library.
+bool romlib_load(const rom_entry_t *rom, chip8_t *chip8);
+
+#endif
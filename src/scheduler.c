@@ -0,0 +1,65 @@
+#include "./constants.h"
+#include "./scheduler.h"
+
+void scheduler_init(scheduler_t *sched, uint64_t now, uint64_t freq,
+                    uint32_t insts_per_second, uint32_t frames_per_second) {
+    *sched = (scheduler_t){0};
+    sched->freq = freq;
+    sched->last = now;
+    sched->insts_per_second = insts_per_second;
+    sched->frames_per_second = frames_per_second ? frames_per_second : FPS;
+}
+
+void scheduler_advance(scheduler_t *sched, uint64_t now, uint32_t *instructions,
+                       uint32_t *timer_ticks, bool *present) {
+    uint64_t elapsed = now - sched->last;
+    sched->last = now;
+    sched->total_ticks += elapsed;
+    if (elapsed > sched->max_lag_ticks) sched->max_lag_ticks = elapsed;
+
+    // If the host stalled (or we are simply too slow), running every missed instruction
+    // would only make the next interval longer still. Cap the catch-up and account for
+    // the rest as dropped time instead of spiralling.
+    const uint64_t max_elapsed = sched->freq * MAX_CATCHUP_FRAMES / sched->frames_per_second;
+    if (elapsed > max_elapsed) {
+        sched->dropped_ticks += elapsed - max_elapsed;
+        elapsed = max_elapsed;
+    }
+
+    sched->inst_acc += elapsed * sched->insts_per_second;
+    *instructions = sched->inst_acc / sched->freq;
+    sched->inst_acc %= sched->freq;
+
+    sched->timer_acc += elapsed * FPS; // CHIP8 timers always run at 60Hz
+    *timer_ticks = sched->timer_acc / sched->freq;
+    sched->timer_acc %= sched->freq;
+
+    sched->frame_acc += elapsed * sched->frames_per_second;
+    const uint64_t frames_due = sched->frame_acc / sched->freq;
+    sched->frame_acc %= sched->freq;
+    if (frames_due > 1) sched->late_frames++;
+    *present = frames_due > 0;
+    if (*present) sched->frames++;
+}
+
+void scheduler_resync(scheduler_t *sched, uint64_t now) {
+    sched->last = now;
+}
+
+uint32_t scheduler_ms_until_frame(const scheduler_t *sched, uint64_t now) {
+    const uint64_t since_last = now - sched->last;
+    const uint64_t acc = sched->frame_acc + since_last * sched->frames_per_second;
+    if (acc >= sched->freq) return 0;
+    const uint64_t ticks_left = (sched->freq - acc) / sched->frames_per_second;
+    return ticks_left * 1000 / sched->freq;
+}
+
+void scheduler_report(const scheduler_t *sched, FILE *out) {
+    if (!sched->total_ticks) return;
+    fprintf(out, "scheduler: %llu frames, %llu late, worst interval %.1f ms, "
+        "dropped %.1f ms of %.1f ms (%.2f%% behind real time)\n",
+        (unsigned long long)sched->frames, (unsigned long long)sched->late_frames,
+        sched->max_lag_ticks * 1000.0 / sched->freq,
+        sched->dropped_ticks * 1000.0 / sched->freq, sched->total_ticks * 1000.0 / sched->freq,
+        100.0 * sched->dropped_ticks / sched->total_ticks);
+}
@@ -0,0 +1,45 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Fixed-timestep scheduler. Works purely on counter values handed in by the
+// caller (SDL_GetPerformanceCounter in the frontend), so it has no SDL dependency.
+// Instruction, timer and frame deadlines are kept as integer accumulators, so
+// rounding never makes them drift against the host clock.
+
+#define MAX_CATCHUP_FRAMES 4 // Never try to make up more than this many frames at once
+
+typedef struct {
+    uint64_t freq; // Counter ticks per second
+    uint64_t last; // Counter value at the previous advance
+    uint32_t insts_per_second;
+    uint32_t frames_per_second; // Presentation rate, normally the display refresh rate
+    // Accumulators in units of (counter ticks * rate); one event is due per freq
+    uint64_t inst_acc;
+    uint64_t timer_acc;
+    uint64_t frame_acc;
+    // Stats for sizing hosts
+    uint64_t frames; // Frames presented
+    uint64_t late_frames; // Advances that had more than one frame of work due
+    uint64_t dropped_ticks; // Host time we gave up on catching up with
+    uint64_t max_lag_ticks; // Worst single advance interval seen
+    uint64_t total_ticks; // Host time covered by all advances
+} scheduler_t;
+
+void scheduler_init(scheduler_t *sched, uint64_t now, uint64_t freq,
+                    uint32_t insts_per_second, uint32_t frames_per_second);
+// Advances to now and returns how many instructions and 60Hz timer ticks are
+// due, and whether a frame should be presented.
+void scheduler_advance(scheduler_t *sched, uint64_t now, uint32_t *instructions,
+                       uint32_t *timer_ticks, bool *present);
+// Forgets about time that passed while we weren't running (e.g. paused).
+void scheduler_resync(scheduler_t *sched, uint64_t now);
+// Milliseconds until the next frame is due, for sleeping the host thread.
+uint32_t scheduler_ms_until_frame(const scheduler_t *sched, uint64_t now);
+// Prints how far behind real time the emulator has been.
+void scheduler_report(const scheduler_t *sched, FILE *out);
+
+#endif
@@ -0,0 +1,675 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "./constants.h"
+#include "./chip8.h"
+#include "./export.h"
+#include "./scheduler.h"
+#include "./server.h"
+#include "./snapshot.h"
+
+// Session server: many chip8_t sessions in one process, without SDL. One I/O
+// thread owns the socket and every connection; a fixed pool of workers runs
+// whichever session's next frame is due first and queues the encoded frame on
+// its connection for the I/O thread to send. See server.h for the protocol.
+//
+// Locking: the pool lock guards the run queue and each session's scheduling
+// fields. A session's own lock is held while a worker runs its frame and while
+// the I/O thread applies input or takes or restores a snapshot. A connection's
+// lock guards its output buffer. Session locks are taken before connection
+// locks, and the pool lock is never held together with either.
+
+#define SERVER_DEFAULT_MAX_SESSIONS 4096
+#define SERVER_OUT_LIMIT (4u << 20) // Frames for a connection beyond this are dropped until it catches up
+#define FRAME_NS(n) ((n) * 1000000000ull / FPS)
+
+typedef struct connection {
+    int fd;
+    _Atomic uint32_t refs; // The I/O thread's own, plus one per session
+    pthread_mutex_t lock;
+    bool closed; // The socket is gone, anything queued from now on is thrown away
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    // I/O thread only
+    uint8_t *in;
+    size_t in_len;
+    size_t in_cap;
+} connection_t;
+
+typedef struct {
+    uint32_t id;
+    connection_t *conn;
+    pthread_mutex_t lock;
+    chip8_t chip8;
+    config_t config;
+    bool registers;
+    // Frame stream, like export.c's: the display as of the last frame queued
+    display_row_t base[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT];
+    bool base_hires;
+    bool base_valid; // False until the first frame, after a drop and after a restore
+    uint64_t base_cycles;
+    uint64_t frames;
+    // Scheduling, under the pool lock. Deadlines are epoch + FRAME_NS(ticks), so they never drift.
+    uint64_t epoch_ns;
+    uint64_t ticks;
+    int32_t heap_index; // Position in the run queue, -1 while a worker has it
+    bool closing; // Destroyed while a worker had it; the worker frees it
+} session_t;
+
+typedef struct {
+    const char *socket_path;
+    uint32_t worker_count;
+    uint32_t max_sessions;
+    // Run queue: a min-heap of sessions by next deadline
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // Signalled when the earliest deadline may have moved
+    session_t **heap;
+    uint32_t heap_count;
+    bool stop;
+    // Session table, I/O thread only. Ids are generation << 16 | slot, so a stale id never matches.
+    session_t **table;
+    uint16_t *generation;
+    uint32_t session_count;
+    connection_t **conns;
+    uint32_t conn_count;
+    int listen_fd;
+    int wake[2]; // Workers write a byte here when a connection has output waiting
+    uint64_t start_ns;
+    // Stats
+    _Atomic uint64_t frames;
+    _Atomic uint64_t late_frames; // Run more than a frame after their deadline
+    _Atomic uint64_t dropped_frames; // Not queued because the client wasn't reading
+    uint64_t sessions_created;
+} server_t;
+
+static server_t server;
+static volatile sig_atomic_t stop_requested;
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t due_ns(const session_t *s) {
+    return s->epoch_ns + FRAME_NS(s->ticks);
+}
+
+// Run queue, all under server.lock.
+
+static void heap_swap(uint32_t a, uint32_t b) {
+    session_t *tmp = server.heap[a];
+    server.heap[a] = server.heap[b];
+    server.heap[b] = tmp;
+    server.heap[a]->heap_index = a;
+    server.heap[b]->heap_index = b;
+}
+
+static void heap_sift_up(uint32_t i) {
+    while (i > 0 && due_ns(server.heap[(i - 1) / 2]) > due_ns(server.heap[i])) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_sift_down(uint32_t i) {
+    for (;;) {
+        const uint32_t left = 2 * i + 1, right = left + 1;
+        uint32_t smallest = i;
+        if (left < server.heap_count && due_ns(server.heap[left]) < due_ns(server.heap[smallest])) smallest = left;
+        if (right < server.heap_count && due_ns(server.heap[right]) < due_ns(server.heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_push(session_t *s) {
+    s->heap_index = server.heap_count;
+    server.heap[server.heap_count++] = s;
+    heap_sift_up(s->heap_index);
+    if (s->heap_index == 0) pthread_cond_signal(&server.cond); // New earliest deadline
+}
+
+static void heap_remove(session_t *s) {
+    const uint32_t i = s->heap_index;
+    server.heap_count--;
+    if (i != server.heap_count) {
+        heap_swap(i, server.heap_count);
+        heap_sift_down(i);
+        heap_sift_up(i);
+    }
+    s->heap_index = -1;
+}
+
+// Connections
+
+static void conn_unref(connection_t *conn) {
+    if (atomic_fetch_sub(&conn->refs, 1) != 1) return;
+    pthread_mutex_destroy(&conn->lock);
+    free(conn->out);
+    free(conn->in);
+    free(conn);
+}
+
+// Queues a message for the I/O thread to send. Frames (droppable) are refused
+// while the connection is SERVER_OUT_LIMIT behind; replies never are.
+static bool conn_queue(connection_t *conn, const uint8_t *data, size_t len, bool droppable) {
+    pthread_mutex_lock(&conn->lock);
+    if (conn->closed || (droppable && conn->out_len + len > SERVER_OUT_LIMIT)) {
+        pthread_mutex_unlock(&conn->lock);
+        return false;
+    }
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : 4096;
+        while (cap < conn->out_len + len) cap *= 2;
+        uint8_t *out = realloc(conn->out, cap);
+        if (!out) {
+            pthread_mutex_unlock(&conn->lock);
+            return false;
+        }
+        conn->out = out;
+        conn->out_cap = cap;
+    }
+    const bool was_empty = conn->out_len == 0;
+    memcpy(&conn->out[conn->out_len], data, len);
+    conn->out_len += len;
+    pthread_mutex_unlock(&conn->lock);
+    if (was_empty) {
+        const uint8_t byte = 0;
+        const ssize_t woken = write(server.wake[1], &byte, 1);
+        (void)woken; // A full pipe means the I/O thread is already due to wake up
+    }
+    return true;
+}
+
+static void send_reply(connection_t *conn, uint8_t type, const uint8_t *payload, uint32_t size) {
+    uint8_t header[SERVER_HEADER_SIZE];
+    server_put_header(header, type, size);
+    // Header and payload go in one piece so a worker's frame can't land in between
+    uint8_t *message = malloc(sizeof header + size);
+    if (!message) return;
+    memcpy(message, header, sizeof header);
+    if (size) memcpy(&message[sizeof header], payload, size);
+    conn_queue(conn, message, sizeof header + size, false);
+    free(message);
+}
+
+static void send_ok(connection_t *conn, uint8_t request, uint32_t id) {
+    uint8_t payload[5] = {request};
+    server_put_u32(&payload[1], id);
+    send_reply(conn, SERVER_OK, payload, sizeof payload);
+}
+
+static void send_error(connection_t *conn, uint8_t request, const char *message) {
+    uint8_t payload[128] = {request};
+    const size_t len = strlen(message) < sizeof payload - 1 ? strlen(message) : sizeof payload - 1;
+    memcpy(&payload[1], message, len);
+    send_reply(conn, SERVER_ERROR, payload, 1 + len);
+}
+
+// Sessions
+
+static void free_session(session_t *s) {
+    conn_unref(s->conn);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+// Runs one frame of s and queues it on its connection.
+static void run_frame(session_t *s, uint64_t due) {
+    uint8_t message[SERVER_HEADER_SIZE + 12 + EXPORT_RECORD_MAX];
+    pthread_mutex_lock(&s->lock);
+    run_cycles(&s->chip8, &s->config, chip8_next_tick(s->chip8.cycles, s->config.insts_per_second) - s->chip8.cycles);
+    s->frames++;
+    const bool keyframe = !s->base_valid || s->base_hires != s->chip8.hires
+        || (s->frames - 1) % EXPORT_KEYFRAME_INTERVAL == 0;
+    const uint8_t flags = (keyframe ? EXPORT_KEYFRAME : 0) | (s->registers ? EXPORT_REGISTERS : 0);
+    size_t len = SERVER_HEADER_SIZE;
+    server_put_u32(&message[len], s->id);
+    server_put_u64(&message[len + 4], due);
+    len += 12;
+    len += export_encode_record(&s->chip8, s->base, s->frames, s->base_cycles, flags, &message[len]);
+    server_put_header(message, SERVER_FRAME, len - SERVER_HEADER_SIZE);
+    if (conn_queue(s->conn, message, len, true)) {
+        memcpy(s->base, s->chip8.display, sizeof s->base);
+        s->base_hires = s->chip8.hires;
+        s->base_cycles = s->chip8.cycles;
+        s->base_valid = true;
+    } else {
+        s->base_valid = false; // The client never sees this frame, so don't encode against it
+        server.dropped_frames++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    server.frames++;
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&server.lock);
+    while (!server.stop) {
+        if (!server.heap_count) {
+            pthread_cond_wait(&server.cond, &server.lock);
+            continue;
+        }
+        session_t *s = server.heap[0];
+        const uint64_t due = due_ns(s);
+        uint64_t now = now_ns();
+        if (due > now) {
+            const struct timespec until = {.tv_sec = due / 1000000000ull, .tv_nsec = due % 1000000000ull};
+            pthread_cond_timedwait(&server.cond, &server.lock, &until);
+            continue;
+        }
+        heap_remove(s);
+        if (server.heap_count) pthread_cond_signal(&server.cond); // Someone else may be needed for the rest
+        pthread_mutex_unlock(&server.lock);
+        run_frame(s, due);
+        if (now - due > FRAME_NS(1)) server.late_frames++;
+        pthread_mutex_lock(&server.lock);
+        if (s->closing) {
+            pthread_mutex_unlock(&server.lock);
+            free_session(s);
+            pthread_mutex_lock(&server.lock);
+            continue;
+        }
+        s->ticks++;
+        // Like the frontend's scheduler, give up on time we can't make up
+        now = now_ns();
+        if (now > due_ns(s) + FRAME_NS(MAX_CATCHUP_FRAMES)) {
+            s->epoch_ns = now;
+            s->ticks = 0;
+        }
+        heap_push(s);
+    }
+    pthread_mutex_unlock(&server.lock);
+    return NULL;
+}
+
+static session_t *find_session(connection_t *conn, uint32_t id) {
+    const uint32_t slot = id & 0xFFFF;
+    if (slot >= server.max_sessions) return NULL;
+    session_t *s = server.table[slot];
+    return s && s->id == id && s->conn == conn ? s : NULL;
+}
+
+static void destroy_session(session_t *s) {
+    server.table[s->id & 0xFFFF] = NULL;
+    server.session_count--;
+    pthread_mutex_lock(&server.lock);
+    const bool queued = s->heap_index >= 0;
+    if (queued) heap_remove(s);
+    else s->closing = true; // A worker is running it right now
+    pthread_mutex_unlock(&server.lock);
+    if (queued) free_session(s);
+}
+
+static void handle_create(connection_t *conn, const uint8_t *payload, uint32_t size) {
+    if (size < 10 || size < 10u + payload[9]) {
+        send_error(conn, SERVER_CREATE, "truncated request");
+        return;
+    }
+    char quirks_name[32] = "chip8";
+    if (payload[9]) {
+        if (payload[9] >= sizeof quirks_name) {
+            send_error(conn, SERVER_CREATE, "unknown quirk profile");
+            return;
+        }
+        memcpy(quirks_name, &payload[10], payload[9]);
+        quirks_name[payload[9]] = '\0';
+    }
+    uint32_t slot = 0;
+    while (slot < server.max_sessions && server.table[slot]) slot++;
+    if (slot == server.max_sessions) {
+        send_error(conn, SERVER_CREATE, "too many sessions");
+        return;
+    }
+    session_t *s = calloc(1, sizeof *s);
+    if (!s) {
+        send_error(conn, SERVER_CREATE, "out of memory");
+        return;
+    }
+    if (!chip8_quirks_by_name(quirks_name, &s->chip8.quirks)) {
+        send_error(conn, SERVER_CREATE, "unknown quirk profile");
+        free(s);
+        return;
+    }
+    const uint8_t *rom = &payload[10 + payload[9]];
+    if (!init_chip8_rom(&s->chip8, "session", rom, size - 10 - payload[9])) {
+        send_error(conn, SERVER_CREATE, "ROM doesn't fit in memory");
+        free(s);
+        return;
+    }
+    chip8_seed(&s->chip8, server_get_u32(payload));
+    const uint32_t ips = server_get_u32(&payload[4]);
+    s->config = (config_t){.window_width = 64, .window_height = 32, .scale_factor = 1,
+                           .insts_per_second = ips >= FPS ? ips : INSTRUCTIONS_PER_SECOND, .skip_idle = true};
+    s->registers = payload[8] & SERVER_REGISTERS;
+    pthread_mutex_init(&s->lock, NULL);
+    if (!++server.generation[slot]) server.generation[slot] = 1; // Ids are never 0
+    s->id = (uint32_t)server.generation[slot] << 16 | slot;
+    s->conn = conn;
+    atomic_fetch_add(&conn->refs, 1);
+    server.table[slot] = s;
+    server.session_count++;
+    server.sessions_created++;
+    uint8_t reply[4];
+    server_put_u32(reply, s->id);
+    send_reply(conn, SERVER_CREATED, reply, sizeof reply);
+    pthread_mutex_lock(&server.lock);
+    s->epoch_ns = now_ns();
+    s->ticks = 1; // The first frame is due one frame from now
+    heap_push(s);
+    pthread_mutex_unlock(&server.lock);
+}
+
+static void handle_stats(connection_t *conn) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const uint64_t cpu_ns = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull
+        + (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+    uint8_t reply[48];
+    server_put_u64(reply, cpu_ns);
+    server_put_u64(&reply[8], now_ns() - server.start_ns);
+    server_put_u32(&reply[16], server.session_count);
+    server_put_u32(&reply[20], server.worker_count);
+    server_put_u64(&reply[24], server.frames);
+    server_put_u64(&reply[32], server.late_frames);
+    server_put_u64(&reply[40], server.dropped_frames);
+    send_reply(conn, SERVER_STATS_DATA, reply, sizeof reply);
+}
+
+// Handles one request; returns false when it was malformed beyond an error reply.
+static bool handle_message(connection_t *conn, uint8_t type, const uint8_t *payload, uint32_t size) {
+    if (type == SERVER_CREATE) {
+        handle_create(conn, payload, size);
+        return true;
+    }
+    if (type == SERVER_STATS) {
+        handle_stats(conn);
+        return true;
+    }
+    if (size < 4) return false;
+    const uint32_t id = server_get_u32(payload);
+    session_t *s = find_session(conn, id);
+    if (!s) {
+        send_error(conn, type, "no such session");
+        return true;
+    }
+    switch (type) {
+        case SERVER_INPUT:
+            if (size < 6) return false;
+            pthread_mutex_lock(&s->lock);
+            s->chip8.keypad[payload[4] & 0x0F] = payload[5] != 0;
+            pthread_mutex_unlock(&s->lock);
+            break;
+        case SERVER_SNAPSHOT: {
+            chip8_snapshot_t *snap = malloc(sizeof *snap);
+            uint8_t *reply = malloc(4 + sizeof *snap);
+            if (snap && reply) {
+                pthread_mutex_lock(&s->lock);
+                snapshot_save(&s->chip8, snap);
+                pthread_mutex_unlock(&s->lock);
+                server_put_u32(reply, id);
+                memcpy(&reply[4], snap, snapshot_size(snap));
+                send_reply(conn, SERVER_SNAPSHOT_DATA, reply, 4 + snapshot_size(snap));
+            } else {
+                send_error(conn, type, "out of memory");
+            }
+            free(snap);
+            free(reply);
+            break;
+        }
+        case SERVER_RESTORE: {
+            if (size < 4 + SNAPSHOT_HEADER_SIZE || size > 4 + sizeof(chip8_snapshot_t)) {
+                send_error(conn, type, "not a snapshot");
+                break;
+            }
+            chip8_snapshot_t *snap = malloc(sizeof *snap);
+            if (!snap) {
+                send_error(conn, type, "out of memory");
+                break;
+            }
+            memcpy(snap, &payload[4], size - 4);
+            if (snapshot_size(snap) != size - 4) {
+                free(snap);
+                send_error(conn, type, "snapshot size does not match its model");
+                break;
+            }
+            pthread_mutex_lock(&s->lock);
+            const bool loaded = snapshot_load(&s->chip8, snap);
+            s->base_valid = false; // The display jumped, start the stream over with a keyframe
+            pthread_mutex_unlock(&s->lock);
+            free(snap);
+            if (loaded) send_ok(conn, type, id);
+            else send_error(conn, type, "snapshot version mismatch or corrupt snapshot");
+            break;
+        }
+        case SERVER_DESTROY:
+            destroy_session(s);
+            send_ok(conn, type, id);
+            break;
+        default:
+            send_error(conn, type, "unknown request");
+            break;
+    }
+    return true;
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void close_connection(uint32_t index) {
+    connection_t *conn = server.conns[index];
+    for (uint32_t slot = 0; slot < server.max_sessions; slot++) {
+        if (server.table[slot] && server.table[slot]->conn == conn) destroy_session(server.table[slot]);
+    }
+    pthread_mutex_lock(&conn->lock);
+    conn->closed = true;
+    conn->out_len = 0;
+    pthread_mutex_unlock(&conn->lock);
+    close(conn->fd);
+    server.conns[index] = server.conns[--server.conn_count];
+    conn_unref(conn);
+}
+
+static void accept_connections(void) {
+    for (;;) {
+        const int fd = accept(server.listen_fd, NULL, NULL);
+        if (fd < 0) return;
+        connection_t *conn = calloc(1, sizeof *conn);
+        connection_t **conns = realloc(server.conns, (server.conn_count + 1) * sizeof *conns);
+        if (!conn || !conns) {
+            free(conn);
+            close(fd);
+            return;
+        }
+        set_nonblocking(fd);
+        conn->fd = fd;
+        conn->refs = 1;
+        pthread_mutex_init(&conn->lock, NULL);
+        server.conns = conns;
+        server.conns[server.conn_count++] = conn;
+    }
+}
+
+// Reads what's there and handles every complete message; false = close the connection.
+static bool read_connection(connection_t *conn) {
+    for (;;) {
+        if (conn->in_cap - conn->in_len < 4096) {
+            const size_t cap = conn->in_cap ? conn->in_cap * 2 : 65536;
+            if (cap > 2 * (SERVER_HEADER_SIZE + SERVER_MAX_PAYLOAD)) return false;
+            uint8_t *in = realloc(conn->in, cap);
+            if (!in) return false;
+            conn->in = in;
+            conn->in_cap = cap;
+        }
+        const ssize_t n = recv(conn->fd, &conn->in[conn->in_len], conn->in_cap - conn->in_len, 0);
+        if (n == 0) return false;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        conn->in_len += n;
+        size_t pos = 0;
+        long size;
+        while ((size = server_message_size(&conn->in[pos], conn->in_len - pos)) > 0) {
+            const uint8_t *message = &conn->in[pos];
+            if (!handle_message(conn, message[4], &message[SERVER_HEADER_SIZE], size - SERVER_HEADER_SIZE)) return false;
+            pos += size;
+        }
+        if (size < 0) return false;
+        memmove(conn->in, &conn->in[pos], conn->in_len - pos);
+        conn->in_len -= pos;
+    }
+}
+
+// Sends as much queued output as the socket takes; false = close the connection.
+static bool flush_connection(connection_t *conn) {
+    bool ok = true;
+    pthread_mutex_lock(&conn->lock);
+    size_t sent = 0;
+    while (sent < conn->out_len) {
+        const ssize_t n = send(conn->fd, &conn->out[sent], conn->out_len - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            ok = errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            break;
+        }
+        sent += n;
+    }
+    memmove(conn->out, &conn->out[sent], conn->out_len - sent);
+    conn->out_len -= sent;
+    pthread_mutex_unlock(&conn->lock);
+    return ok;
+}
+
+static void io_loop(void) {
+    struct pollfd *fds = NULL;
+    while (!stop_requested) {
+        struct pollfd *grown = realloc(fds, (server.conn_count + 2) * sizeof *fds);
+        if (!grown) break;
+        fds = grown;
+        fds[0] = (struct pollfd){.fd = server.listen_fd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = server.wake[0], .events = POLLIN};
+        for (uint32_t i = 0; i < server.conn_count; i++) {
+            connection_t *conn = server.conns[i];
+            pthread_mutex_lock(&conn->lock);
+            const bool pending = conn->out_len > 0;
+            pthread_mutex_unlock(&conn->lock);
+            fds[i + 2] = (struct pollfd){.fd = conn->fd, .events = POLLIN | (pending ? POLLOUT : 0)};
+        }
+        const uint32_t polled = server.conn_count;
+        if (poll(fds, polled + 2, 200) < 0 && errno != EINTR) break;
+        if (fds[1].revents & POLLIN) {
+            uint8_t drain[256];
+            while (read(server.wake[0], drain, sizeof drain) > 0) continue;
+        }
+        // Backwards, so closing one only moves connections that were already handled
+        for (uint32_t i = polled; i-- > 0;) {
+            connection_t *conn = server.conns[i];
+            bool ok = true;
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) ok = read_connection(conn);
+            if (ok) ok = flush_connection(conn);
+            if (!ok) close_connection(i);
+        }
+        if (fds[0].revents & POLLIN) accept_connections();
+    }
+    free(fds);
+}
+
+static bool open_socket(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path); // A socket left behind by a previous run
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr *)&addr, sizeof addr) != 0
+        || listen(server.listen_fd, 64) != 0) {
+        fprintf(stderr, "Could not listen on %s\n", path);
+        return false;
+    }
+    set_nonblocking(server.listen_fd);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    server.socket_path = SERVER_DEFAULT_SOCKET;
+    server.worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    server.max_sessions = SERVER_DEFAULT_MAX_SESSIONS;
+    bool valid = true;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) valid = false;
+        else if (strcmp(argv[i], "--socket") == 0) server.socket_path = argv[++i];
+        else if (strcmp(argv[i], "--workers") == 0) server.worker_count = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--max-sessions") == 0) server.max_sessions = strtoul(argv[++i], NULL, 0);
+        else valid = false;
+    }
+    if (!valid || server.max_sessions > 0x10000) {
+        fprintf(stderr, "Usage %s [--socket PATH] [--workers N] [--max-sessions N]\n"
+            "  --socket PATH       Unix domain socket to listen on (default %s)\n"
+            "  --workers N         emulation threads (default: one per core)\n"
+            "  --max-sessions N    at most N sessions at once, up to 65536 (default %d)\n",
+            argv[0], SERVER_DEFAULT_SOCKET, SERVER_DEFAULT_MAX_SESSIONS);
+        exit(EXIT_FAILURE);
+    }
+    if (server.worker_count < 1) server.worker_count = 1;
+    server.heap = calloc(server.max_sessions, sizeof *server.heap);
+    server.table = calloc(server.max_sessions, sizeof *server.table);
+    server.generation = calloc(server.max_sessions, sizeof *server.generation);
+    if (!server.heap || !server.table || !server.generation || pipe(server.wake) != 0) exit(EXIT_FAILURE);
+    set_nonblocking(server.wake[0]);
+    set_nonblocking(server.wake[1]);
+    if (!open_socket(server.socket_path)) exit(EXIT_FAILURE);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // Deadlines are CLOCK_MONOTONIC
+    pthread_cond_init(&server.cond, &attr);
+    pthread_mutex_init(&server.lock, NULL);
+    server.start_ns = now_ns();
+    pthread_t *workers = calloc(server.worker_count, sizeof *workers);
+    for (uint32_t w = 0; w < server.worker_count; w++) pthread_create(&workers[w], NULL, worker_main, NULL);
+    fprintf(stderr, "chip8server: listening on %s with %u workers\n", server.socket_path, server.worker_count);
+
+    io_loop();
+
+    pthread_mutex_lock(&server.lock);
+    server.stop = true;
+    pthread_cond_broadcast(&server.cond);
+    pthread_mutex_unlock(&server.lock);
+    for (uint32_t w = 0; w < server.worker_count; w++) pthread_join(workers[w], NULL);
+    while (server.conn_count) close_connection(server.conn_count - 1);
+    close(server.listen_fd);
+    unlink(server.socket_path);
+    fprintf(stderr, "chip8server: %llu sessions served, %llu frames, %llu late, %llu dropped\n",
+        (unsigned long long)server.sessions_created, (unsigned long long)server.frames,
+        (unsigned long long)server.late_frames, (unsigned long long)server.dropped_frames);
+    free(workers);
+    free(server.heap);
+    free(server.table);
+    free(server.generation);
+    free(server.conns);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire protocol of chip8server, which hosts many emulator sessions in one
+// process behind a Unix domain stream socket. Every message is
+//   u32le payload size, u8 type, payload
+// with all integers little endian. A connection owns the sessions it created;
+// closing it destroys them. Requests are answered in order, and frames of the
+// connection's sessions are interleaved with the replies as they are produced.
+//
+// Client to server:
+//   CREATE    u32 seed, u32 instructions per second (0 = default), u8 flags (SERVER_REGISTERS),
+//             u8 quirk profile name length, the name (empty = chip8), then the ROM itself
+//             -> CREATED u32 session
+//   INPUT     u32 session, u8 key, u8 pressed; applied before the session's next frame, no reply
+//   SNAPSHOT  u32 session -> SNAPSHOT_DATA u32 session, snapshot_size() bytes of chip8_snapshot_t
+//             (host byte order, as on disk)
+//   RESTORE   u32 session, the same snapshot bytes -> OK
+//   DESTROY   u32 session -> OK
+//   STATS     -> STATS_DATA u64 server CPU time in ns, u64 uptime in ns, u32 sessions,
+//             u32 workers, u64 frames, u64 late frames, u64 dropped frames
+// Server to client:
+//   OK        u8 request type, u32 session
+//   ERROR     u8 request type, then a message (not NUL terminated)
+//   FRAME     u32 session, u64 CLOCK_MONOTONIC time in ns the frame was due, then one
+//             record of the export stream format (see export.h). Each session is its own
+//             stream; the first record and any after a dropped one are keyframes.
+//
+// Each session runs in real time: 60 frames per second, each frame running up
+// to and including the next tick of the timers (see chip8_next_tick()).
+
+#define SERVER_DEFAULT_SOCKET "/tmp/chip8server.sock"
+#define SERVER_HEADER_SIZE 5
+#define SERVER_MAX_PAYLOAD (256u << 10) // Comfortably above a snapshot or the largest XO-CHIP ROM
+
+typedef enum {
+    SERVER_CREATE = 0x01,
+    SERVER_INPUT = 0x02,
+    SERVER_SNAPSHOT = 0x03,
+    SERVER_RESTORE = 0x04,
+    SERVER_DESTROY = 0x05,
+    SERVER_STATS = 0x06,
+    SERVER_OK = 0x80,
+    SERVER_ERROR = 0x81,
+    SERVER_CREATED = 0x82,
+    SERVER_SNAPSHOT_DATA = 0x83,
+    SERVER_STATS_DATA = 0x84,
+    SERVER_FRAME = 0x85,
+} server_message_t;
+
+// CREATE flags
+#define SERVER_REGISTERS 0x01 // Include registers and timers in every frame
+
+static inline void server_put_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = value >> (8 * i);
+}
+
+static inline void server_put_u64(uint8_t *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out[i] = value >> (8 * i);
+}
+
+static inline uint32_t server_get_u32(const uint8_t *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)in[i] << (8 * i);
+    return value;
+}
+
+static inline uint64_t server_get_u64(const uint8_t *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+// Writes a message header and returns its size.
+static inline size_t server_put_header(uint8_t *out, uint8_t type, uint32_t payload_size) {
+    server_put_u32(out, payload_size);
+    out[4] = type;
+    return SERVER_HEADER_SIZE;
+}
+
+// Size of the complete message at the start of buffer, 0 while more bytes are
+// needed, or -1 when it claims more than SERVER_MAX_PAYLOAD.
+static inline long server_message_size(const uint8_t *buffer, size_t len) {
+    if (len < SERVER_HEADER_SIZE) return 0;
+    const uint32_t payload = server_get_u32(buffer);
+    if (payload > SERVER_MAX_PAYLOAD) return -1;
+    return len >= SERVER_HEADER_SIZE + (size_t)payload ? (long)(SERVER_HEADER_SIZE + payload) : 0;
+}
+
+#endif
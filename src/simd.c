@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Display rows are stored as host integers, so on these (little endian) hosts
+// the low 64 bits, the right half of the screen, come first in memory.
+
+// Each plane bit (-1 when set, 0 when not) XORs in what it changes about the
+// background color, which keeps the select branchless in every backend.
+static void palette_terms(const uint32_t palette[4], uint32_t terms[4]) {
+    terms[0] = palette[0];
+    terms[1] = palette[0] ^ palette[1];
+    terms[2] = palette[0] ^ palette[2];
+    terms[3] = terms[1] ^ terms[2] ^ palette[0] ^ palette[3];
+}
+
+static void expand_scalar(uint64_t bits0, uint64_t bits1, uint32_t out[64], const uint32_t palette[4]) {
+    uint32_t terms[4];
+    palette_terms(palette, terms);
+    if (!bits1) { // Anything but XO-CHIP's second plane: the cheaper two color select
+        for (uint32_t x = 0; x < 64; x++) out[x] = terms[0] ^ (terms[1] & -(uint32_t)(bits0 >> (63 - x) & 1));
+        return;
+    }
+    for (uint32_t x = 0; x < 64; x++) {
+        const uint32_t bit0 = -(uint32_t)(bits0 >> (63 - x) & 1);
+        const uint32_t bit1 = -(uint32_t)(bits1 >> (63 - x) & 1);
+        out[x] = terms[0] ^ (terms[1] & bit0) ^ (terms[2] & bit1) ^ (terms[3] & bit0 & bit1);
+    }
+}
+
+static display_row_t xor_rows_scalar(display_row_t *rows, const display_row_t *sprite, uint32_t count) {
+    display_row_t collision = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        collision |= rows[i] & sprite[i];
+        rows[i] ^= sprite[i];
+    }
+    return collision;
+}
+
+static void shift_rows_scalar(display_row_t *rows, uint32_t count, bool right, display_row_t mask) {
+    for (uint32_t i = 0; i < count; i++) rows[i] = (right ? rows[i] >> 4 : rows[i] << 4) & mask;
+}
+
+static const simd_t scalar_backend = {"scalar", expand_scalar, xor_rows_scalar, shift_rows_scalar};
+
+#if SIMD_X86
+// Four pixels per vector: a nibble of plane bits is broadcast and each lane
+// tests its own bit, the first pixel being the nibble's top bit.
+__attribute__((target("sse2")))
+static void expand_sse2(uint64_t bits0, uint64_t bits1, uint32_t out[64], const uint32_t palette[4]) {
+    uint32_t terms[4];
+    palette_terms(palette, terms);
+    const __m128i bg = _mm_set1_epi32(terms[0]);
+    const __m128i first = _mm_set1_epi32(terms[1]);
+    const __m128i second = _mm_set1_epi32(terms[2]);
+    const __m128i both = _mm_set1_epi32(terms[3]);
+    const __m128i select = _mm_setr_epi32(8, 4, 2, 1);
+    for (uint32_t x = 0; x < 64; x += 4) {
+        const __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits0 >> (60 - x) & 0xF), select), select);
+        __m128i pixels = _mm_xor_si128(bg, _mm_and_si128(first, m0));
+        if (bits1) {
+            const __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits1 >> (60 - x) & 0xF), select), select);
+            pixels = _mm_xor_si128(pixels, _mm_and_si128(second, m1));
+            pixels = _mm_xor_si128(pixels, _mm_and_si128(both, _mm_and_si128(m0, m1)));
+        }
+        _mm_storeu_si128((__m128i *)&out[x], pixels);
+    }
+}
+
+// One display row is exactly one vector.
+__attribute__((target("sse2")))
+static display_row_t xor_rows_sse2(display_row_t *rows, const display_row_t *sprite, uint32_t count) {
+    __m128i collision = _mm_setzero_si128();
+    for (uint32_t i = 0; i < count; i++) {
+        const __m128i row = _mm_loadu_si128((const __m128i *)&rows[i]);
+        const __m128i bits = _mm_loadu_si128((const __m128i *)&sprite[i]);
+        collision = _mm_or_si128(collision, _mm_and_si128(row, bits));
+        _mm_storeu_si128((__m128i *)&rows[i], _mm_xor_si128(row, bits));
+    }
+    display_row_t result;
+    _mm_storeu_si128((__m128i *)&result, collision);
+    return result;
+}
+
+// There is no 128 bit bit shift: shift both halves and carry the 4 bits that
+// cross between them over with a byte shift of the whole row.
+__attribute__((target("sse2")))
+static inline __m128i shift_row_sse2(__m128i row, bool right) {
+    return right ? _mm_or_si128(_mm_srli_epi64(row, 4), _mm_slli_epi64(_mm_srli_si128(row, 8), 60))
+                 : _mm_or_si128(_mm_slli_epi64(row, 4), _mm_srli_epi64(_mm_slli_si128(row, 8), 60));
+}
+
+__attribute__((target("sse2")))
+static void shift_rows_sse2(display_row_t *rows, uint32_t count, bool right, display_row_t mask) {
+    const __m128i keep = _mm_loadu_si128((const __m128i *)&mask);
+    for (uint32_t i = 0; i < count; i++) {
+        const __m128i row = _mm_loadu_si128((const __m128i *)&rows[i]);
+        _mm_storeu_si128((__m128i *)&rows[i], _mm_and_si128(shift_row_sse2(row, right), keep));
+    }
+}
+
+// Eight pixels per vector: a byte of plane bits is broadcast and each lane
+// shifts its own bit up to the sign, which the arithmetic shift then spreads.
+__attribute__((target("avx2")))
+static void expand_avx2(uint64_t bits0, uint64_t bits1, uint32_t out[64], const uint32_t palette[4]) {
+    uint32_t terms[4];
+    palette_terms(palette, terms);
+    const __m256i bg = _mm256_set1_epi32(terms[0]);
+    const __m256i first = _mm256_set1_epi32(terms[1]);
+    const __m256i second = _mm256_set1_epi32(terms[2]);
+    const __m256i both = _mm256_set1_epi32(terms[3]);
+    const __m256i select = _mm256_setr_epi32(24, 25, 26, 27, 28, 29, 30, 31);
+    for (uint32_t x = 0; x < 64; x += 8) {
+        const __m256i m0 = _mm256_srai_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(bits0 >> (56 - x) & 0xFF), select), 31);
+        __m256i pixels = _mm256_xor_si256(bg, _mm256_and_si256(first, m0));
+        if (bits1) {
+            const __m256i m1 =
+                _mm256_srai_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(bits1 >> (56 - x) & 0xFF), select), 31);
+            pixels = _mm256_xor_si256(pixels, _mm256_and_si256(second, m1));
+            pixels = _mm256_xor_si256(pixels, _mm256_and_si256(both, _mm256_and_si256(m0, m1)));
+        }
+        _mm256_storeu_si256((__m256i *)&out[x], pixels);
+    }
+}
+
+// Two rows per vector, with an odd last row done on its own.
+__attribute__((target("avx2")))
+static display_row_t xor_rows_avx2(display_row_t *rows, const display_row_t *sprite, uint32_t count) {
+    __m256i collision = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m256i row = _mm256_loadu_si256((const __m256i *)&rows[i]);
+        const __m256i bits = _mm256_loadu_si256((const __m256i *)&sprite[i]);
+        collision = _mm256_or_si256(collision, _mm256_and_si256(row, bits));
+        _mm256_storeu_si256((__m256i *)&rows[i], _mm256_xor_si256(row, bits));
+    }
+    __m128i both = _mm_or_si128(_mm256_castsi256_si128(collision), _mm256_extracti128_si256(collision, 1));
+    if (i < count) {
+        const __m128i row = _mm_loadu_si128((const __m128i *)&rows[i]);
+        const __m128i bits = _mm_loadu_si128((const __m128i *)&sprite[i]);
+        both = _mm_or_si128(both, _mm_and_si128(row, bits));
+        _mm_storeu_si128((__m128i *)&rows[i], _mm_xor_si128(row, bits));
+    }
+    display_row_t result;
+    _mm_storeu_si128((__m128i *)&result, both);
+    return result;
+}
+
+// The 256 bit byte shifts work within each 128 bit half, i.e. within each row.
+__attribute__((target("avx2")))
+static void shift_rows_avx2(display_row_t *rows, uint32_t count, bool right, display_row_t mask) {
+    const __m128i keep = _mm_loadu_si128((const __m128i *)&mask);
+    const __m256i keep2 = _mm256_broadcastsi128_si256(keep);
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m256i row = _mm256_loadu_si256((const __m256i *)&rows[i]);
+        const __m256i shifted =
+            right ? _mm256_or_si256(_mm256_srli_epi64(row, 4), _mm256_slli_epi64(_mm256_srli_si256(row, 8), 60))
+                  : _mm256_or_si256(_mm256_slli_epi64(row, 4), _mm256_srli_epi64(_mm256_slli_si256(row, 8), 60));
+        _mm256_storeu_si256((__m256i *)&rows[i], _mm256_and_si256(shifted, keep2));
+    }
+    if (i < count) {
+        const __m128i row = _mm_loadu_si128((const __m128i *)&rows[i]);
+        _mm_storeu_si128((__m128i *)&rows[i], _mm_and_si128(shift_row_sse2(row, right), keep));
+    }
+}
+
+static const simd_t sse2_backend = {"sse2", expand_sse2, xor_rows_sse2, shift_rows_sse2};
+static const simd_t avx2_backend = {"avx2", expand_avx2, xor_rows_avx2, shift_rows_avx2};
+#endif
+
+#if SIMD_NEON
+// Four pixels per vector, each lane testing its own bit of a broadcast nibble.
+static void expand_neon(uint64_t bits0, uint64_t bits1, uint32_t out[64], const uint32_t palette[4]) {
+    static const uint32_t lanes[4] = {8, 4, 2, 1};
+    uint32_t terms[4];
+    palette_terms(palette, terms);
+    const uint32x4_t bg = vdupq_n_u32(terms[0]);
+    const uint32x4_t first = vdupq_n_u32(terms[1]);
+    const uint32x4_t second = vdupq_n_u32(terms[2]);
+    const uint32x4_t both = vdupq_n_u32(terms[3]);
+    const uint32x4_t select = vld1q_u32(lanes);
+    for (uint32_t x = 0; x < 64; x += 4) {
+        const uint32x4_t m0 = vtstq_u32(vdupq_n_u32(bits0 >> (60 - x) & 0xF), select);
+        uint32x4_t pixels = veorq_u32(bg, vandq_u32(first, m0));
+        if (bits1) {
+            const uint32x4_t m1 = vtstq_u32(vdupq_n_u32(bits1 >> (60 - x) & 0xF), select);
+            pixels = veorq_u32(pixels, vandq_u32(second, m1));
+            pixels = veorq_u32(pixels, vandq_u32(both, vandq_u32(m0, m1)));
+        }
+        vst1q_u32(&out[x], pixels);
+    }
+}
+
+static display_row_t xor_rows_neon(display_row_t *rows, const display_row_t *sprite, uint32_t count) {
+    uint64x2_t collision = vdupq_n_u64(0);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint64x2_t row = vld1q_u64((const uint64_t *)&rows[i]);
+        const uint64x2_t bits = vld1q_u64((const uint64_t *)&sprite[i]);
+        collision = vorrq_u64(collision, vandq_u64(row, bits));
+        vst1q_u64((uint64_t *)&rows[i], veorq_u64(row, bits));
+    }
+    display_row_t result;
+    vst1q_u64((uint64_t *)&result, collision);
+    return result;
+}
+
+// vext moves one half of the row next to a zero half, which carries the 4 bits
+// crossing between the halves.
+static void shift_rows_neon(display_row_t *rows, uint32_t count, bool right, display_row_t mask) {
+    const uint64x2_t keep = vld1q_u64((const uint64_t *)&mask);
+    const uint64x2_t zero = vdupq_n_u64(0);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint64x2_t row = vld1q_u64((const uint64_t *)&rows[i]);
+        const uint64x2_t shifted = right ? vorrq_u64(vshrq_n_u64(row, 4), vshlq_n_u64(vextq_u64(row, zero, 1), 60))
+                                         : vorrq_u64(vshlq_n_u64(row, 4), vshrq_n_u64(vextq_u64(zero, row, 1), 60));
+        vst1q_u64((uint64_t *)&rows[i], vandq_u64(shifted, keep));
+    }
+}
+
+static const simd_t neon_backend = {"neon", expand_neon, xor_rows_neon, shift_rows_neon};
+#endif
+
+uint32_t simd_backends(const simd_t *backends[SIMD_MAX_BACKENDS]) {
+    uint32_t count = 0;
+    backends[count++] = &scalar_backend;
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) backends[count++] = &sse2_backend;
+    if (__builtin_cpu_supports("avx2")) backends[count++] = &avx2_backend;
+#elif SIMD_NEON
+    backends[count++] = &neon_backend;
+#endif
+    return count;
+}
+
+const simd_t *simd_get(void) {
+    static const simd_t *selected; // Threads racing here all pick the same backend
+    const simd_t *simd = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (simd) return simd;
+    const simd_t *backends[SIMD_MAX_BACKENDS];
+    const uint32_t count = simd_backends(backends);
+    simd = backends[count - 1];
+    const char *name = getenv("CHIP8_SIMD");
+    if (name) {
+        uint32_t i = 0;
+        while (i < count && strcmp(backends[i]->name, name) != 0) i++;
+        if (i < count) simd = backends[i];
+        else fprintf(stderr, "CHIP8_SIMD=%s is not available here, using %s\n", name, simd->name);
+    }
+    __atomic_store_n(&selected, simd, __ATOMIC_RELEASE);
+    return simd;
+}
@@ -0,0 +1,33 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "./chip8.h"
+
+// The pixel kernels, once per instruction set: plain C everywhere, SSE2 and
+// AVX2 on x86, NEON on ARM. The x86 versions are compiled with target
+// attributes and chosen from CPUID on first use, so a plain -O2 build runs the
+// best one the host has. NEON is part of every AArch64 CPU and is chosen at
+// compile time. $CHIP8_SIMD names a backend to use instead, e.g. scalar.
+
+typedef struct {
+    const char *name;
+    // Expands 64 pixels to palette colors; bit 63 of bits0 and bits1 are the
+    // first pixel's plane bits. palette[] as render_rows() takes it.
+    void (*expand)(uint64_t bits0, uint64_t bits1, uint32_t out[64], const uint32_t palette[4]);
+    // XORs sprite[i] into rows[i] and returns the bits that were on in both.
+    display_row_t (*xor_rows)(display_row_t *rows, const display_row_t *sprite, uint32_t count);
+    // Shifts each row 4 pixels right or left, keeping only the bits in mask.
+    void (*shift_rows)(display_row_t *rows, uint32_t count, bool right, display_row_t mask);
+} simd_t;
+
+#define SIMD_MAX_BACKENDS 4
+
+// The backend in use.
+const simd_t *simd_get(void);
+// Every backend this build can run on this CPU, scalar first and the one
+// simd_get() prefers last. Returns how many.
+uint32_t simd_backends(const simd_t *backends[SIMD_MAX_BACKENDS]);
+
+#endif
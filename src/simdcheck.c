@@ -0,0 +1,119 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "./simd.h"
+
+// Checks every SIMD backend the host can run against the scalar one on random
+// rows, sprites and palettes, then times each kernel. Exits non-zero on the
+// first mismatch.
+//
+//   expand  ns per 64 pixels, both with and without a second plane
+//   xor     ns per sprite row drawn
+//   shift   ns per row scrolled
+
+#define CHECK_ROUNDS 20000
+#define TIME_ROUNDS 200000
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+// xorshift64, with runs of zero bits mixed in so empty rows and empty halves get tested too.
+static uint64_t random_u64(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    const uint64_t value = rng_state;
+    switch (value & 7) {
+        case 0: return 0;
+        case 1: return value & 0xFF00000000000000ull;
+        case 2: return ~(uint64_t)0;
+        default: return value;
+    }
+}
+
+static display_row_t random_row(void) {
+    return (display_row_t)random_u64() << 64 | random_u64();
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool check_backend(const simd_t *scalar, const simd_t *simd) {
+    static const display_row_t lores_screen = ~(display_row_t)0 << 64;
+    for (uint32_t round = 0; round < CHECK_ROUNDS; round++) {
+        uint32_t palette[4];
+        for (int i = 0; i < 4; i++) palette[i] = random_u64();
+        const uint64_t bits0 = random_u64(), bits1 = random_u64();
+        uint32_t expected[64], got[64];
+        scalar->expand(bits0, bits1, expected, palette);
+        simd->expand(bits0, bits1, got, palette);
+        if (memcmp(expected, got, sizeof got) != 0) {
+            fprintf(stderr, "simd: %s expand differs for %016llx %016llx\n", simd->name,
+                (unsigned long long)bits0, (unsigned long long)bits1);
+            return false;
+        }
+
+        display_row_t rows[2][17], sprite[17];
+        const uint32_t count = 1 + round % 17; // Odd and even counts reach every tail
+        for (uint32_t i = 0; i < count; i++) {
+            rows[0][i] = rows[1][i] = random_row();
+            sprite[i] = random_row();
+        }
+        const display_row_t want = scalar->xor_rows(rows[0], sprite, count);
+        const display_row_t have = simd->xor_rows(rows[1], sprite, count);
+        if (want != have || memcmp(rows[0], rows[1], count * sizeof rows[0][0]) != 0) {
+            fprintf(stderr, "simd: %s xor_rows differs on %u rows\n", simd->name, count);
+            return false;
+        }
+
+        const bool right = round & 1;
+        const display_row_t mask = round & 2 ? lores_screen : ~(display_row_t)0;
+        scalar->shift_rows(rows[0], count, right, mask);
+        simd->shift_rows(rows[1], count, right, mask);
+        if (memcmp(rows[0], rows[1], count * sizeof rows[0][0]) != 0) {
+            fprintf(stderr, "simd: %s shift_rows %s differs on %u rows\n", simd->name, right ? "right" : "left", count);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void time_backend(const simd_t *simd, bool preferred) {
+    static const uint32_t palette[4] = {0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555};
+    static uint32_t pixels[64];
+    static display_row_t rows[DISPLAY_HIRES_HEIGHT], sprite[16];
+    for (uint32_t i = 0; i < DISPLAY_HIRES_HEIGHT; i++) rows[i] = random_row();
+    for (uint32_t i = 0; i < 16; i++) sprite[i] = random_row();
+    double start = now_s();
+    for (uint32_t i = 0; i < TIME_ROUNDS; i++) simd->expand(rows[i & 63] >> 64, 0, pixels, palette);
+    const double expand1_ns = (now_s() - start) * 1e9 / TIME_ROUNDS;
+    start = now_s();
+    for (uint32_t i = 0; i < TIME_ROUNDS; i++) simd->expand(rows[i & 63] >> 64, rows[i & 63], pixels, palette);
+    const double expand2_ns = (now_s() - start) * 1e9 / TIME_ROUNDS;
+    display_row_t collision = 0;
+    start = now_s();
+    for (uint32_t i = 0; i < TIME_ROUNDS; i++) collision |= simd->xor_rows(&rows[i & 31], sprite, 16);
+    const double xor_ns = (now_s() - start) * 1e9 / TIME_ROUNDS / 16;
+    start = now_s();
+    for (uint32_t i = 0; i < TIME_ROUNDS / 16; i++) simd->shift_rows(rows, DISPLAY_HIRES_HEIGHT, i & 1, ~(display_row_t)0);
+    const double shift_ns = (now_s() - start) * 1e9 / (TIME_ROUNDS / 16) / DISPLAY_HIRES_HEIGHT;
+    printf("simd: %-6s ok  expand %.2f ns (%.2f ns two planes)  xor %.2f ns  shift %.2f ns%s\n", simd->name,
+        expand1_ns, expand2_ns, xor_ns, shift_ns, preferred ? "  [in use]" : "");
+    if (collision == 1) printf("\n"); // Keeps the timed loop from being optimized away
+}
+
+int main(void) {
+    const simd_t *backends[SIMD_MAX_BACKENDS];
+    const uint32_t count = simd_backends(backends);
+    const simd_t *in_use = simd_get();
+    for (uint32_t i = 0; i < count; i++) {
+        if (!check_backend(backends[0], backends[i])) exit(EXIT_FAILURE);
+        time_backend(backends[i], backends[i] == in_use);
+    }
+    return 0;
+}
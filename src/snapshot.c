@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include "./snapshot.h"
+#include "./delta.h"
+
+_Static_assert(SNAPSHOT_HEADER_SIZE % 16 == 0, "no padding between the header and the RAM");
+
+// CHIP-8 and SUPER-CHIP only address the first 4 KiB.
+static size_t ram_size(uint8_t model) {
+    return model == MODEL_XOCHIP ? RAM_SIZE : 0x1000;
+}
+
+size_t snapshot_size(const chip8_snapshot_t *snap) {
+    return SNAPSHOT_HEADER_SIZE + ram_size(snap->quirks.model);
+}
+
+void snapshot_save(const chip8_t *chip8, chip8_snapshot_t *snap) {
+    memset(snap, 0, SNAPSHOT_HEADER_SIZE); // Zero the reserved bytes too, so deltas and hashes are stable
+    snap->magic = SNAPSHOT_MAGIC;
+    snap->version = SNAPSHOT_VERSION;
+    snap->cycles = chip8->cycles;
+    memcpy(snap->display, chip8->display, sizeof snap->display);
+    snap->rng_state = chip8->rng_state;
+    memcpy(snap->stack, chip8->stack, sizeof snap->stack);
+    snap->PC = chip8->PC;
+    snap->reg_i = chip8->reg_i;
+    memcpy(snap->ram, chip8->ram, ram_size(chip8->quirks.model));
+    memcpy(snap->V, chip8->V, sizeof snap->V);
+    for (int i = 0; i < 16; i++) snap->keypad[i] = chip8->keypad[i];
+    memcpy(snap->flags, chip8->flags, sizeof snap->flags);
+    memcpy(snap->audio_pattern, chip8->audio_pattern, sizeof snap->audio_pattern);
+    snap->sp = chip8->sp;
+    snap->delay_timer = chip8->delay_timer;
+    snap->sound_timer = chip8->sound_timer;
+    snap->key_wait_active = chip8->key_wait_active;
+    snap->key_wait_key = chip8->key_wait_key;
+    snap->hires = chip8->hires;
+    snap->planes = chip8->planes;
+    snap->pitch = chip8->pitch;
+    snap->quirks = chip8->quirks;
+    snap->fault = chip8->fault;
+    snap->fault_pc = chip8->fault_pc;
+}
+
+// Snapshots also come from files and over the network, so anything the core
+// would index with or switch on has to be in range before it gets there.
+static bool snapshot_valid(const chip8_snapshot_t *snap) {
+    if (snap->magic != SNAPSHOT_MAGIC) {
+        fprintf(stderr, "Not a snapshot (bad magic number %08x)\n", snap->magic);
+        return false;
+    }
+    if (snap->version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "Snapshot version %u is not supported (expected %u)\n", snap->version, SNAPSHOT_VERSION);
+        return false;
+    }
+    // quirks_t is a model byte followed by bools, which must be 0 or 1
+    const uint8_t *quirk_bytes = (const uint8_t *)&snap->quirks;
+    bool quirks_ok = snap->quirks.model <= MODEL_XOCHIP;
+    for (size_t i = 1; i < sizeof snap->quirks; i++) quirks_ok = quirks_ok && quirk_bytes[i] <= 1;
+    if (!quirks_ok || snap->sp > STACK_SIZE || snap->key_wait_key > 0x0F || snap->key_wait_active > 1
+        || snap->hires > 1 || (snap->planes & ~3)) {
+        fprintf(stderr, "Snapshot is corrupt\n");
+        return false;
+    }
+    return true;
+}
+
+bool snapshot_load(chip8_t *chip8, const chip8_snapshot_t *snap) {
+    if (!snapshot_valid(snap)) return false;
+    const size_t ram = ram_size(snap->quirks.model);
+    // An instruction is stale if either of its two bytes changed; code only runs from the first
+    // 4 KiB, plus the byte at 0x1000 the instruction at 0xFFF reads on XO-CHIP
+    for (uint32_t addr = 0; addr < 0x1000 + (ram > 0x1000); addr++) {
+        if (chip8->ram[addr] == snap->ram[addr]) continue;
+        if (addr < 0x1000) chip8->icache[addr].op = OP_UNDECODED;
+        chip8->icache[(addr - 1) & 0x0FFF].op = OP_UNDECODED;
+    }
+    chip8->cycles = snap->cycles;
+    memcpy(chip8->display, snap->display, sizeof chip8->display);
+    chip8->rng_state = snap->rng_state;
+    memcpy(chip8->stack, snap->stack, sizeof chip8->stack);
+    chip8->PC = snap->PC;
+    chip8->reg_i = snap->reg_i;
+    memcpy(chip8->ram, snap->ram, ram);
+    // RAM the new model can't address is cleared, so it can't come back on a switch to XO-CHIP
+    if ((size_t)chip8->ram_mask + 1 > ram) memset(&chip8->ram[ram], 0, (size_t)chip8->ram_mask + 1 - ram);
+    memcpy(chip8->V, snap->V, sizeof chip8->V);
+    for (int i = 0; i < 16; i++) chip8->keypad[i] = snap->keypad[i];
+    memcpy(chip8->flags, snap->flags, sizeof chip8->flags);
+    memcpy(chip8->audio_pattern, snap->audio_pattern, sizeof chip8->audio_pattern);
+    chip8->sp = snap->sp;
+    chip8->delay_timer = snap->delay_timer;
+    chip8->sound_timer = snap->sound_timer;
+    chip8->key_wait_active = snap->key_wait_active;
+    chip8->key_wait_key = snap->key_wait_key;
+    chip8->hires = snap->hires;
+    chip8->planes = snap->planes;
+    chip8->pitch = snap->pitch;
+    chip8->quirks = snap->quirks;
+    chip8->fault = snap->fault;
+    chip8->fault_pc = snap->fault_pc;
+    chip8->ram_mask = ram - 1;
+    chip8->draw = true;
+    return true;
+}
+
+bool snapshot_write_file(const char *path, const chip8_snapshot_t *snap) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+        return false;
+    }
+    const bool ok = fwrite(snap, snapshot_size(snap), 1, file) == 1;
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Could not write snapshot to %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool snapshot_read_file(const char *path, chip8_snapshot_t *snap) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Snapshot file %s is invalid\n", path);
+        return false;
+    }
+    bool ok = fread(snap, SNAPSHOT_HEADER_SIZE, 1, file) == 1 && snap->magic == SNAPSHOT_MAGIC;
+    if (ok) ok = fread(snap->ram, snapshot_size(snap) - SNAPSHOT_HEADER_SIZE, 1, file) == 1;
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "%s is not a snapshot\n", path);
+        return false;
+    }
+    return true;
+}
+
+size_t snapshot_delta_encode(const void *base, const chip8_snapshot_t *snap, uint8_t *out) {
+    return delta_encode(base, snap, snapshot_size(snap), out);
+}
+
+void snapshot_delta_apply(chip8_snapshot_t *base, const uint8_t *delta, size_t size) {
+    delta_apply(base, delta, size);
+}
@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "./chip8.h"
+#include "./delta.h"
+
+// Pointer-free copy of everything that makes up the machine state. Saving and
+// loading are a handful of memcpys; the same bytes are written to disk as is
+// (host byte order), and the rewind buffer stores XOR deltas between them.
+// Fields are ordered so the struct has no padding. RAM comes last and only the
+// part the model addresses is in use, so a CHIP-8 snapshot is snapshot_size()
+// bytes rather than the whole struct.
+
+#define SNAPSHOT_MAGIC 0x53384843u // "CH8S" in little endian
+#define SNAPSHOT_VERSION 4 // Bump whenever the layout below changes
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t cycles;
+    display_row_t display[DISPLAY_PLANES][DISPLAY_HIRES_HEIGHT];
+    uint32_t rng_state;
+    uint16_t stack[STACK_SIZE];
+    uint16_t PC;
+    uint16_t reg_i;
+    uint8_t V[16];
+    uint8_t keypad[16];
+    uint8_t flags[16];
+    uint8_t audio_pattern[16];
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t key_wait_active;
+    uint8_t key_wait_key;
+    uint8_t hires;
+    uint8_t planes;
+    uint8_t pitch;
+    quirks_t quirks; // The machine a snapshot was taken on, so it comes back the same
+    uint16_t fault_pc;
+    uint8_t fault; // A fault is part of the timeline: restoring a state from before it clears it
+    uint8_t reserved[7]; // Rounds the header up to the display's alignment
+    uint8_t ram[RAM_SIZE]; // Only the first snapshot_size() - SNAPSHOT_HEADER_SIZE bytes are stored
+} chip8_snapshot_t;
+
+#define SNAPSHOT_HEADER_SIZE offsetof(chip8_snapshot_t, ram)
+
+// Bytes of snap in use: the header plus the RAM its model addresses.
+size_t snapshot_size(const chip8_snapshot_t *snap);
+void snapshot_save(const chip8_t *chip8, chip8_snapshot_t *snap);
+// Restores snap into chip8, or returns false and leaves chip8 alone when snap is
+// from another version or has out of range fields. Only the predecoded
+// instructions whose bytes differ are dropped, so the cache stays warm across
+// loads of similar states.
+// A JIT attached to chip8 has to be flushed by the caller.
+bool snapshot_load(chip8_t *chip8, const chip8_snapshot_t *snap);
+// Both only move the snapshot_size() bytes in use.
+bool snapshot_write_file(const char *path, const chip8_snapshot_t *snap);
+bool snapshot_read_file(const char *path, chip8_snapshot_t *snap);
+
+// Run-length encodes snap XOR base, both snapshot_size(snap) bytes, into out (at
+// least DELTA_MAX(snapshot_size(snap)) bytes) and returns the encoded size; a frame
+// that changed little encodes to a few bytes.
+size_t snapshot_delta_encode(const void *base, const chip8_snapshot_t *snap, uint8_t *out);
+// Turns base into the snapshot a delta was encoded from.
+void snapshot_delta_apply(chip8_snapshot_t *base, const uint8_t *delta, size_t size);
+
+#endif
@@ -0,0 +1,115 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "./trace.h"
+
+#define TRACE_RING_SIZE (1u << 22) // 4 MiB, must be a power of two
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+// Single producer (emulator thread), single consumer (writer thread) byte ring.
+// head and tail only ever grow; the ring index is the counter masked by the size.
+struct trace {
+    uint8_t ring[TRACE_RING_SIZE];
+    _Atomic uint64_t head; // Written by the producer only
+    _Atomic uint64_t tail; // Written by the consumer only
+    _Atomic bool stop;
+    uint64_t written; // Producer side counters
+    uint64_t dropped;
+    FILE *file;
+    pthread_t writer;
+};
+
+static void ring_copy_in(trace_t *trace, uint64_t pos, const void *src, size_t len) {
+    const size_t start = pos & TRACE_RING_MASK;
+    const size_t first = len < TRACE_RING_SIZE - start ? len : TRACE_RING_SIZE - start;
+    memcpy(&trace->ring[start], src, first);
+    memcpy(&trace->ring[0], (const uint8_t *)src + first, len - first);
+}
+
+// Writes out everything between tail and head; returns false when the ring was empty.
+static bool drain(trace_t *trace) {
+    const uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    const uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    if (head == tail) return false;
+    const size_t start = tail & TRACE_RING_MASK;
+    const size_t len = head - tail;
+    const size_t first = len < TRACE_RING_SIZE - start ? len : TRACE_RING_SIZE - start;
+    fwrite(&trace->ring[start], 1, first, trace->file);
+    fwrite(&trace->ring[0], 1, len - first, trace->file);
+    atomic_store_explicit(&trace->tail, head, memory_order_release);
+    return true;
+}
+
+static void *writer_main(void *arg) {
+    trace_t *trace = arg;
+    const struct timespec idle = {.tv_sec = 0, .tv_nsec = 1000000};
+    for (;;) {
+        if (drain(trace)) continue;
+        if (atomic_load_explicit(&trace->stop, memory_order_acquire)) {
+            drain(trace); // Pick up anything published right before stop was set
+            return NULL;
+        }
+        nanosleep(&idle, NULL);
+    }
+}
+
+trace_t *trace_open(const char *path) {
+    trace_t *trace = calloc(1, sizeof *trace);
+    if (!trace) return NULL;
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        fprintf(stderr, "Could not open trace file %s\n", path);
+        free(trace);
+        return NULL;
+    }
+    const trace_file_header_t header = {
+        .magic = TRACE_MAGIC, .version = TRACE_VERSION, .record_size = sizeof(trace_record_t),
+    };
+    fwrite(&header, sizeof header, 1, trace->file);
+    if (pthread_create(&trace->writer, NULL, writer_main, trace) != 0) {
+        fprintf(stderr, "Could not start trace writer thread\n");
+        fclose(trace->file);
+        free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+void trace_close(trace_t *trace) {
+    if (!trace) return;
+    atomic_store_explicit(&trace->stop, true, memory_order_release);
+    pthread_join(trace->writer, NULL);
+    fclose(trace->file);
+    if (trace->dropped) {
+        fprintf(stderr, "trace: %llu records written, %llu dropped (writer too slow)\n",
+            (unsigned long long)trace->written, (unsigned long long)trace->dropped);
+    }
+    free(trace);
+}
+
+void trace_write(trace_t *trace, uint16_t pc, uint16_t opcode, uint16_t reg_i,
+                 const uint8_t V_before[16], const uint8_t V_after[16]) {
+    uint8_t record[sizeof(trace_record_t) + 16];
+    trace_record_t header = {.pc = pc, .opcode = opcode, .reg_i = reg_i, .v_mask = 0};
+    size_t len = sizeof header;
+    for (int i = 0; i < 16; i++) {
+        if (V_before[i] != V_after[i]) {
+            header.v_mask |= 1u << i;
+            record[len++] = V_after[i];
+        }
+    }
+    memcpy(record, &header, sizeof header);
+
+    const uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    const uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+    if (TRACE_RING_SIZE - (head - tail) < len) {
+        trace->dropped++;
+        return;
+    }
+    ring_copy_in(trace, head, record, len);
+    atomic_store_explicit(&trace->head, head + len, memory_order_release);
+    trace->written++;
+}
@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Instruction tracing. Compiled in by default and gated at runtime by
+// chip8->trace being non-NULL; build with -DCHIP8_NO_TRACE to remove it entirely.
+#ifndef CHIP8_NO_TRACE
+#define CHIP8_TRACE 1
+#else
+#define CHIP8_TRACE 0
+#endif
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+
+// On-disk and in-ring record. The header is followed by one byte per set bit
+// in v_mask: the new value of each V register the instruction changed, V0 first.
+typedef struct {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t reg_i; // I after the instruction ran
+    uint16_t v_mask; // Bit n set when Vn changed
+} trace_record_t;
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size; // sizeof(trace_record_t), so the decoder can sanity check
+} trace_file_header_t;
+
+typedef struct trace trace_t;
+
+// Opens path for writing and starts the background writer thread.
+trace_t *trace_open(const char *path);
+// Flushes everything still in the ring, stops the writer and reports dropped records.
+void trace_close(trace_t *trace);
+// Called by the emulator thread after each instruction. Never blocks: if the
+// writer can't keep up, the record is dropped and counted instead.
+void trace_write(trace_t *trace, uint16_t pc, uint16_t opcode, uint16_t reg_i,
+                 const uint8_t V_before[16], const uint8_t V_after[16]);
+
+#endif
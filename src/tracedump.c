@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./disasm.h"
+#include "./trace.h"
+
+// Offline decoder for traces written by trace.c: turns the binary records
+// back into one line of text per executed instruction.
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage %s <trace_file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Could not open trace file %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    trace_file_header_t header;
+    if (fread(&header, sizeof header, 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not a chip8 trace\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "Unsupported trace version %u\n", header.version);
+        exit(EXIT_FAILURE);
+    }
+
+    trace_record_t record;
+    uint64_t count = 0;
+    char text[32];
+    while (fread(&record, sizeof record, 1, in) == 1) {
+        disassemble(record.opcode, text, sizeof text);
+        printf("%10llu  0x%04X: %04X  %-16s I=0x%04X",
+            (unsigned long long)count++, record.pc, record.opcode, text, record.reg_i);
+        for (int i = 0; i < 16; i++) {
+            if (!(record.v_mask & (1u << i))) continue;
+            const int value = fgetc(in);
+            if (value == EOF) {
+                fprintf(stderr, "\nTruncated record at instruction %llu\n", (unsigned long long)count - 1);
+                exit(EXIT_FAILURE);
+            }
+            printf(" V%X=0x%02X", i, value);
+        }
+        putchar('\n');
+    }
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./triple_buffer.h"
+
+#define CACHE_LINE 64
+#define TRIPLE_BUFFER_FRESH 0x80 // Set in middle when it holds a slot the reader hasn't taken yet
+#define TRIPLE_BUFFER_INDEX 0x03
+
+bool triple_buffer_init(triple_buffer_t *tb, size_t slot_size) {
+    *tb = (triple_buffer_t){0};
+    tb->slot_size = (slot_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    tb->slots = aligned_alloc(CACHE_LINE, 3 * tb->slot_size);
+    if (!tb->slots) {
+        fprintf(stderr, "Could not allocate the frame buffers\n");
+        return false;
+    }
+    memset(tb->slots, 0, 3 * tb->slot_size);
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+    return true;
+}
+
+void triple_buffer_free(triple_buffer_t *tb) {
+    free(tb->slots);
+    tb->slots = NULL;
+}
+
+void *triple_buffer_back(triple_buffer_t *tb) {
+    return &tb->slots[tb->back * tb->slot_size];
+}
+
+void triple_buffer_publish(triple_buffer_t *tb) {
+    // Release makes the slot's contents visible before the reader can take it
+    const uint8_t spare = __atomic_exchange_n(&tb->middle, tb->back | TRIPLE_BUFFER_FRESH, __ATOMIC_ACQ_REL);
+    tb->back = spare & TRIPLE_BUFFER_INDEX;
+}
+
+const void *triple_buffer_take(triple_buffer_t *tb) {
+    if (!(__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & TRIPLE_BUFFER_FRESH)) return NULL;
+    const uint8_t latest = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+    tb->front = latest & TRIPLE_BUFFER_INDEX;
+    return &tb->slots[tb->front * tb->slot_size];
+}
@@ -0,0 +1,31 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single producer, single consumer triple buffer. The writer always has
+// a slot of its own to fill and the reader always has one to read, so neither
+// ever waits for the other; publishing just swaps the writer's slot with the
+// spare one, and the reader picks up whichever was published last. Frames the
+// reader didn't get to in time are dropped, never queued.
+
+typedef struct {
+    uint8_t *slots;
+    size_t slot_size; // Rounded up to a cache line so the slots don't share one
+    uint8_t back; // Writer's slot
+    uint8_t front; // Reader's slot
+    uint8_t middle; // Spare slot plus TRIPLE_BUFFER_FRESH, only ever swapped atomically
+} triple_buffer_t;
+
+bool triple_buffer_init(triple_buffer_t *tb, size_t slot_size);
+void triple_buffer_free(triple_buffer_t *tb);
+// Writer side: fill this slot, then publish it. The slot returned changes with every publish.
+void *triple_buffer_back(triple_buffer_t *tb);
+void triple_buffer_publish(triple_buffer_t *tb);
+// Reader side: the slot published most recently, or NULL when nothing was published
+// since the last call. Stays valid until the next call.
+const void *triple_buffer_take(triple_buffer_t *tb);
+
+#endif
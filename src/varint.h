@@ -0,0 +1,30 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LEB128-style unsigned varints: 7 bits per byte, high bit set on all but the last.
+#define VARINT_MAX 10 // Bytes needed for a full uint64_t
+
+static inline size_t varint_put(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Returns the number of bytes read, or 0 if the varint runs past size.
+static inline size_t varint_get(const uint8_t *in, size_t size, uint64_t *value) {
+    *value = 0;
+    for (size_t n = 0; n < size && n < VARINT_MAX; n++) {
+        *value |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) return n + 1;
+    }
+    return 0;
+}
+
+#endif